@@ -0,0 +1,143 @@
+/*
+ * Drives a circuit breaker (src/px_breaker.c) through an outage of a stand-in endpoint and checks the share of
+ * requests its ramp admits after recovery, for the linear and the exponential curve.
+ *
+ * The stand-in fails for the first 500ms and is healthy from then on. A request arrives every 100us and the monitor
+ * ticks every 10ms, like the service monitor thread. Both curves have to trip once, start near 1/128, grow over the
+ * ramp, admit everything once it is over, and the exponential curve has to stay well below the linear one halfway.
+ *
+ * build: gcc -std=gnu99 -O2 -Isrc $(apr-1-config --includes) contrib/breaker_ramp.c src/px_breaker.c \
+ *            src/px_histogram.c $(apr-1-config --link-ld) -lcurl -o breaker_ramp
+ * usage: ./breaker_ramp
+ */
+#include <stdio.h>
+#include <unistd.h>
+
+#include <apr_atomic.h>
+#include <apr_general.h>
+
+#include "px_breaker.h"
+
+#define RAMP_MS 1000
+#define RAMP_BUCKETS 10
+#define RUN_MS 3000
+#define RECOVER_MS 500
+
+typedef struct ramp_run_t {
+    apr_uint32_t requests[RAMP_BUCKETS];
+    apr_uint32_t admitted[RAMP_BUCKETS];
+    apr_uint32_t closed_requests;
+    apr_uint32_t closed_admitted;
+    apr_uint32_t trips;
+    px_breaker_state state;
+} ramp_run;
+
+static apr_uint32_t percent(apr_uint32_t part, apr_uint32_t whole) {
+    return whole ? part * 100 / whole : 0;
+}
+
+static void run(bool exponential, ramp_run *out) {
+    px_breaker_options options = {
+        .window = apr_time_from_msec(1000),
+        .min_errors = 20,
+        .error_rate = 50,
+        .probe_min = apr_time_from_msec(100),
+        .probe_max = apr_time_from_msec(400),
+        .ramp = apr_time_from_msec(RAMP_MS),
+        .ramp_exponential = exponential,
+    };
+    px_breaker breaker = { 0 };
+    px_breaker_init(&breaker, &options);
+
+    apr_time_t start = apr_time_now();
+    apr_time_t recover = start + apr_time_from_msec(RECOVER_MS);
+    apr_time_t next_tick = start;
+    bool was_half_open = false;
+    for (apr_time_t now = start; now < start + apr_time_from_msec(RUN_MS); now = apr_time_now()) {
+        if (now >= next_tick) {
+            px_breaker_tick(&breaker, now);
+            if (px_breaker_probe_due(&breaker, now)) {
+                px_breaker_probe_done(&breaker, now >= recover, now);
+            }
+            next_tick = now + apr_time_from_msec(10);
+        }
+        px_breaker_state state = apr_atomic_read32(&breaker.state);
+        bool admitted = px_breaker_admit(&breaker);
+        if (state == PX_BREAKER_HALF_OPEN) {
+            int bucket = (int)((now - breaker.half_open_since) * RAMP_BUCKETS / apr_time_from_msec(RAMP_MS));
+            if (bucket < RAMP_BUCKETS) {
+                out->requests[bucket]++;
+                out->admitted[bucket] += admitted;
+            }
+            was_half_open = true;
+        } else if (state == PX_BREAKER_CLOSED && was_half_open) {
+            out->closed_requests++;
+            out->closed_admitted += admitted;
+        }
+        if (admitted) {
+            px_breaker_record(&breaker, now >= recover ? CURLE_OK : CURLE_COULDNT_CONNECT, 0.001);
+        }
+        usleep(100);
+    }
+    out->trips = breaker.trips;
+    out->state = apr_atomic_read32(&breaker.state);
+
+    printf("%s: trips %u, probes %u, ramped %u\n", exponential ? "exponential" : "linear", breaker.trips, breaker.probes, breaker.ramped);
+    for (int i = 0; i < RAMP_BUCKETS; ++i) {
+        printf("  %4d ms %3u%% of %u\n", i * RAMP_MS / RAMP_BUCKETS, percent(out->admitted[i], out->requests[i]), out->requests[i]);
+    }
+    printf("  closed %3u%% of %u\n", percent(out->closed_admitted, out->closed_requests), out->closed_requests);
+}
+
+// returns the number of failed checks
+static int check_curve(const char *name, const ramp_run *r) {
+    int failed = 0;
+    if (r->trips != 1 || r->state != PX_BREAKER_CLOSED) {
+        printf("%s: expected one trip and a closed breaker\n", name);
+        failed++;
+    }
+    if (r->requests[0] == 0 || percent(r->admitted[0], r->requests[0]) > 5) {
+        printf("%s: the ramp has to start near 1/128\n", name);
+        failed++;
+    }
+    // the admitted share of a bucket is its average, a few points of slack cover the tick granularity
+    for (int i = 1; i < RAMP_BUCKETS; ++i) {
+        if (percent(r->admitted[i], r->requests[i]) + 2 < percent(r->admitted[i - 1], r->requests[i - 1])) {
+            printf("%s: admitted share shrinks at %d ms\n", name, i * RAMP_MS / RAMP_BUCKETS);
+            failed++;
+        }
+    }
+    if (r->closed_requests == 0 || r->closed_admitted != r->closed_requests) {
+        printf("%s: requests turned away after the ramp\n", name);
+        failed++;
+    }
+    return failed;
+}
+
+int main(void) {
+    ramp_run linear = { { 0 } }, exponential = { { 0 } };
+    apr_initialize();
+    run(false, &linear);
+    run(true, &exponential);
+
+    int failed = check_curve("linear", &linear) + check_curve("exponential", &exponential);
+    // halfway the linear curve admits about half of the requests, the exponential one about 1/128 * 2^3.5
+    int half = RAMP_BUCKETS / 2;
+    apr_uint32_t linear_half = percent(linear.admitted[half], linear.requests[half]);
+    apr_uint32_t exponential_half = percent(exponential.admitted[half], exponential.requests[half]);
+    if (linear_half < 40 || linear_half > 70) {
+        printf("linear: %u%% admitted halfway\n", linear_half);
+        failed++;
+    }
+    if (exponential_half * 2 > linear_half) {
+        printf("exponential: %u%% admitted halfway, linear %u%%\n", exponential_half, linear_half);
+        failed++;
+    }
+    apr_terminate();
+    if (failed) {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
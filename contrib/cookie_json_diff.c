@@ -0,0 +1,244 @@
+/*
+ * Differential test of the cookie JSON decoder (src/px_cookie_json.c) against jansson.
+ *
+ * Every payload the decoder accepts must be accepted by jansson with the same fields, payloads it rejects go through
+ * jansson in the module. The payloads below cover both cookie versions with escapes, unicode, reordered, missing,
+ * duplicate and extra fields and odd numbers, followed by random mutations of valid cookies.
+ *
+ * build: gcc -std=gnu99 -O2 -Isrc $(apxs -q CFLAGS) -I$(apxs -q INCLUDEDIR) $(apr-1-config --includes) \
+ *            contrib/cookie_json_diff.c src/px_cookie_json.c src/px_json_scan.c \
+ *            $(apr-1-config --link-ld) -ljansson -o cookie_json_diff
+ * usage: ./cookie_json_diff [mutations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+
+#include "px_cookie_json.h"
+
+typedef struct payload_case_t {
+    int version;
+    const char *json;
+} payload_case;
+
+static const payload_case cases[] = {
+    // plain cookies, taken by the decoder
+    { 3, "{\"u\":\"2b1d2a10-e30e-11e7-9fc6-6f721d4b631d\",\"v\":\"7f803340-9d42-11e7-83a5-8f78028be852\",\"t\":1513504354651,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"v\":\"vid\",\"u\":\"uuid\",\"s\":100,\"t\":1,\"a\":\"b\"}" },
+    { 3, " { \"a\" : \"c\" ,\n\t\"t\" : 1513504354651 , \"s\" : -5 , \"u\" : \"\" , \"v\" : \"vid\" } " },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":-1513504354651,\"s\":2147483647,\"a\":\"j\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":999999999999999999,\"s\":-2147483648,\"a\":\"c\"}" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1513504354651,\"s\":{\"a\":0,\"b\":0},\"h\":\"deadbeef\"}" },
+    { 1, "{\"h\":\"deadbeef\",\"s\":{\"b\":100,\"a\":1},\"t\":1,\"v\":\"vid\",\"u\":\"uuid\"}" },
+    { 1, "{ \"s\" : { } , \"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"h\":\"x\"}" },
+    // escapes and unicode
+    { 3, "{\"u\":\"uu\\\"id\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"v\\u0069d\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\\/\\\\\\n\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"\xc3\xa9t\xc3\xa9\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"\\ud83d\\ude00\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"\\ud83d\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"a\\u0000b\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"\\u0075\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"tab\there\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":{\"a\":0,\"b\":0},\"h\":\"dead\\u0062eef\"}" },
+    // missing, duplicate and extra fields
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"s\":0,\"a\":\"c\"}" },
+    { 3, "{}" },
+    { 3, "{\"u\":\"uuid\",\"u\":\"other\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\",\"x\":1}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\",\"h\":\"hash\"}" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":{\"a\":0},\"h\":\"x\"}" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":{\"a\":0,\"b\":0,\"c\":0},\"h\":\"x\"}" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":{\"a\":0,\"b\":0},\"h\":\"x\",\"a\":\"c\"}" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"h\":\"x\"}" },
+    // numbers and types
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1.5,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1e3,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":01,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":-0,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":2147483648,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":9223372036854775807,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":9223372036854775808,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":\"1\",\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":null,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":true,\"a\":\"c\"}" },
+    { 3, "{\"u\":1,\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":+1,\"s\":0,\"a\":\"c\"}" },
+    // broken documents
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\",}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"}}" },
+    { 3, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":0,\"a\":\"c\"} x" },
+    { 3, "[\"u\",\"v\"]" },
+    { 3, "" },
+    { 1, "{\"u\":\"uuid\",\"v\":\"vid\",\"t\":1,\"s\":{\"a\":0,\"b\":0,},\"h\":\"x\"}" },
+};
+
+// the jansson decoding of parse_risk_payload1/parse_risk_payload3 in src/px_payload.c, without the request pool
+static bool reference_parse(const char *raw, int version, risk_payload *payload) {
+    json_error_t error;
+    json_t *j_payload = json_loads(raw, 0, &error);
+    if (!j_payload) {
+        return false;
+    }
+    char buf[30];
+    const char *vid, *uuid, *action, *hash;
+    json_int_t ts;
+    int score, a_val, b_val;
+    memset(payload, 0, sizeof(*payload));
+    if (version == 3) {
+        if (json_unpack(j_payload, "{s:s,s:s,s:i,s:I,s:s}", "v", &vid, "u", &uuid, "s", &score, "t", &ts, "a", &action)) {
+            json_decref(j_payload);
+            return false;
+        }
+        payload->score = score;
+        payload->action = strdup(action);
+    } else {
+        if (json_unpack(j_payload, "{s:s,s:s,s:{s:i,s:i},s:I,s:s}", "v", &vid, "u", &uuid, "s", "a", &a_val, "b", &b_val, "t", &ts, "h", &hash)) {
+            json_decref(j_payload);
+            return false;
+        }
+        payload->hash = strdup(hash);
+        payload->a_val = a_val;
+        payload->b_val = b_val;
+        payload->score = b_val;
+        snprintf(buf, sizeof(buf), "%d", a_val);
+        payload->a = strdup(buf);
+        snprintf(buf, sizeof(buf), "%d", b_val);
+        payload->b = strdup(buf);
+        payload->action = "c";
+    }
+    snprintf(buf, sizeof(buf), "%" JSON_INTEGER_FORMAT, ts);
+    payload->timestamp = strdup(buf);
+    payload->ts = ts;
+    payload->uuid = strdup(uuid);
+    payload->vid = strdup(vid);
+    json_decref(j_payload);
+    return true;
+}
+
+static bool str_equal(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static const char *payload_diff(const risk_payload *fast, const risk_payload *rp, int version) {
+    if (!str_equal(fast->timestamp, rp->timestamp) || fast->ts != rp->ts) {
+        return "timestamp";
+    }
+    if (!str_equal(fast->uuid, rp->uuid)) {
+        return "uuid";
+    }
+    if (!str_equal(fast->vid, rp->vid)) {
+        return "vid";
+    }
+    if (fast->score != rp->score) {
+        return "score";
+    }
+    if (!str_equal(fast->action, rp->action)) {
+        return "action";
+    }
+    if (version == 1 && (!str_equal(fast->hash, rp->hash) || !str_equal(fast->a, rp->a) || !str_equal(fast->b, rp->b)
+                || fast->a_val != rp->a_val || fast->b_val != rp->b_val)) {
+        return "score object or hash";
+    }
+    return NULL;
+}
+
+static void reference_free(risk_payload *rp, int version) {
+    free((void*)rp->timestamp);
+    free((void*)rp->uuid);
+    free((void*)rp->vid);
+    free((void*)rp->hash);
+    free((void*)rp->a);
+    free((void*)rp->b);
+    if (version == 3) {
+        free((void*)rp->action);
+    }
+}
+
+// returns false when the decoder accepted a payload jansson rejects or decodes differently
+static bool check(const char *raw, int version, bool verbose, int *accepted) {
+    size_t len = strlen(raw);
+    char *scratch = malloc(len + 1);
+    risk_payload fast, rp;
+    bool fast_ok = px_cookie_json_parse(raw, scratch, version, &fast);
+    bool ref_ok = reference_parse(raw, version, &rp);
+    bool ok = true;
+    if (fast_ok) {
+        const char *diff = ref_ok ? payload_diff(&fast, &rp, version) : "rejected by jansson";
+        if (diff) {
+            printf("v%d differs (%s): %s\n", version, diff, raw);
+            ok = false;
+        }
+        (*accepted)++;
+    }
+    if (verbose) {
+        printf("v%d %-8s %-8s %s\n", version, fast_ok ? "decoder" : "-", ref_ok ? "jansson" : "-", raw);
+    }
+    if (ref_ok) {
+        reference_free(&rp, version);
+    }
+    free(scratch);
+    return ok;
+}
+
+// bytes a mutation inserts or overwrites with, json punctuation is picked more often than the rest
+static char mutation_byte(void) {
+    static const char interesting[] = "{}[]\":,\\-+.eE0123456789 \tnu\x7f\x80\xc3";
+    return rand() % 4 ? interesting[rand() % (sizeof(interesting) - 1)] : (char)(1 + rand() % 255);
+}
+
+static int mutations(int count, int *accepted) {
+    int failed = 0;
+    char buf[512];
+    srand(1);
+    for (int i = 0; i < count; ++i) {
+        const payload_case *c = &cases[rand() % 8];
+        size_t len = strlen(c->json);
+        memcpy(buf, c->json, len + 1);
+        for (int n = 1 + rand() % 3; n > 0 && len > 0 && len < sizeof(buf) - 2; --n) {
+            size_t at = rand() % len;
+            switch (rand() % 3) {
+                case 0:
+                    buf[at] = mutation_byte();
+                    break;
+                case 1:
+                    memmove(buf + at + 1, buf + at, len - at + 1);
+                    buf[at] = mutation_byte();
+                    len++;
+                    break;
+                default:
+                    memmove(buf + at, buf + at + 1, len - at);
+                    len--;
+                    break;
+            }
+        }
+        failed += !check(buf, c->version, false, accepted);
+    }
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    int failed = 0;
+    int accepted = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        failed += !check(cases[i].json, cases[i].version, true, &accepted);
+    }
+    printf("%zu payloads, %d taken by the decoder\n", sizeof(cases) / sizeof(cases[0]), accepted);
+
+    accepted = 0;
+    failed += mutations(count, &accepted);
+    printf("%d mutations, %d taken by the decoder\n", count, accepted);
+
+    if (failed) {
+        printf("%d payloads decoded differently\n", failed);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Known answer tests and benchmark for the cookie PBKDF2 kernel (src/px_pbkdf2.c).
+ *
+ * build: gcc -std=gnu99 -O2 -Isrc contrib/pbkdf2_bench.c src/px_pbkdf2.c -lcrypto -o pbkdf2_bench
+ * usage: ./pbkdf2_bench [iterations] [seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+
+#include "px_pbkdf2.h"
+
+// output size used for cookies, aes-256 key followed by the iv
+#define DERIVED_KEY_LEN 48
+
+// RFC 7914 section 11 PBKDF2-HMAC-SHA256 vectors
+static const struct {
+    const char *pass;
+    const char *salt;
+    int iterations;
+    size_t len;
+    const char *hex;
+} vectors[] = {
+    { "passwd", "salt", 1, 64,
+        "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+        "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783" },
+    { "Password", "NaCl", 80000, 64,
+        "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+        "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d" },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int known_answers(void) {
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+        px_pbkdf2_key key;
+        unsigned char out[64];
+        char hex[129];
+        px_pbkdf2_key_init(&key, vectors[i].pass, strlen(vectors[i].pass), EVP_sha256());
+        px_pbkdf2_sha256(&key, (const unsigned char*)vectors[i].salt, strlen(vectors[i].salt), vectors[i].iterations, out, vectors[i].len);
+        for (size_t j = 0; j < vectors[i].len; ++j) {
+            sprintf(hex + j * 2, "%02x", out[j]);
+        }
+        bool ok = strcmp(hex, vectors[i].hex) == 0;
+        failed += !ok;
+        printf("kat %zu: %s\n", i, ok ? "ok" : "FAILED");
+    }
+
+    // random keys and salts against openssl, cookie sized output
+    srand(1);
+    for (int i = 0; i < 200; ++i) {
+        char pass[100];
+        unsigned char salt[40], expected[DERIVED_KEY_LEN], actual[DERIVED_KEY_LEN];
+        size_t pass_len = rand() % sizeof(pass);
+        size_t salt_len = rand() % sizeof(salt);
+        int iterations = 1 + rand() % 2000;
+        for (size_t j = 0; j < pass_len; ++j) {
+            pass[j] = rand();
+        }
+        for (size_t j = 0; j < salt_len; ++j) {
+            salt[j] = rand();
+        }
+        px_pbkdf2_key key;
+        px_pbkdf2_key_init(&key, pass, pass_len, EVP_sha256());
+        PKCS5_PBKDF2_HMAC(pass, pass_len, salt, salt_len, iterations, EVP_sha256(), sizeof(expected), expected);
+        px_pbkdf2_sha256(&key, salt, salt_len, iterations, actual, sizeof(actual));
+        if (memcmp(expected, actual, sizeof(actual)) != 0) {
+            printf("random %d: FAILED (pass_len %zu, salt_len %zu, iterations %d)\n", i, pass_len, salt_len, iterations);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+static void bench(const char *name, bool openssl, int iterations, double seconds) {
+    static const char pass[] = "cookie key used for the benchmark";
+    static const unsigned char salt[] = "0123456789abcdef";
+    unsigned char out[DERIVED_KEY_LEN];
+    px_pbkdf2_key key;
+    px_pbkdf2_key_init(&key, pass, sizeof(pass) - 1, EVP_sha256());
+
+    long derivations = 0;
+    double start = now(), elapsed;
+    do {
+        if (openssl) {
+            PKCS5_PBKDF2_HMAC(pass, sizeof(pass) - 1, salt, sizeof(salt) - 1, iterations, EVP_sha256(), sizeof(out), out);
+        } else {
+            px_pbkdf2_sha256(&key, salt, sizeof(salt) - 1, iterations, out, sizeof(out));
+        }
+        derivations++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    // a 48 byte output is two pbkdf2 blocks, every round is two hmacs per block
+    printf("%-8s %8.1f derivations/s  %12.0f rounds/s  (%d iterations, %zu byte output)\n",
+            name, derivations / elapsed, derivations * (double)iterations / elapsed, iterations, sizeof(out));
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+
+    bool accelerated = px_pbkdf2_init();
+    printf("kernel: %s\n", accelerated ? "sha extensions" : "openssl");
+
+    int failed = known_answers();
+    if (failed) {
+        printf("%d known answer tests failed\n", failed);
+        return 1;
+    }
+
+    bench("openssl", true, iterations, seconds);
+    bench("px", false, iterations, seconds);
+    return 0;
+}
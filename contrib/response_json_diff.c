@@ -0,0 +1,240 @@
+/*
+ * Differential test of the risk api and captcha response decoders (src/px_response_json.c) against jansson.
+ *
+ * Every response the decoders accept must be accepted by jansson with the same fields, responses they reject go
+ * through jansson in the module. The responses below cover the challenge action, escapes, skipped members of every
+ * type, missing, duplicate and null fields and odd numbers, followed by random mutations of valid responses.
+ *
+ * build: gcc -std=gnu99 -O2 -Isrc $(apxs -q CFLAGS) -I$(apxs -q INCLUDEDIR) $(apr-1-config --includes) \
+ *            contrib/response_json_diff.c src/px_response_json.c \
+ *            src/px_json_scan.c $(apr-1-config --link-ld) -ljansson -o response_json_diff
+ * usage: ./response_json_diff [mutations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_general.h>
+#include <apr_pools.h>
+#include <jansson.h>
+
+#include "px_response_json.h"
+
+typedef struct response_case_t {
+    bool captcha;
+    const char *json;
+} response_case;
+
+static const response_case cases[] = {
+    // plain responses, taken by the decoders
+    { false, "{\"status\":0,\"uuid\":\"8712cef7-bcfa-4bb6-ae99-868025e1908a\",\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"b\",\"message\":\"\",\"data_enrichment\":{\"timestamp\":1513504354651,\"ok\":true,\"list\":[1,-2,0.5,null,\"x\",[],{}]}}" },
+    { false, " {\n\t\"action\" : \"c\" , \"score\" : -1 , \"uuid\" : \"\" , \"status\" : -1 } " },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"j\",\"action_data\":{\"body\":\"<html>\\n<script>var a=\\\"b\\\";<\\/script>\\t</html>\"}}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"c\",\"action_data\":null}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"c\",\"action_data\":{\"body\":1}}" },
+    { true, "{\"status\":0,\"uuid\":\"uuid\",\"vid\":\"vid\",\"cid\":\"cid\"}" },
+    { true, "{\"status\":-1,\"message\":\"invalid captcha\"}" },
+    // escapes and unicode
+    { false, "{\"status\":0,\"uuid\":\"u\\u0075id\",\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"\xc3\xa9t\xc3\xa9\",\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"message\":\"\\ud83d\"}" },
+    { false, "{\"status\":0,\"uuid\":\"a\\u0000b\",\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"tab\there\",\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"message\":\"bad \\x escape\"}" },
+    { false, "{\"st\\u0061tus\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\"}" },
+    { true, "{\"status\":0,\"uuid\":\"uuid\",\"vid\":\"v\\/id\\\\\"}" },
+    // missing, duplicate, null and extra fields
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0}" },
+    { false, "{\"status\":0,\"score\":0,\"action\":\"c\"}" },
+    { false, "{}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"score\":100}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"j\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"j\",\"action_data\":{}}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"j\",\"action_data\":\"body\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"j\",\"action_data\":{\"body\":\"a\",\"body\":\"b\"}}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":100,\"action\":\"j\",\"action_data\":{\"body\":\"a\",\"x\":[1]}}" },
+    { false, "{\"status\":0,\"uuid\":null,\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":1,\"x\":2}" },
+    { true, "{\"uuid\":\"uuid\",\"vid\":\"vid\"}" },
+    { true, "{\"status\":0,\"vid\":null}" },
+    { true, "{\"status\":0,\"uuid\":\"a\",\"uuid\":\"b\"}" },
+    // numbers and types
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":1.5,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":1e2,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":01,\"action\":\"c\"}" },
+    { false, "{\"status\":-0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":2147483648,\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":\"0\",\"action\":\"c\"}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":-0.25}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":1e999}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":99999999999999999999}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":1.}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":.5}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":tru}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":[[[[[[[[[[1]]]]]]]]]]}" },
+    // broken documents
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\"" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\",\"x\":[1,]}" },
+    { false, "{\"status\":0,\"uuid\":\"uuid\",\"score\":0,\"action\":\"c\"} x" },
+    { false, "[0]" },
+    { false, "" },
+    { true, "{\"status\":0,}" },
+};
+
+// the jansson decoding of parse_risk_response in src/px_json.c, without the request pool
+static bool reference_risk(const char *raw, risk_response *response) {
+    json_error_t error;
+    json_t *j_response = json_loads(raw, 0, &error);
+    if (!j_response) {
+        return false;
+    }
+    const char *uuid = NULL, *action = NULL, *body = NULL;
+    memset(response, 0, sizeof(*response));
+    if (json_unpack(j_response, "{s:i,s:s,s:i,s:s}", "status", &response->status, "uuid", &uuid, "score", &response->score, "action", &action)) {
+        json_decref(j_response);
+        return false;
+    }
+    if (!strcmp(action, "j") && json_unpack(json_object_get(j_response, "action_data"), "{s:s}", "body", &body)) {
+        json_decref(j_response);
+        return false;
+    }
+    response->uuid = strdup(uuid);
+    response->action = strdup(action);
+    response->action_data_body = body ? strdup(body) : NULL;
+    json_decref(j_response);
+    return true;
+}
+
+// the jansson decoding of parse_captcha_response in src/px_json.c
+static bool reference_captcha(const char *raw, captcha_response *response) {
+    json_error_t error;
+    json_t *j_response = json_loads(raw, 0, &error);
+    if (!j_response) {
+        return false;
+    }
+    const char *uuid = NULL, *vid = NULL, *cid = NULL;
+    memset(response, 0, sizeof(*response));
+    if (json_unpack(j_response, "{s:i,s?s,s?s,s?s}", "status", &response->status, "uuid", &uuid, "cid", &cid, "vid", &vid)) {
+        json_decref(j_response);
+        return false;
+    }
+    response->uuid = uuid ? strdup(uuid) : NULL;
+    response->vid = strdup(vid ? vid : "");
+    response->cid = cid ? strdup(cid) : NULL;
+    json_decref(j_response);
+    return true;
+}
+
+static bool str_equal(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// returns false when a decoder accepted a response jansson rejects or decodes differently
+static bool check(apr_pool_t *pool, const response_case *c, bool verbose, int *accepted) {
+    const char *diff = NULL;
+    bool fast_ok, ref_ok;
+    if (c->captcha) {
+        captcha_response fast, ref;
+        fast_ok = px_captcha_response_json_parse(c->json, pool, &fast);
+        ref_ok = reference_captcha(c->json, &ref);
+        if (fast_ok && !ref_ok) {
+            diff = "rejected by jansson";
+        } else if (fast_ok && (fast.status != ref.status || !str_equal(fast.uuid, ref.uuid) || !str_equal(fast.vid, ref.vid) || !str_equal(fast.cid, ref.cid))) {
+            diff = "fields";
+        }
+        if (ref_ok) {
+            free((void*)ref.uuid);
+            free((void*)ref.vid);
+            free((void*)ref.cid);
+        }
+    } else {
+        risk_response fast, ref;
+        fast_ok = px_risk_response_json_parse(c->json, pool, &fast);
+        ref_ok = reference_risk(c->json, &ref);
+        if (fast_ok && !ref_ok) {
+            diff = "rejected by jansson";
+        } else if (fast_ok && (fast.status != ref.status || fast.score != ref.score || !str_equal(fast.uuid, ref.uuid)
+                    || !str_equal(fast.action, ref.action) || !str_equal(fast.action_data_body, ref.action_data_body))) {
+            diff = "fields";
+        }
+        if (ref_ok) {
+            free((void*)ref.uuid);
+            free((void*)ref.action);
+            free((void*)ref.action_data_body);
+        }
+    }
+    if (diff) {
+        printf("%s differs (%s): %s\n", c->captcha ? "captcha" : "risk", diff, c->json);
+    }
+    if (verbose) {
+        printf("%-7s %-8s %-8s %s\n", c->captcha ? "captcha" : "risk", fast_ok ? "decoder" : "-", ref_ok ? "jansson" : "-", c->json);
+    }
+    *accepted += fast_ok;
+    apr_pool_clear(pool);
+    return diff == NULL;
+}
+
+// bytes a mutation inserts or overwrites with, json punctuation is picked more often than the rest
+static char mutation_byte(void) {
+    static const char interesting[] = "{}[]\":,\\/-+.eE0123456789 \tntfu\x7f\x80\xc3";
+    return rand() % 4 ? interesting[rand() % (sizeof(interesting) - 1)] : (char)(1 + rand() % 255);
+}
+
+static int mutations(apr_pool_t *pool, int count, int *accepted) {
+    int failed = 0;
+    char buf[512];
+    srand(1);
+    for (int i = 0; i < count; ++i) {
+        const response_case *c = &cases[rand() % 8];
+        size_t len = strlen(c->json);
+        memcpy(buf, c->json, len + 1);
+        for (int n = 1 + rand() % 3; n > 0 && len > 0 && len < sizeof(buf) - 2; --n) {
+            size_t at = rand() % len;
+            switch (rand() % 3) {
+                case 0:
+                    buf[at] = mutation_byte();
+                    break;
+                case 1:
+                    memmove(buf + at + 1, buf + at, len - at + 1);
+                    buf[at] = mutation_byte();
+                    len++;
+                    break;
+                default:
+                    memmove(buf + at, buf + at + 1, len - at);
+                    len--;
+                    break;
+            }
+        }
+        response_case mutated = { c->captcha, buf };
+        failed += !check(pool, &mutated, false, accepted);
+    }
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    int failed = 0;
+    int accepted = 0;
+    apr_pool_t *pool;
+    apr_initialize();
+    apr_pool_create(&pool, NULL);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        failed += !check(pool, &cases[i], true, &accepted);
+    }
+    printf("%zu responses, %d taken by the decoders\n", sizeof(cases) / sizeof(cases[0]), accepted);
+
+    accepted = 0;
+    failed += mutations(pool, count, &accepted);
+    printf("%d mutations, %d taken by the decoders\n", count, accepted);
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    if (failed) {
+        printf("%d responses decoded differently\n", failed);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#!/bin/sh
+# Sustained Risk API load on a fixed number of worker threads, blocking workers vs SuspendRequests.
+#
+# Every request carries no cookie, so each one waits for the Risk API. A local mock answers after
+# RISK_DELAY_MS, and each mode serves CONCURRENCY clients with THREADS worker threads.
+#
+# usage: contrib/s2s_bench.sh <path to mod_perimeterx.so>
+# env:   HTTPD (apache2), MODULES_DIR (/usr/lib/apache2/modules), THREADS (16), CONCURRENCY (256),
+#        REQUESTS (20000), RISK_DELAY_MS (50), IO_THREADS (2)
+set -e
+
+MODULE=${1:?usage: $0 <path to mod_perimeterx.so>}
+HTTPD=${HTTPD:-apache2}
+MODULES_DIR=${MODULES_DIR:-/usr/lib/apache2/modules}
+THREADS=${THREADS:-16}
+CONCURRENCY=${CONCURRENCY:-256}
+REQUESTS=${REQUESTS:-20000}
+RISK_DELAY_MS=${RISK_DELAY_MS:-50}
+IO_THREADS=${IO_THREADS:-2}
+HTTP_PORT=18080
+RISK_PORT=18081
+
+for tool in "$HTTPD" ab python3; do
+    if ! [ -x "$(command -v $tool)" ]; then
+        echo "$tool is not installed."
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d)
+trap 'kill $RISK_PID 2>/dev/null; "$HTTPD" -d "$WORK" -f "$WORK/httpd.conf" -k stop 2>/dev/null; rm -rf "$WORK"' EXIT
+mkdir -p "$WORK/htdocs" "$WORK/logs"
+echo ok > "$WORK/htdocs/index.html"
+
+cat > "$WORK/risk_api.py" <<EOF
+import http.server, socketserver, time
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    def do_POST(self):
+        self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        time.sleep($RISK_DELAY_MS / 1000.0)
+        body = b'{"status":0,"uuid":"00000000-0000-0000-0000-000000000000","score":0,"action":"c"}'
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+    def log_message(self, *args):
+        pass
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    request_queue_size = 1024
+Server(("127.0.0.1", $RISK_PORT), Handler).serve_forever()
+EOF
+python3 "$WORK/risk_api.py" &
+RISK_PID=$!
+sleep 1
+
+run() {
+    mode=$1
+    io_threads=$2
+    suspend=$3
+    cat > "$WORK/httpd.conf" <<EOF
+ServerRoot "$WORK"
+Listen 127.0.0.1:$HTTP_PORT
+PidFile logs/httpd.pid
+ErrorLog logs/error_log
+LogLevel warn
+LoadModule mpm_event_module $MODULES_DIR/mod_mpm_event.so
+<IfFile $MODULES_DIR/mod_unixd.so>
+    LoadModule unixd_module $MODULES_DIR/mod_unixd.so
+</IfFile>
+LoadModule perimeterx_module $MODULE
+StartServers 1
+ServerLimit 1
+ThreadsPerChild $THREADS
+ThreadLimit $THREADS
+MaxRequestWorkers $THREADS
+DocumentRoot "$WORK/htdocs"
+<IfModule mod_perimeterx.c>
+    PXEnabled On
+    AppID PXbench
+    AuthToken bench
+    CookieKey bench
+    BaseURL http://127.0.0.1:$RISK_PORT
+    APITimeoutMS 1000
+    ReportPageRequest Off
+    BackgroundActivitySend On
+    CurlPoolSize $CONCURRENCY
+    CurlIOThreads $io_threads
+    SuspendRequests $suspend
+</IfModule>
+EOF
+    "$HTTPD" -d "$WORK" -f "$WORK/httpd.conf" -k start
+    sleep 1
+    ab -q -c "$CONCURRENCY" -n "$REQUESTS" "http://127.0.0.1:$HTTP_PORT/index.html" > "$WORK/ab.txt"
+    "$HTTPD" -d "$WORK" -f "$WORK/httpd.conf" -k stop
+    sleep 2
+    rps=$(awk '/^Requests per second/ { print $4 }' "$WORK/ab.txt")
+    p99=$(awk '$1 == "99%" { print $2 }' "$WORK/ab.txt")
+    echo "$rps $p99" > "$WORK/$mode.txt"
+    printf '%-10s %10s req/s  p50 %5s ms  p99 %5s ms  failed %s\n' "$mode" "$rps" \
+        "$(awk '$1 == "50%" { print $2 }' "$WORK/ab.txt")" "$p99" \
+        "$(awk '/^Failed requests/ { print $3 }' "$WORK/ab.txt")"
+}
+
+echo "$THREADS worker threads, $CONCURRENCY clients, Risk API answers in $RISK_DELAY_MS ms"
+run blocking 0 Off
+run suspended "$IO_THREADS" On
+# with THREADS workers blocked for RISK_DELAY_MS each, blocking mode tops out at THREADS * 1000 / RISK_DELAY_MS req/s
+awk -v threads="$THREADS" -v delay="$RISK_DELAY_MS" '
+    NR == 1 { rps = $1; p99 = $2 }
+    NR == 2 { printf "suspended / blocking: %.2fx throughput, p99 %s -> %s ms (blocking bound %d req/s)\n", $1 / rps, p99, $2, threads * 1000 / delay }
+' "$WORK/blocking.txt" "$WORK/suspended.txt"
@@ -1,123 +1,284 @@
 #include "curl_pool.h"
 
+#include <apr_atomic.h>
+#include <apr_time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HEAD_INDEX(head) ((apr_uint32_t)(head))
+#define HEAD_TAG(head) ((apr_uint32_t)((head) >> 32))
+#define HEAD(tag, index) (((apr_uint64_t)(tag) << 32) | (index))
+
+// lock free stacks (treiber) of slots. the tag changes on every update so a slot which is popped and pushed back
+// between a load and the compare and swap does not go unnoticed (aba).
+static curl_pool_node *stack_pop(curl_pool *pool, apr_uint64_t *stack) {
+    apr_uint64_t head = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    for (;;) {
+        apr_uint32_t index = HEAD_INDEX(head);
+        if (index == 0) {
+            return NULL;
+        }
+        curl_pool_node *node = &pool->nodes[index - 1];
+        apr_uint64_t next = HEAD(HEAD_TAG(head) + 1, __atomic_load_n(&node->next, __ATOMIC_RELAXED));
+        if (__atomic_compare_exchange_n(stack, &head, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return node;
+        }
+    }
+}
+
+static void stack_push(curl_pool *pool, apr_uint64_t *stack, curl_pool_node *node) {
+    apr_uint32_t index = (apr_uint32_t)(node - pool->nodes) + 1;
+    apr_uint64_t head = __atomic_load_n(stack, __ATOMIC_RELAXED);
+    for (;;) {
+        __atomic_store_n(&node->next, HEAD_INDEX(head), __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(stack, &head, HEAD(HEAD_TAG(head) + 1, index), true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+// detaches the whole stack, returns the index + 1 of its first slot
+static apr_uint32_t stack_take_all(apr_uint64_t *stack) {
+    apr_uint64_t head = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(stack, &head, HEAD(HEAD_TAG(head) + 1, 0), true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    return HEAD_INDEX(head);
+}
+
+static void node_release(curl_pool_node *node) {
+    curl_easy_cleanup(node->curl);
+    node->curl = NULL;
+    free(node->buffer.data);
+    memset(&node->buffer, 0, sizeof(node->buffer));
+}
+
+static bool node_init(curl_pool *pool, curl_pool_node *node) {
+    node->curl = curl_easy_init();
+    if (!node->curl) {
+        return false;
+    }
+    curl_easy_setopt(node->curl, CURLOPT_PRIVATE, node);
+    if (pool->init) {
+        pool->init(node->curl, pool->init_data);
+    }
+    apr_atomic_inc32(&pool->handles);
+    apr_atomic_inc32(&pool->created);
+    return true;
+}
+
+static CURL *take(curl_pool *pool) {
+    curl_pool_node *node = stack_pop(pool, &pool->free);
+    if (!node) {
+        // grow while the pool is below its max size
+        node = stack_pop(pool, &pool->empty);
+        if (!node) {
+            return NULL;
+        }
+        if (!node_init(pool, node)) {
+            stack_push(pool, &pool->empty, node);
+            return NULL;
+        }
+    }
+    apr_atomic_inc32(&pool->acquired);
+    return node->curl;
+}
+
+// releases the handles idle for longer than idle_timeout, keeping min_size handles alive
+static void reap(curl_pool *pool, apr_time_t now) {
+    // the free list is detached and reversed, so the least recently used handles come first
+    apr_uint32_t reversed = 0;
+    for (apr_uint32_t index = stack_take_all(&pool->free); index;) {
+        curl_pool_node *node = &pool->nodes[index - 1];
+        // a pop that loaded the head before the list was detached may still read next, its compare and swap fails
+        index = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+        __atomic_store_n(&node->next, reversed, __ATOMIC_RELAXED);
+        reversed = (apr_uint32_t)(node - pool->nodes) + 1;
+    }
+    for (apr_uint32_t index = reversed; index;) {
+        curl_pool_node *node = &pool->nodes[index - 1];
+        index = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+        if (now - node->released > pool->idle_timeout && apr_atomic_read32(&pool->handles) > (apr_uint32_t)pool->min_size) {
+            node_release(node);
+            apr_atomic_dec32(&pool->handles);
+            apr_atomic_inc32(&pool->reaped);
+            stack_push(pool, &pool->empty, node);
+        } else {
+            stack_push(pool, &pool->free, node);
+        }
+    }
+    // waiters may have missed the handles while the list was detached
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (apr_atomic_read32(&pool->waiters) > 0) {
+        apr_thread_mutex_lock(pool->mutex);
+        apr_thread_cond_broadcast(pool->cond);
+        apr_thread_mutex_unlock(pool->mutex);
+    }
+}
+
+// one thread at a time looks for idle handles, at most twice per idle_timeout
+static void maybe_reap(curl_pool *pool, apr_time_t now) {
+    apr_time_t reaped_at = __atomic_load_n(&pool->reaped_at, __ATOMIC_RELAXED);
+    if (pool->idle_timeout > 0 && now - reaped_at > pool->idle_timeout / 2
+            && __atomic_compare_exchange_n(&pool->reaped_at, &reaped_at, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        reap(pool, now);
+    }
+}
+
+// slow path, sleeps until a handle is put back. a negative timeout waits forever.
+static CURL *take_wait(curl_pool *pool, apr_interval_time_t timeout) {
+    CURL *c = NULL;
+    apr_time_t start = apr_time_now();
+    apr_time_t deadline = start + timeout;
+    apr_atomic_inc32(&pool->waits);
+
+    apr_thread_mutex_lock(pool->mutex);
+    apr_atomic_inc32(&pool->waiters);
+    // pairs with the fence in curl_pool_put
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while ((c = take(pool)) == NULL) {
+        if (timeout < 0) {
+            apr_thread_cond_wait(pool->cond, pool->mutex);
+            continue;
+        }
+        apr_time_t now = apr_time_now();
+        if (now >= deadline || apr_thread_cond_timedwait(pool->cond, pool->mutex, deadline - now) == APR_TIMEUP) {
+            // a handle may have been put back right before the timeout
+            c = take(pool);
+            break;
+        }
+    }
+    apr_atomic_dec32(&pool->waiters);
+    apr_thread_mutex_unlock(pool->mutex);
+
+    if (!c) {
+        apr_atomic_inc32(&pool->timeouts);
+    }
+    __atomic_fetch_add(&pool->wait_time, (apr_uint64_t)(apr_time_now() - start), __ATOMIC_RELAXED);
+    return c;
+}
+
 static apr_status_t curl_pool_destroy(void *arg) {
     curl_pool *pool = (curl_pool*)arg;
-    for (int i = 0; i < pool->size; ++i) {
-        if (pool->data[i]) {
-            curl_easy_cleanup(pool->data[i]);
-            pool->data[i] = NULL;
+    // every slot, not only the free list: a handle still checked out when the child exits is released with its buffer
+    // as well, nothing may use or put back handles of a destroyed pool
+    for (int i = 0; i < pool->max_size; ++i) {
+        curl_pool_node *node = &pool->nodes[i];
+        if (node->curl) {
+            node_release(node);
+            apr_atomic_dec32(&pool->handles);
         }
     }
+    pool->free = 0;
+    pool->empty = 0;
     return APR_SUCCESS;
 }
 
-curl_pool *curl_pool_create(apr_pool_t *p, int size, bool reset) {
+curl_pool *curl_pool_create(apr_pool_t *p, int min_size, int max_size, apr_interval_time_t idle_timeout, bool reset, curl_pool_init_cb init, void *init_data) {
     curl_pool *pool = (curl_pool *)apr_pcalloc(p, sizeof(curl_pool));
-    apr_thread_mutex_create(&pool->mutex, APR_THREAD_MUTEX_NESTED, p);
+    apr_thread_mutex_create(&pool->mutex, APR_THREAD_MUTEX_DEFAULT, p);
     apr_thread_cond_create(&pool->cond, p);
-    pool->size = size;
-    pool->used = 0;
-    pool->data = (CURL **)apr_pcalloc(p, sizeof(CURL*) * size);
+    pool->max_size = max_size;
+    pool->min_size = min_size < max_size ? min_size : max_size;
+    pool->idle_timeout = idle_timeout;
+    pool->nodes = (curl_pool_node *)apr_pcalloc(p, sizeof(curl_pool_node) * max_size);
+    pool->reaped_at = apr_time_now();
     pool->reset = reset;
-    for (int i = 0; i < pool->size; ++i) {
-        pool->data[i] = curl_easy_init();
+    pool->init = init;
+    pool->init_data = init_data;
+    // pushed in reverse so the slots are used in order
+    for (int i = pool->max_size - 1; i >= 0; --i) {
+        curl_pool_node *node = &pool->nodes[i];
+        if (i < pool->min_size && node_init(pool, node)) {
+            node->released = pool->reaped_at;
+            stack_push(pool, &pool->free, node);
+        } else {
+            stack_push(pool, &pool->empty, node);
+        }
     }
     apr_pool_cleanup_register(p, pool, curl_pool_destroy, apr_pool_cleanup_null);
     return pool;
 }
 
+// the reap runs once a handle is taken, the detached free list cannot make this get fail
 CURL *curl_pool_get(curl_pool *pool) {
-    CURL *c = NULL;
-    apr_thread_mutex_lock(pool->mutex);
-    if (pool->used < pool->size) {
-        for (int i = 0; i < pool->size && c == NULL; ++i) {
-            c = pool->data[i];
-            if  (c) {
-                pool->data[i] = NULL;
-                pool->used += 1;
-            }
-        }
+    CURL *c = take(pool);
+    if (c) {
+        maybe_reap(pool, apr_time_now());
     }
-    apr_thread_mutex_unlock(pool->mutex);
     return c;
 }
 
 CURL *curl_pool_get_wait(curl_pool *pool) {
-    apr_thread_mutex_lock(pool->mutex);
-    CURL *c = NULL;
-    bool found = false;
-    while (!found) {
-        if (pool->used < pool->size) {
-            for (int i = 0; i < pool->size && c == NULL; ++i) {
-                c = pool->data[i];
-                if  (c) {
-
-                    pool->data[i] = NULL;
-                    pool->used += 1;
-                    found = true;
-                    break;
-                }
-            }
-        }
-        if (!found) {
-            apr_thread_cond_wait(pool->cond, pool->mutex);
-        }
+    CURL *c = take(pool);
+    if (c) {
+        maybe_reap(pool, apr_time_now());
+        return c;
     }
-    apr_thread_mutex_unlock(pool->mutex);
-    return c;
+    return take_wait(pool, -1);
 }
 
 CURL *curl_pool_get_timedwait(curl_pool *pool, apr_interval_time_t timeout) {
-    CURL *c = NULL;
-    apr_thread_mutex_lock(pool->mutex);
-    bool found = false;
-    while (!found) {
-        if (pool->used < pool->size) {
-            for (int i = 0; i < pool->size && c == NULL; ++i) {
-                c = pool->data[i];
-                if  (c) {
-                    pool->data[i] = NULL;
-                    pool->used += 1;
-                    found = true;
-                    break;
-                }
-            }
-        }
-        if (!found && (apr_thread_cond_timedwait(pool->cond, pool->mutex, timeout) == APR_TIMEUP)) {
-            break;
-        }
+    CURL *c = take(pool);
+    if (c) {
+        maybe_reap(pool, apr_time_now());
+        return c;
     }
-    apr_thread_mutex_unlock(pool->mutex);
-    return c;
+    return take_wait(pool, timeout);
+}
+
+curl_buffer *curl_pool_buffer(CURL *curl) {
+    curl_pool_node *node = NULL;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&node);
+    return node ? &node->buffer : NULL;
 }
 
 int curl_pool_put(curl_pool *pool, CURL *curl) {
-    bool extra = true;
-    apr_thread_mutex_lock(pool->mutex);
-    if (pool->used > 0) {
-        // find free spot
-        int i = 0;
-        while (i < pool->size && pool->data[i]) {
-            ++i;
-        }
-        // put it back to pool
-        if (i < pool->size) {
-            pool->data[i] = curl;
-            extra = false;
-            pool->used -= 1;
-            if (pool->reset) {
-                curl_easy_reset(curl);
-            }
-
-            apr_thread_cond_signal(pool->cond);
-        }
-    }
-    apr_thread_mutex_unlock(pool->mutex);
-    // if we have extra, release it
-    if (extra) {
+    curl_pool_node *node = NULL;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&node);
+    // if it is not one of ours, release it
+    if (!node || node < pool->nodes || node >= pool->nodes + pool->max_size || node->curl != curl) {
         curl_easy_cleanup(curl);
         return 1;
     }
+    if (pool->reset) {
+        curl_easy_reset(curl);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, node);
+        if (pool->init) {
+            pool->init(curl, pool->init_data);
+        }
+    }
+    apr_time_t now = apr_time_now();
+    node->released = now;
+    stack_push(pool, &pool->free, node);
+
+    // either the waiter sees the pushed slot or we see the waiter, the mutex makes sure it is already sleeping
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (apr_atomic_read32(&pool->waiters) > 0) {
+        apr_thread_mutex_lock(pool->mutex);
+        apr_thread_cond_signal(pool->cond);
+        apr_thread_mutex_unlock(pool->mutex);
+    }
+
+    maybe_reap(pool, now);
     return 0;
 }
 
+void curl_pool_reap(curl_pool *pool) {
+    maybe_reap(pool, apr_time_now());
+}
+
+void curl_pool_get_stats(curl_pool *pool, curl_pool_stats *stats) {
+    if (!pool) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    stats->max_size = pool->max_size;
+    stats->handles = apr_atomic_read32(&pool->handles);
+    stats->created = apr_atomic_read32(&pool->created);
+    stats->reaped = apr_atomic_read32(&pool->reaped);
+    stats->acquired = apr_atomic_read32(&pool->acquired);
+    stats->waits = apr_atomic_read32(&pool->waits);
+    stats->timeouts = apr_atomic_read32(&pool->timeouts);
+    stats->wait_time = __atomic_load_n(&pool->wait_time, __ATOMIC_RELAXED);
+}
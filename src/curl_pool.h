@@ -5,22 +5,76 @@
 
 #include <curl/curl.h>
 #include <apr_pools.h>
+#include <apr_time.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
 
+// sets up a new handle, and a handle after curl_easy_reset, before it is handed out
+typedef void (*curl_pool_init_cb)(CURL *curl, void *data);
+
+// response body storage of a handle, kept between its transfers and released with the handle
+typedef struct curl_buffer_t {
+    char *data;
+    size_t size;
+    size_t capacity;
+} curl_buffer;
+
+// a pool slot, the handle keeps a pointer to its slot in CURLOPT_PRIVATE. slots without a handle are created on demand.
+typedef struct curl_pool_node_t {
+    CURL *curl;
+    curl_buffer buffer;
+    // index + 1 of the next slot on the same list, 0 ends the list
+    apr_uint32_t next;
+    apr_time_t released;
+} curl_pool_node;
+
 typedef struct curl_pool_t {
+    // only used to sleep while every handle is in use
     apr_thread_mutex_t *mutex;
     apr_thread_cond_t *cond;
-    int size;
-    int used;
-    CURL** data;
+    volatile apr_uint32_t waiters;
+    int min_size;
+    int max_size;
+    apr_interval_time_t idle_timeout;
+    curl_pool_node *nodes;
+    // list heads: modification tag in the high 32 bits, index + 1 of the first slot in the low 32 bits
+    apr_uint64_t free;  // slots holding an idle handle
+    apr_uint64_t empty; // slots without a handle
+    apr_time_t reaped_at;
     bool reset;
+    curl_pool_init_cb init;
+    void *init_data;
+    volatile apr_uint32_t handles;
+    volatile apr_uint32_t created;
+    volatile apr_uint32_t reaped;
+    volatile apr_uint32_t acquired;
+    volatile apr_uint32_t waits;
+    volatile apr_uint32_t timeouts;
+    apr_uint64_t wait_time; // in usec
 } curl_pool;
 
-curl_pool *curl_pool_create(apr_pool_t *p, int size, bool reset);
+typedef struct curl_pool_stats_t {
+    int max_size;
+    apr_uint32_t handles;
+    apr_uint32_t created;
+    apr_uint32_t reaped;
+    apr_uint32_t acquired;
+    apr_uint32_t waits;
+    apr_uint32_t timeouts;
+    apr_uint64_t wait_time; // in usec
+} curl_pool_stats;
+
+// min_size handles are created upfront, up to max_size on demand. handles idle for longer than idle_timeout are
+// released while more than min_size are alive, 0 keeps them forever. init may be NULL.
+curl_pool *curl_pool_create(apr_pool_t *p, int min_size, int max_size, apr_interval_time_t idle_timeout, bool reset, curl_pool_init_cb init, void *init_data);
 CURL *curl_pool_get(curl_pool *pool);
 CURL *curl_pool_get_wait(curl_pool *pool);
 CURL *curl_pool_get_timedwait(curl_pool *pool, apr_interval_time_t timeout);
 int curl_pool_put(curl_pool *pool, CURL *curl);
+// releases idle handles like a get or put does, for a pool that sees no traffic. cheap to call on every tick.
+void curl_pool_reap(curl_pool *pool);
+// the buffer of a handle taken from a pool, NULL for other handles
+curl_buffer *curl_pool_buffer(CURL *curl);
+void curl_pool_get_stats(curl_pool *pool, curl_pool_stats *stats);
 
 #endif /* CURL_POOL_H */
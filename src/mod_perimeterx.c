@@ -3,6 +3,7 @@
  */
 #include <stdio.h>
 #include <stdbool.h>
+#include <unistd.h>
 
 #include <jansson.h>
 #include <curl/curl.h>
@@ -11,6 +12,7 @@
 #include <openssl/ssl.h>
 #include <openssl/opensslv.h>
 #include <openssl/crypto.h>
+#include <openssl/sha.h>
 #include <openssl/engine.h>
 #include <httpd.h>
 #include <http_config.h>
@@ -19,20 +21,24 @@
 #include <ap_provider.h>
 #include <http_request.h>
 #include <http_log.h>
+#include <ap_mpm.h>
 #include <apr_strings.h>
 #include <apr_atomic.h>
 #include <apr_portable.h>
 #include <apr_signal.h>
-#include <apr_base64.h>
 #include <apr_time.h>
 #include <apr_uri.h>
+#include <apr_optional.h>
+#include <mod_status.h>
 
 #include "px_utils.h"
 #include "px_types.h"
 #include "px_template.h"
 #include "px_enforcer.h"
+#include "px_codec.h"
 #include "px_json.h"
 #include "px_client.h"
+#include "px_payload.h"
 
 module AP_MODULE_DECLARE_DATA perimeterx_module;
 
@@ -47,6 +53,13 @@ static const char *ACTIVITIES_API = "/api/v1/collector/s2s";
 static const char *HEALTH_CHECK_API = "/api/v1/kpi/status";
 
 
+// the suspend_connection hook and ap_mpm_resume_suspended
+#define PX_SUSPEND_SUPPORTED AP_MODULE_MAGIC_AT_LEAST(20120211, 37)
+// how often the health check thread looks at the circuit breaker windows
+#define BREAKER_TICK apr_time_from_msec(10)
+// a child that stopped running the health checks is replaced after this
+#define BREAKER_LEASE apr_time_from_msec(250)
+
 static const char *CONTENT_TYPE_JSON = "application/json";
 static const char *CONTENT_TYPE_HTML = "text/html";
 
@@ -67,6 +80,28 @@ static const char *ERROR_CONFIG_MISSING = "mod_perimeterx: config structure not
 static const char* MAX_CURL_POOL_SIZE_EXCEEDED = "mod_perimeterx: CurlPoolSize can not exceed 10000";
 static const char *INVALID_WORKER_NUMBER_QUEUE_SIZE = "mod_perimeterx: invalid number of background activity workers - must be greater than zero";
 static const char *INVALID_ACTIVITY_QUEUE_SIZE = "mod_perimeterx: invalid background activity queue size - must be greater than zero";
+static const char *INVALID_KEY_CACHE_SIZE = "mod_perimeterx: invalid cookie key cache size - must not be negative";
+static const char *INVALID_VERDICT_CACHE_SIZE = "mod_perimeterx: invalid cookie verdict cache size - must not be negative";
+static const char *INVALID_NEGATIVE_CACHE_SIZE = "mod_perimeterx: invalid cookie negative cache size - must not be negative";
+static const char *INVALID_NEGATIVE_CACHE_TTL = "mod_perimeterx: invalid cookie negative cache ttl - must be greater than zero";
+static const char *INVALID_CURL_POOL_MIN_SIZE = "mod_perimeterx: invalid curl pool min size - must not be negative";
+static const char *INVALID_CURL_POOL_IDLE_TIMEOUT = "mod_perimeterx: invalid curl pool idle timeout - must not be negative";
+static const char *INVALID_CURL_IO_THREADS = "mod_perimeterx: invalid number of curl io threads - must not be negative";
+static const char *INVALID_CURL_WARM_CONNECTIONS = "mod_perimeterx: invalid number of curl warm connections - must not be negative";
+static const char *INVALID_CURL_TCP_KEEPALIVE = "mod_perimeterx: invalid curl tcp keepalive interval - must not be negative";
+static const char *INVALID_CURL_CONNECTION_IDLE_TIMEOUT = "mod_perimeterx: invalid curl connection idle timeout - must not be negative";
+static const char *INVALID_HEDGE_PERCENTILE = "mod_perimeterx: invalid hedge percentile - must be between 1 and 99";
+static const char *INVALID_HEDGE_BUDGET_PERCENT = "mod_perimeterx: invalid hedge budget - must be between 1 and 100 percent";
+static const char *INVALID_ADAPTIVE_TIMEOUT_MULTIPLIER = "mod_perimeterx: invalid adaptive timeout multiplier - must not be negative";
+static const char *INVALID_ADAPTIVE_TIMEOUT = "mod_perimeterx: invalid adaptive timeout - must not be negative";
+static const char *INVALID_BREAKER_ERROR_RATE = "mod_perimeterx: invalid circuit breaker error rate - must be between 0 and 100 percent";
+static const char *INVALID_BREAKER_MAX_LATENCY = "mod_perimeterx: invalid circuit breaker max latency - must not be negative";
+static const char *INVALID_BREAKER_PROBE_INTERVAL = "mod_perimeterx: invalid circuit breaker probe interval - must be greater than zero";
+static const char *INVALID_BREAKER_PROBE_RANGE = "mod_perimeterx: invalid circuit breaker probe interval - BreakerProbeMinMS must not be greater than BreakerProbeMaxMS";
+static const char *INVALID_BREAKER_RAMP = "mod_perimeterx: invalid circuit breaker ramp - must not be negative";
+static const char *TOO_MANY_PAYLOAD_KEYS = "mod_perimeterx: too many cookie keys - at most 8 keys can be active";
+static const char *INVALID_KEY_DERIVATION_BUDGET = "mod_perimeterx: invalid cookie key derivation budget - must not be negative";
+static const char *INVALID_KEY_DERIVATION_BURST = "mod_perimeterx: invalid cookie key derivation burst - must not be negative";
 static const char *ERROR_BASE_URL_BEFORE_APP_ID = "mod_perimeterx: BaseUrl was set before AppId";
 static const char *ERROR_SHORT_APP_ID = "mod_perimeterx: AppId must be longer than 2 chars";
 
@@ -178,9 +213,8 @@ char *create_response(px_config *conf, request_context *ctx) {
 
     // formulate server response according to px token type
     if (ctx->token_origin == TOKEN_ORIGIN_HEADER) {
-        int expected_encoded_len = apr_base64_encode_len(html_size);
-        char *encoded_html = apr_palloc(ctx->r->pool, expected_encoded_len + 1);
-        apr_base64_encode(encoded_html, html, html_size);
+        char *encoded_html = apr_palloc(ctx->r->pool, px_base64_encode_len(html_size) + 1);
+        px_base64_encode((const unsigned char*)html, html_size, encoded_html);
         free(html);
         if (!encoded_html) {
             return NULL;
@@ -201,7 +235,7 @@ void post_verification(request_context *ctx, px_config *conf, bool request_valid
         if (conf->background_activity_send) {
             apr_queue_push(conf->activity_queue, activity);
         } else {
-            post_request(conf->activities_api_url, activity, conf->api_timeout_ms, conf, ctx, NULL, NULL);
+            post_request(conf->activities_endpoint, activity, conf->api_timeout_ms, conf, ctx, NULL, NULL);
             free(activity);
         }
     }
@@ -222,6 +256,83 @@ static void redirect_copy_headers_out(request_rec *r, const redirect_response *r
     }
 }
 
+// a request waiting for its Risk API call without holding a worker thread
+typedef struct px_suspended_t {
+    request_context *ctx;
+    px_config *conf;
+    risk_api_call *call;
+} px_suspended;
+
+static bool px_mpm_is_async = false;
+
+// finishes a verified request: monitor mode, activities, score header and the block response
+static int px_handle_verdict(request_rec *r, px_config *conf, request_context *ctx, bool request_valid) {
+    // if request is not valid, and monitor mode is on, toggle request_valid and set pass_reason
+    if (conf->monitor_mode && !request_valid) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, LOGGER_DEBUG_FORMAT, conf->app_id, "Request marked for simulated block");
+        ctx->pass_reason = PASS_REASON_MONITOR_MODE;
+        request_valid = true;
+    }
+    post_verification(ctx, conf, request_valid);
+#if DEBUG
+    const char *PX_AUT_HEADER_KEY = getenv("PX_AUT_HEADER_KEY");
+    const char *PX_AUT_HEADER_VALUE = getenv("PX_AUT_HEADER_VALUE");
+    if (PX_AUT_HEADER_KEY && PX_AUT_HEADER_VALUE) {
+        char *aut_test_header = apr_pstrdup(r->pool, (char *) apr_table_get(r->headers_in, PX_AUT_HEADER_KEY));
+        if (aut_test_header && strcmp(aut_test_header, PX_AUT_HEADER_VALUE) == 0) {
+            const char *ctx_str = json_context(ctx);
+            ap_set_content_type(r, CONTENT_TYPE_JSON);
+            ap_rprintf(r, "%s", ctx_str);
+            free((void*)ctx_str);
+            return DONE;
+        }
+    }
+#endif
+
+    if (conf->score_header_enabled) {
+        const char *score_str = apr_itoa(r->pool, ctx->score);
+        apr_table_set(r->headers_in, conf->score_header_name, score_str);
+    }
+
+    if (!request_valid && ctx->block_enabled) {
+        // redirecting requests to custom block page if exists
+        if (conf->block_page_url) {
+            const char *url_arg = r->args ? apr_pstrcat(r->pool, r->uri, "?", r->args, NULL) : r->uri;
+            const char *url = pescape_urlencoded(r->pool, url_arg);
+            const char *redirect_url = apr_pstrcat(r->pool, conf->block_page_url, "?url=", url, "&uuid=", ctx->uuid, "&vid=", ctx->vid,  NULL);
+            apr_table_set(r->headers_out, "Location", redirect_url);
+            return HTTP_TEMPORARY_REDIRECT;
+        }
+
+        char *response = create_response(conf, ctx);
+        if (response) {
+            const char *content_type = CONTENT_TYPE_HTML;
+            if (ctx->response_application_json) {
+                content_type = CONTENT_TYPE_JSON;
+            }
+            ap_set_content_type(ctx->r, content_type);
+            ctx->r->status = HTTP_FORBIDDEN;
+            ap_rwrite(response, strlen(response), ctx->r);
+            free(response);
+            return DONE;
+        }
+        // failed to create response
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, LOGGER_DEBUG_FORMAT, conf->app_id, "Could not create block page with template, passing request");
+    }
+    r->status = HTTP_OK;
+    return OK;
+}
+
+// only the event mpm parks connections, http/2 streams and captcha checks wait on their worker
+static bool px_can_suspend(request_rec *r, px_config *conf, request_context *ctx) {
+#if PX_SUSPEND_SUPPORTED
+    return conf->suspend_requests && conf->io && px_mpm_is_async && r->connection->cs && !r->main && r->proto_num < 2000
+        && !(conf->captcha_enabled && ctx->px_captcha);
+#else
+    return false;
+#endif
+}
+
 int px_handle_request(request_rec *r, px_config *conf) {
     // Decline if module is disabled or not properly configured
     if (!conf || !conf->module_enabled || !conf->app_id) {
@@ -229,7 +340,7 @@ int px_handle_request(request_rec *r, px_config *conf) {
     }
 
     // fail open mode
-    if (apr_atomic_read32(&conf->px_errors_count) >= conf->px_errors_threshold) {
+    if (conf->risk_endpoint && px_breaker_is_open(conf->risk_endpoint->breaker)) {
         return DECLINED;
     }
 
@@ -275,100 +386,189 @@ int px_handle_request(request_rec *r, px_config *conf) {
     request_context *ctx = create_context(r, conf);
     if (ctx) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, LOGGER_DEBUG_FORMAT, conf->app_id, "Request context created successfully");
-        bool request_valid = px_verify_request(ctx, conf);
-
-        // if request is not valid, and monitor mode is on, toggle request_valid and set pass_reason
-        if (conf->monitor_mode && !request_valid) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, LOGGER_DEBUG_FORMAT, conf->app_id, "Request marked for simulated block");
-            ctx->pass_reason = PASS_REASON_MONITOR_MODE;
-            request_valid = true;
+        if (px_can_suspend(r, conf, ctx)) {
+            bool request_valid;
+            if (px_verify_payload(ctx, conf, &request_valid)) {
+                return px_handle_verdict(r, conf, ctx, request_valid);
+            }
+            if (!px_risk_api_admit(ctx, conf)) {
+                return px_handle_verdict(r, conf, ctx, true);
+            }
+            // the Risk API is called from the quick handler, where the request can be suspended
+            px_suspended *suspended = (px_suspended*)apr_pcalloc(r->pool, sizeof(px_suspended));
+            suspended->ctx = ctx;
+            suspended->conf = conf;
+            ap_set_module_config(r->request_config, &perimeterx_module, suspended);
+            r->status = HTTP_OK;
+            return OK;
         }
-        post_verification(ctx, conf, request_valid);
-#if DEBUG
-        const char *PX_AUT_HEADER_KEY = getenv("PX_AUT_HEADER_KEY");
-        const char *PX_AUT_HEADER_VALUE = getenv("PX_AUT_HEADER_VALUE");
-        if (PX_AUT_HEADER_KEY && PX_AUT_HEADER_VALUE) {
-            char *aut_test_header = apr_pstrdup(r->pool, (char *) apr_table_get(r->headers_in, PX_AUT_HEADER_KEY));
-            if (aut_test_header && strcmp(aut_test_header, PX_AUT_HEADER_VALUE) == 0) {
-                const char *ctx_str = json_context(ctx);
-                ap_set_content_type(r, CONTENT_TYPE_JSON);
-                ap_rprintf(r, "%s", ctx_str);
-                free((void*)ctx_str);
-                return DONE;
+        return px_handle_verdict(r, conf, ctx, px_verify_request(ctx, conf));
+    }
+    r->status = HTTP_OK;
+    return OK;
+}
+
+#if PX_SUSPEND_SUPPORTED
+// runs on a worker once the Risk API call completed or timed out, finishes the request like ap_process_async_request.
+// the quick handlers run again, ours declines now and the ones ordered after it, mod_cache for instance, get their
+// turn. invoke_mtx is held like other callbacks resuming a request do, until the suspending worker let go of it.
+static void px_resume_request(void *baton) {
+    px_suspended *suspended = (px_suspended*)baton;
+    request_rec *r = suspended->ctx->r;
+    conn_rec *c = r->connection;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *invoke_mtx = r->invoke_mtx;
+    if (invoke_mtx) {
+        apr_thread_mutex_lock(invoke_mtx);
+    }
+#endif
+    int status = px_handle_verdict(r, suspended->conf, suspended->ctx, px_verify_risk_api_call(suspended->call, suspended->conf));
+    if (status == OK) {
+        status = ap_run_quick_handler(r, 0);
+        if (status == DECLINED) {
+            status = ap_process_request_internal(r);
+            if (status == OK) {
+                status = ap_invoke_handler(r);
             }
         }
+    }
+#if APR_HAS_THREADS
+    if (invoke_mtx) {
+        apr_thread_mutex_unlock(invoke_mtx);
+    }
 #endif
+    if (status == SUSPENDED) {
+        // a later handler suspended the request again and resumes the connection itself
+        return;
+    }
+    if (status == DONE) {
+        status = OK;
+    }
+    if (status == OK) {
+        ap_finalize_request_protocol(r);
+    } else {
+        r->status = HTTP_OK;
+        ap_die(status, r);
+    }
+    ap_process_request_after_handler(r);
+    ap_mpm_resume_suspended(c);
+}
 
-        if (conf->score_header_enabled) {
-            const char *score_str = apr_itoa(r->pool, ctx->score);
-            apr_table_set(r->headers_in, conf->score_header_name, score_str);
-        }
+// called on the io thread
+static void px_risk_api_done(void *baton) {
+    ap_mpm_register_timed_callback(0, px_resume_request, baton);
+}
 
-        if (!request_valid && ctx->block_enabled) {
-            // redirecting requests to custom block page if exists
-            if (conf->block_page_url) {
-                const char *url_arg = r->args ? apr_pstrcat(r->pool, r->uri, "?", r->args, NULL) : r->uri;
-                const char *url = pescape_urlencoded(r->pool, url_arg);
-                const char *redirect_url = apr_pstrcat(r->pool, conf->block_page_url, "?url=", url, "&uuid=", ctx->uuid, "&vid=", ctx->vid,  NULL);
-                apr_table_set(r->headers_out, "Location", redirect_url);
-                return HTTP_TEMPORARY_REDIRECT;
-            }
+// suspends requests whose Risk API call px_handle_request deferred. runs first so the request is still verified before
+// the access checks, as from post_read_request.
+static int px_hook_quick_handler(request_rec *r, int lookup) {
+    px_suspended *suspended = ap_get_module_config(r->request_config, &perimeterx_module);
+    if (lookup || !suspended) {
+        return DECLINED;
+    }
+    ap_set_module_config(r->request_config, &perimeterx_module, NULL);
 
-            char *response = create_response(conf, ctx);
-            if (response) {
-                const char *content_type = CONTENT_TYPE_HTML;
-                if (ctx->response_application_json) {
-                    content_type = CONTENT_TYPE_JSON;
-                }
-                ap_set_content_type(ctx->r, content_type);
-                ctx->r->status = HTTP_FORBIDDEN;
-                ap_rwrite(response, strlen(response), ctx->r);
-                free(response);
-                return DONE;
-            }
-            // failed to create response
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, LOGGER_DEBUG_FORMAT, conf->app_id, "Could not create block page with template, passing request");
-        }
+    suspended->call = risk_api_prepare(suspended->ctx, suspended->conf, px_risk_api_done, suspended);
+    if (!suspended->call) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, LOGGER_DEBUG_FORMAT, suspended->conf->app_id, "Risk API call can not be suspended, waiting for it");
+        int status = px_handle_verdict(r, suspended->conf, suspended->ctx, px_verify_risk_api(suspended->ctx, suspended->conf));
+        return status == OK ? DECLINED : status;
     }
-    r->status = HTTP_OK;
-    return OK;
+    apr_atomic_inc32(&suspended->conf->requests_suspended);
+    // the worker still owns the connection until the mpm parked it, the call starts in px_hook_suspend_connection
+    ap_set_module_config(r->connection->conn_config, &perimeterx_module, suspended);
+    return SUSPENDED;
 }
 
-// Background thread that wakes up after reacing X timeoutes in interval length Y and checks when service is available again
+static void px_hook_suspend_connection(conn_rec *c, request_rec *r) {
+    px_suspended *suspended = ap_get_module_config(c->conn_config, &perimeterx_module);
+    if (suspended) {
+        ap_set_module_config(c->conn_config, &perimeterx_module, NULL);
+        risk_api_submit(suspended->call);
+    }
+}
+#endif
+
+// Background thread that drives the circuit breakers of the PerimeterX endpoints: it opens them when their window
+// shows too many errors or too much latency, and probes the service with backoff until it is available again. every
+// child runs one, only the holder of the lease does the work for the whole server.
 static void *APR_THREAD_FUNC health_check(apr_thread_t *thd, void *data) {
     health_check_data *hc = (health_check_data*) data;
     px_config *conf = hc->config;
+    apr_uint32_t pid = (apr_uint32_t)getpid();
+    bool leading = false;
+    px_breaker *breakers[] = {
+        conf->risk_endpoint->breaker,
+        conf->captcha_endpoint->breaker,
+        conf->activities_endpoint->breaker,
+        conf->redirect_breaker,
+    };
+    const int nbreakers = sizeof(breakers) / sizeof(*breakers);
+    bool probed[sizeof(breakers) / sizeof(*breakers)];
+    // pools belong to the child, they are shrunk whether or not it holds the lease
+    curl_pool *pools[] = {
+        conf->risk_endpoint->pool,
+        conf->captcha_endpoint->pool,
+        conf->activities_endpoint->pool,
+        conf->redirect_curl_pool,
+    };
 
     const char *health_check_url = apr_pstrcat(hc->server->process->pool, hc->config->base_url, HEALTH_CHECK_API, NULL);
     CURL *curl = curl_easy_init();
-    CURLcode res;
+    px_share_attach(conf->share, curl);
+    apr_thread_mutex_lock(conf->health_check_cond_mutex);
     while (!conf->should_exit_thread) {
-        // wait for condition and reset errors count on internal
-        apr_thread_mutex_lock(conf->health_check_cond_mutex);
-        while (!conf->should_exit_thread && apr_atomic_read32(&conf->px_errors_count) < conf->px_errors_threshold) {
-            if (apr_thread_cond_timedwait(conf->health_check_cond, conf->health_check_cond_mutex, conf->health_check_interval) == APR_TIMEUP) {
-                apr_atomic_set32(&conf->px_errors_count, 0);
-            }
-        }
-
-        apr_thread_mutex_unlock(conf->health_check_cond_mutex);
+        apr_thread_cond_timedwait(conf->health_check_cond, conf->health_check_cond_mutex, leading ? BREAKER_TICK : BREAKER_LEASE);
         if (conf->should_exit_thread) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, hc->server, LOGGER_DEBUG_FORMAT, conf->app_id, "health_check: marked to exit");
             break;
         }
 
-        // do health check until success
-        res = CURLE_AGAIN;
-        while (!conf->should_exit_thread && res != CURLE_OK) {
-            curl_easy_setopt(curl, CURLOPT_URL, health_check_url);
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, conf->api_timeout_ms);
-            res = curl_easy_perform(curl);
-            if (res != CURLE_OK && res != CURLE_OPERATION_TIMEDOUT) {
-                apr_sleep(1000); // TODO(barak): should be configured with nice default
+        for (size_t i = 0; i < sizeof(pools) / sizeof(*pools); ++i) {
+            curl_pool_reap(pools[i]);
+        }
+
+        apr_time_t now = apr_time_now();
+        bool was_leading = leading;
+        leading = px_breaker_lease_take(&conf->health->lease, pid, now, BREAKER_LEASE);
+        if (leading != was_leading) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, hc->server, LOGGER_DEBUG_FORMAT, conf->app_id, leading ? "health_check: running the health checks of the server" : "health_check: another child runs the health checks");
+        }
+        if (!leading) {
+            continue;
+        }
+        bool probe = false;
+        for (int i = 0; i < nbreakers; ++i) {
+            px_breaker_tick(breakers[i], now);
+            probed[i] = px_breaker_probe_due(breakers[i], now);
+            probe = probe || probed[i];
+        }
+        if (!probe) {
+            continue;
+        }
+
+        // one probe answers for every open breaker, all endpoints are served by the same host. the lease has to outlast
+        // the probe, or another child would probe as well.
+        px_breaker_lease_take(&conf->health->lease, pid, now, apr_time_from_msec(conf->api_timeout_ms) + BREAKER_LEASE);
+        apr_thread_mutex_unlock(conf->health_check_cond_mutex);
+        curl_easy_setopt(curl, CURLOPT_URL, health_check_url);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, conf->api_timeout_ms);
+        if (conf->curl_ca_info) {
+            curl_easy_setopt(curl, CURLOPT_CAINFO, conf->curl_ca_info);
+        }
+        CURLcode res = curl_easy_perform(curl);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, hc->server, LOGGER_DEBUG_FORMAT, conf->app_id, res == CURLE_OK ? "health_check: probe succeeded" : "health_check: probe failed");
+        now = apr_time_now();
+        for (int i = 0; i < nbreakers; ++i) {
+            if (probed[i]) {
+                px_breaker_probe_done(breakers[i], res == CURLE_OK, now);
             }
         }
-        apr_atomic_set32(&conf->px_errors_count, 0);
+        apr_thread_mutex_lock(conf->health_check_cond_mutex);
     }
+    apr_thread_mutex_unlock(conf->health_check_cond_mutex);
+    // the next child takes over without waiting for the lease to run out
+    px_breaker_lease_release(&conf->health->lease, pid);
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, hc->server, LOGGER_DEBUG_FORMAT, conf->app_id, "health_check: thread exiting");
 
@@ -380,14 +580,9 @@ static void *APR_THREAD_FUNC health_check(apr_thread_t *thd, void *data) {
 static void *APR_THREAD_FUNC background_activity_consumer(apr_thread_t *thd, void *data) {
     activity_consumer_data *consumer_data = (activity_consumer_data*)data;
     px_config *conf = consumer_data->config;
-    CURL *curl = curl_easy_init();
+    curl_pool *pool = conf->activities_endpoint->pool;
 
     void *v;
-    if (!curl) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, consumer_data->server, LOGGER_DEBUG_FORMAT, conf->app_id, "could not create curl handle, thread will not run to consume messages");
-        return NULL;
-    }
-
     while (true) {
         apr_status_t rv = apr_queue_pop(conf->activity_queue, &v);
         if (rv == APR_EINTR) {
@@ -396,28 +591,173 @@ static void *APR_THREAD_FUNC background_activity_consumer(apr_thread_t *thd, voi
         if (rv == APR_EOF) {
             break;
         }
+        if (rv == APR_SUCCESS && v && px_breaker_is_open(conf->activities_endpoint->breaker)) {
+            // the activities api is down, queued activities are dropped instead of waiting for it one by one
+            free(v);
+            continue;
+        }
         if (rv == APR_SUCCESS && v) {
             char *activity = (char *)v;
-            post_request_helper(curl, conf->activities_api_url, activity, conf->api_timeout_ms, conf, consumer_data->server, NULL);
+            // checked out per post, the activities pool is shared with the posts of request threads
+            CURL *curl = curl_pool_get_timedwait(pool, apr_time_from_msec(conf->api_timeout_ms));
+            if (!curl) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, consumer_data->server, LOGGER_DEBUG_FORMAT, conf->app_id, "could not get curl handle, activity dropped");
+                free(activity);
+                continue;
+            }
+            long timeout = px_adaptive_timeout(conf, conf->activities_endpoint->rtt, conf->api_timeout_ms);
+            CURLcode status = post_request_helper(curl, activity, timeout, conf, consumer_data->server, NULL);
+            double request_rtt;
+            if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &request_rtt)) {
+                request_rtt = 0;
+            }
+            px_endpoint_record(conf->activities_endpoint, status, request_rtt, timeout);
+            curl_pool_put(pool, curl);
             free(activity);
         }
     }
 
-    curl_easy_cleanup(curl);
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, consumer_data->server, LOGGER_DEBUG_FORMAT, conf->app_id, "activity consumer thread exited");
     apr_thread_exit(thd, 0);
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, consumer_data->server, LOGGER_DEBUG_FORMAT, conf->app_id, "Sending activity completed");
     return NULL;
 }
 
+// first party handles are reset on every put, so only the share is set up here
+static void redirect_handle_init(CURL *curl, void *data) {
+    px_share_attach((px_share*)data, curl);
+}
+
+static void warm_connection_done(CURLcode status, void *baton) {
+    warm_connection *warm = (warm_connection*)baton;
+    warm_connection_end(warm->curl);
+    if (status == CURLE_OK) {
+        apr_atomic_inc32(&warm->config->connections_warmed);
+    } else {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, warm->server, "[%s]: warm_connection: %s", warm->config->app_id, curl_easy_strerror(status));
+    }
+    curl_pool_put(warm->pool, warm->curl);
+}
+
+typedef struct connection_warmup_t {
+    apr_array_header_t *warms;
+    apr_thread_t *thread;
+    volatile apr_uint32_t stop;
+} connection_warmup_state;
+
+// each handle keeps its own connection without io threads, so the handles are warmed one after the other.
+// once the pool is cleared the handles left are put back without a transfer.
+static void *APR_THREAD_FUNC connection_warmup(apr_thread_t *thd, void *data) {
+    connection_warmup_state *warmup = (connection_warmup_state*)data;
+    for (int i = 0; i < warmup->warms->nelts; ++i) {
+        warm_connection *warm = APR_ARRAY_IDX(warmup->warms, i, warm_connection*);
+        if (apr_atomic_read32(&warmup->stop)) {
+            warm_connection_end(warm->curl);
+            curl_pool_put(warm->pool, warm->curl);
+            continue;
+        }
+        warm_connection_done(curl_easy_perform(warm->curl), warm);
+    }
+    apr_thread_exit(thd, 0);
+    return NULL;
+}
+
+// the thread uses the config pool and its curl pools, it is joined before they go away. a pre cleanup runs ahead of
+// the curl pool cleanups and of the thread's own subpool, waiting at most for the transfer in flight.
+static apr_status_t connection_warmup_join(void *data) {
+    connection_warmup_state *warmup = (connection_warmup_state*)data;
+    apr_status_t rv;
+    apr_atomic_set32(&warmup->stop, 1);
+    apr_thread_join(&rv, warmup->thread);
+    return APR_SUCCESS;
+}
+
 // --------------------------------------------------------------------------------
 //
 
+// opens curl_warm_connections connections to each endpoint off the request path. the handles are taken without
+// waiting, requests arriving meanwhile create their own handles or wait like they would for busy ones.
+static void warm_connections(apr_pool_t *p, server_rec *s, px_config *cfg) {
+    // risk api handles keep their url, the captcha and activity posts reuse their connections on the io threads
+    const char *urls[] = { cfg->risk_api_url, cfg->client_base_uri, cfg->collector_base_uri };
+    curl_pool *pools[] = { cfg->risk_endpoint->pool, cfg->redirect_curl_pool, cfg->redirect_curl_pool };
+    int endpoints = cfg->first_party_enabled ? 3 : 1;
+
+    apr_array_header_t *warms = apr_array_make(p, endpoints * cfg->curl_warm_connections, sizeof(warm_connection*));
+    for (int i = 0; i < endpoints; ++i) {
+        for (int n = 0; n < cfg->curl_warm_connections; ++n) {
+            CURL *curl = curl_pool_get(pools[i]);
+            if (!curl) {
+                break;
+            }
+            warm_connection *warm = (warm_connection*)apr_palloc(p, sizeof(warm_connection));
+            warm->config = cfg;
+            warm->server = s;
+            warm->pool = pools[i];
+            warm->curl = curl;
+            warm_connection_start(curl, urls[i], cfg);
+            APR_ARRAY_PUSH(warms, warm_connection*) = warm;
+        }
+    }
+
+    // connections of the io threads live in their multi handles, which run the transfers side by side
+    if (cfg->io) {
+        for (int i = 0; i < warms->nelts; ++i) {
+            warm_connection *warm = APR_ARRAY_IDX(warms, i, warm_connection*);
+            px_io_submit(cfg->io, p, warm->curl, cfg->api_timeout_ms, warm_connection_done, warm);
+        }
+        return;
+    }
+
+    connection_warmup_state *warmup = (connection_warmup_state*)apr_pcalloc(p, sizeof(connection_warmup_state));
+    warmup->warms = warms;
+    apr_threadattr_t *attr = NULL;
+    apr_status_t rv = apr_threadattr_create(&attr, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_create(&warmup->thread, attr, connection_warmup, warmup, p);
+    }
+    if (rv == APR_SUCCESS) {
+        apr_pool_pre_cleanup_register(p, warmup, connection_warmup_join);
+    } else {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, LOGGER_ERROR_FORMAT, cfg->app_id, "warm_connections: failed to start the warm-up thread, connections are opened by requests");
+        for (int i = 0; i < warms->nelts; ++i) {
+            warm_connection *warm = APR_ARRAY_IDX(warms, i, warm_connection*);
+            warm_connection_end(warm->curl);
+            curl_pool_put(warm->pool, warm->curl);
+        }
+    }
+}
+
+static void health_init(px_health *health, const px_config *cfg) {
+    px_breaker_options options = {
+        .window = cfg->health_check_interval,
+        .min_errors = cfg->px_errors_threshold > 0 ? cfg->px_errors_threshold : 1,
+        .error_rate = cfg->breaker_error_rate,
+        .max_latency = apr_time_from_msec(cfg->breaker_max_latency_ms),
+        .probe_min = apr_time_from_msec(cfg->breaker_probe_min_ms),
+        .probe_max = apr_time_from_msec(cfg->breaker_probe_max_ms),
+        .ramp = apr_time_from_msec(cfg->breaker_ramp_ms),
+        .ramp_exponential = cfg->breaker_ramp_exponential,
+    };
+    px_breaker_init(&health->risk, &options);
+    px_breaker_init(&health->captcha, &options);
+    px_breaker_init(&health->activities, &options);
+    px_breaker_init(&health->redirect, &options);
+}
+
 static apr_status_t create_health_check(apr_pool_t *p, server_rec *s, px_config *cfg) {
     apr_status_t rv;
 
     health_check_data *hc_data= (health_check_data*)apr_palloc(p, sizeof(health_check_data));
-    cfg->px_errors_count = 0;
+    if (!cfg->health) {
+        // no shared memory, the child finds out about outages on its own
+        cfg->health = (px_health*)apr_pcalloc(p, sizeof(px_health));
+        health_init(cfg->health, cfg);
+    }
+    cfg->risk_endpoint->breaker = &cfg->health->risk;
+    cfg->captcha_endpoint->breaker = &cfg->health->captcha;
+    cfg->activities_endpoint->breaker = &cfg->health->activities;
+    cfg->redirect_breaker = &cfg->health->redirect;
     hc_data->server = s;
     hc_data->config = cfg;
 
@@ -499,6 +839,15 @@ static apr_status_t px_child_exit(void *data) {
 
 static apr_status_t px_child_setup(apr_pool_t *p, server_rec *s) {
     apr_status_t rv = APR_SUCCESS;
+    bool pbkdf2_accelerated = px_pbkdf2_init();
+    px_codec_init();
+    int mpm_is_async = 0;
+    px_mpm_is_async = ap_mpm_query(AP_MPMQ_IS_ASYNC, &mpm_is_async) == APR_SUCCESS && mpm_is_async;
+    // the configuration pools are created from the process pool as well, their handles are released before the share
+    px_share *share = px_share_create(s->process->pool);
+    if (!share) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, "px_child_setup: failed to create the curl share, handles resolve and negotiate tls on their own");
+    }
     // init each virtual host
     for (server_rec *vs = s; vs; vs = vs->next) {
 
@@ -515,8 +864,84 @@ static apr_status_t px_child_setup(apr_pool_t *p, server_rec *s) {
             return rv;
         }
 
-        cfg->curl_pool = curl_pool_create(cfg->pool, cfg->curl_pool_size, false);
-        cfg->redirect_curl_pool = curl_pool_create(cfg->pool, cfg->redirect_curl_pool_size, true);
+        apr_time_t pools_start = apr_time_now();
+        cfg->share = share;
+        // a slow captcha or activity post cannot take the handles of risk api calls
+        cfg->risk_endpoint = px_endpoint_create(cfg->pool, cfg->risk_api_url, cfg, cfg->curl_pool_min_size, cfg->curl_pool_size);
+        cfg->captcha_endpoint = px_endpoint_create(cfg->pool, cfg->captcha_api_url, cfg, 0, cfg->curl_pool_size);
+        cfg->activities_endpoint = px_endpoint_create(cfg->pool, cfg->activities_api_url, cfg, 0, cfg->curl_pool_size);
+        cfg->redirect_rtt = px_rtt_create(cfg->pool);
+        cfg->redirect_curl_pool = curl_pool_create(cfg->pool, cfg->redirect_curl_pool_min_size, cfg->redirect_curl_pool_size, cfg->curl_pool_idle_timeout, true, redirect_handle_init, share);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, s, LOGGER_DEBUG_FORMAT, cfg->app_id, apr_psprintf(p, "px_child_setup: created %u curl handles in %" APR_TIME_T_FMT " usec",
+                    apr_atomic_read32(&cfg->risk_endpoint->pool->handles) + apr_atomic_read32(&cfg->redirect_curl_pool->handles), apr_time_now() - pools_start));
+        if (cfg->curl_io_threads > 0) {
+            cfg->io = px_io_create(cfg->pool, vs, cfg->curl_io_threads);
+            if (!cfg->io) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to start curl io threads, requests will be sent from the request thread");
+            }
+        }
+        if (cfg->curl_http2) {
+            curl_version_info_data *curl_info = curl_version_info(CURLVERSION_NOW);
+            if (!(curl_info->features & CURL_VERSION_HTTP2) || curl_info->version_num < 0x073100) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: libcurl has no HTTP/2 support, CurlHTTP2 is ignored");
+            } else if (!cfg->io) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: CurlHTTP2 without CurlIOThreads, each curl handle keeps its own connection");
+            }
+        }
+        if (cfg->suspend_requests && (!cfg->io || !px_mpm_is_async || !PX_SUSPEND_SUPPORTED)) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: SuspendRequests needs the event mpm and CurlIOThreads, requests will wait for the Risk API on their thread");
+        }
+        if (cfg->hedge_risk_requests) {
+            if (!cfg->io) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: HedgeRiskRequests needs CurlIOThreads, Risk API requests will not be hedged");
+            }
+            cfg->risk_endpoint->hedge_percentile = cfg->hedge_percentile;
+            cfg->risk_endpoint->hedge_budget = cfg->hedge_budget_percent;
+        }
+        if (cfg->curl_warm_connections > 0) {
+            warm_connections(cfg->pool, vs, cfg);
+        }
+        if (cfg->key_cache_size > 0) {
+            cfg->key_cache = px_cache_create(cfg->pool, cfg->key_cache_size, PX_DERIVED_KEY_LEN);
+            if (!cfg->key_cache) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to create cookie key cache, keys will not be cached");
+            }
+        }
+        if (cfg->verdict_cache_size > 0) {
+            cfg->verdict_cache = px_cache_create(cfg->pool, cfg->verdict_cache_size, sizeof(px_payload_verdict));
+            if (!cfg->verdict_cache) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to create cookie verdict cache, verdicts will not be cached");
+            }
+        }
+        if (cfg->negative_cache_size > 0) {
+            cfg->negative_cache = px_cache_create(cfg->pool, cfg->negative_cache_size, sizeof(px_payload_failure));
+            if (!cfg->negative_cache) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to create cookie negative cache, failures will not be cached");
+            }
+        }
+        if (cfg->key_derivation_budget > 0) {
+            cfg->key_derivation_bucket = px_token_bucket_create(cfg->pool, cfg->key_derivation_budget, cfg->key_derivation_burst);
+            if (!cfg->key_derivation_bucket) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to create key derivation budget, key derivation will not be limited");
+            }
+        }
+        // thread states are released with the child pool
+        for (int i = 0; i < cfg->payload_keys->nelts; ++i) {
+            px_payload_key *key = APR_ARRAY_IDX(cfg->payload_keys, i, px_payload_key*);
+            key->crypto = px_crypto_create(p, key->key);
+            if (!key->crypto) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to create crypto contexts, falling back to per request contexts");
+            }
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, s, LOGGER_DEBUG_FORMAT, cfg->app_id, apr_pstrcat(p, "px_child_setup: cookie key ", key->id, " is active", NULL));
+        }
+        // remembers which key matched each salt while several keys are active
+        if (cfg->payload_keys->nelts > 1 && cfg->key_cache_size > 0) {
+            cfg->key_hint_cache = px_cache_create(cfg->pool, cfg->key_cache_size, sizeof(int));
+            if (!cfg->key_hint_cache) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_child_setup: failed to create cookie key hint cache, keys will be tried in order");
+            }
+        }
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, s, LOGGER_DEBUG_FORMAT, cfg->app_id, pbkdf2_accelerated ? "px_child_setup: using sha extensions for cookie key derivation" : "px_child_setup: using openssl for cookie key derivation");
         if (cfg->background_activity_send) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, s, LOGGER_DEBUG_FORMAT, cfg->app_id, "px_child_setup: start init for background_activity_send");
 
@@ -541,6 +966,25 @@ static apr_status_t px_child_setup(apr_pool_t *p, server_rec *s) {
     return rv;
 }
 
+static int px_hook_post_config(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s) {
+    for (server_rec *vs = s; vs; vs = vs->next) {
+        px_config *cfg = ap_get_module_config(vs->module_config, &perimeterx_module);
+        if (!cfg || !cfg->module_enabled || !cfg->px_health_check || cfg->health) {
+            continue;
+        }
+        // anonymous shared memory is inherited by the children forked after this
+        apr_status_t rv = apr_shm_create(&cfg->health_shm, sizeof(px_health), NULL, pconf);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, LOGGER_ERROR_FORMAT, cfg->app_id, "px_hook_post_config: failed to create shared memory for the circuit breakers, each child will keep its own");
+            continue;
+        }
+        cfg->health = (px_health*)apr_shm_baseaddr_get(cfg->health_shm);
+        memset(cfg->health, 0, sizeof(px_health));
+        health_init(cfg->health, cfg);
+    }
+    return OK;
+}
+
 static void px_hook_child_init(apr_pool_t *p, server_rec *s) {
     apr_status_t rv = px_child_setup(p, s);
     if (rv != APR_SUCCESS) {
@@ -666,7 +1110,20 @@ static const char *set_payload_key(cmd_parms *cmd, void *config, const char *pay
     if (!conf) {
         return ERROR_CONFIG_MISSING;
     }
-    conf->payload_key = payload_key;
+    if (conf->payload_keys->nelts == PX_PAYLOAD_KEYS_MAX) {
+        return TOO_MANY_PAYLOAD_KEYS;
+    }
+    px_payload_key *key = apr_pcalloc(cmd->pool, sizeof(px_payload_key));
+    key->key = payload_key;
+    key->index = conf->payload_keys->nelts;
+    // the first 4 bytes of the key digest identify the key in logs and on the status page
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    char *id = apr_palloc(cmd->pool, 9);
+    SHA256((const unsigned char*)payload_key, strlen(payload_key), digest);
+    px_hex_encode(digest, 4, id);
+    id[8] = '\0';
+    key->id = id;
+    APR_ARRAY_PUSH(conf->payload_keys, px_payload_key*) = key;
     return NULL;
 }
 
@@ -769,6 +1226,115 @@ static const char *set_redirect_curl_pool_size(cmd_parms *cmd, void *config, con
     return NULL;
 }
 
+static const char *set_curl_pool_min_size(cmd_parms *cmd, void *config, const char *curl_pool_size) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int pool_size = atoi(curl_pool_size);
+    if (pool_size < 0) {
+        return INVALID_CURL_POOL_MIN_SIZE;
+    }
+    if (pool_size > MAX_CURL_POOL_SIZE) {
+        return MAX_CURL_POOL_SIZE_EXCEEDED;
+    }
+    conf->curl_pool_min_size = pool_size;
+    return NULL;
+}
+
+static const char *set_redirect_curl_pool_min_size(cmd_parms *cmd, void *config, const char *curl_pool_size) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int pool_size = atoi(curl_pool_size);
+    if (pool_size < 0) {
+        return INVALID_CURL_POOL_MIN_SIZE;
+    }
+    if (pool_size > MAX_CURL_POOL_SIZE) {
+        return MAX_CURL_POOL_SIZE_EXCEEDED;
+    }
+    conf->redirect_curl_pool_min_size = pool_size;
+    return NULL;
+}
+
+static const char *set_curl_pool_idle_timeout(cmd_parms *cmd, void *config, const char *idle_timeout) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int timeout = atoi(idle_timeout);
+    if (timeout < 0) {
+        return INVALID_CURL_POOL_IDLE_TIMEOUT;
+    }
+    conf->curl_pool_idle_timeout = apr_time_from_sec(timeout);
+    return NULL;
+}
+
+static const char *set_curl_io_threads(cmd_parms *cmd, void *config, const char *io_threads) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int threads = atoi(io_threads);
+    if (threads < 0) {
+        return INVALID_CURL_IO_THREADS;
+    }
+    conf->curl_io_threads = threads;
+    return NULL;
+}
+
+static const char *set_curl_warm_connections(cmd_parms *cmd, void *config, const char *warm_connections) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int connections = atoi(warm_connections);
+    if (connections < 0) {
+        return INVALID_CURL_WARM_CONNECTIONS;
+    }
+    if (connections > MAX_CURL_POOL_SIZE) {
+        return MAX_CURL_POOL_SIZE_EXCEEDED;
+    }
+    conf->curl_warm_connections = connections;
+    return NULL;
+}
+
+static const char *set_curl_tcp_keepalive(cmd_parms *cmd, void *config, const char *keepalive) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int interval = atoi(keepalive);
+    if (interval < 0) {
+        return INVALID_CURL_TCP_KEEPALIVE;
+    }
+    conf->curl_tcp_keepalive = interval;
+    return NULL;
+}
+
+static const char *set_curl_connection_idle_timeout(cmd_parms *cmd, void *config, const char *idle_timeout) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int timeout = atoi(idle_timeout);
+    if (timeout < 0) {
+        return INVALID_CURL_CONNECTION_IDLE_TIMEOUT;
+    }
+    conf->curl_connection_idle_timeout = timeout;
+    return NULL;
+}
+
+static const char *set_curl_tcp_fastopen(cmd_parms *cmd, void *config, int arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    conf->curl_tcp_fastopen = arg ? true : false;
+    return NULL;
+}
+
 
 static const char *set_base_url(cmd_parms *cmd, void *config, const char *base_url) {
     px_config *conf = get_config(cmd, config);
@@ -925,6 +1491,86 @@ static const char *set_px_errors_count_interval(cmd_parms *cmd, void *config, co
     return NULL;
 }
 
+static const char *set_breaker_error_rate(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int rate = atoi(arg);
+    if (rate < 0 || rate > 100) {
+        return INVALID_BREAKER_ERROR_RATE;
+    }
+    conf->breaker_error_rate = rate;
+    return NULL;
+}
+
+static const char *set_breaker_max_latency_ms(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    long latency = atol(arg);
+    if (latency < 0) {
+        return INVALID_BREAKER_MAX_LATENCY;
+    }
+    conf->breaker_max_latency_ms = latency;
+    return NULL;
+}
+
+static const char *set_breaker_probe_min_ms(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    long interval = atol(arg);
+    if (interval <= 0) {
+        return INVALID_BREAKER_PROBE_INTERVAL;
+    }
+    if (interval > conf->breaker_probe_max_ms) {
+        return INVALID_BREAKER_PROBE_RANGE;
+    }
+    conf->breaker_probe_min_ms = interval;
+    return NULL;
+}
+
+static const char *set_breaker_probe_max_ms(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    long interval = atol(arg);
+    if (interval <= 0) {
+        return INVALID_BREAKER_PROBE_INTERVAL;
+    }
+    if (interval < conf->breaker_probe_min_ms) {
+        return INVALID_BREAKER_PROBE_RANGE;
+    }
+    conf->breaker_probe_max_ms = interval;
+    return NULL;
+}
+
+static const char *set_breaker_ramp_ms(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    long ramp = atol(arg);
+    if (ramp < 0) {
+        return INVALID_BREAKER_RAMP;
+    }
+    conf->breaker_ramp_ms = ramp;
+    return NULL;
+}
+
+static const char *set_breaker_ramp_exponential(cmd_parms *cmd, void *config, int arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    conf->breaker_ramp_exponential = arg ? true : false;
+    return NULL;
+}
+
 static const char *set_background_activity_workers(cmd_parms *cmd, void *config, const char *arg) {
     px_config *conf = get_config(cmd, config);
     if (!conf) {
@@ -960,6 +1606,15 @@ static const char* set_proxy_url(cmd_parms *cmd, void *config, const char *proxy
     return NULL;
 }
 
+static const char* set_curl_ca_info(cmd_parms *cmd, void *config, const char *ca_info) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    conf->curl_ca_info = ca_info;
+    return NULL;
+}
+
 static const char* set_captcha_timeout(cmd_parms *cmd, void *config, const char *captcha_timeout) {
     px_config *conf = get_config(cmd, config);
     if (!conf) {
@@ -1086,6 +1741,98 @@ static const char *set_monitor_mode(cmd_parms *cmd, void *config, int arg) {
     return NULL;
 }
 
+static const char *set_curl_http2(cmd_parms *cmd, void *config, int arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    conf->curl_http2 = arg ? true : false;
+    return NULL;
+}
+
+static const char *set_suspend_requests(cmd_parms *cmd, void *config, int arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    conf->suspend_requests = arg ? true : false;
+    return NULL;
+}
+
+static const char *set_hedge_risk_requests(cmd_parms *cmd, void *config, int arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    conf->hedge_risk_requests = arg ? true : false;
+    return NULL;
+}
+
+static const char *set_hedge_percentile(cmd_parms *cmd, void *config, const char *percentile) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int pct = atoi(percentile);
+    if (pct < 1 || pct > 99) {
+        return INVALID_HEDGE_PERCENTILE;
+    }
+    conf->hedge_percentile = pct;
+    return NULL;
+}
+
+static const char *set_hedge_budget_percent(cmd_parms *cmd, void *config, const char *budget) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int pct = atoi(budget);
+    if (pct < 1 || pct > 100) {
+        return INVALID_HEDGE_BUDGET_PERCENT;
+    }
+    conf->hedge_budget_percent = pct;
+    return NULL;
+}
+
+static const char *set_adaptive_timeout_multiplier(cmd_parms *cmd, void *config, const char *multiplier) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int times = atoi(multiplier);
+    if (times < 0) {
+        return INVALID_ADAPTIVE_TIMEOUT_MULTIPLIER;
+    }
+    conf->adaptive_timeout_multiplier = times;
+    return NULL;
+}
+
+static const char *set_adaptive_timeout_min_ms(cmd_parms *cmd, void *config, const char *timeout_ms) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    long timeout = atol(timeout_ms);
+    if (timeout < 0) {
+        return INVALID_ADAPTIVE_TIMEOUT;
+    }
+    conf->adaptive_timeout_min_ms = timeout;
+    return NULL;
+}
+
+static const char *set_adaptive_timeout_max_ms(cmd_parms *cmd, void *config, const char *timeout_ms) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    long timeout = atol(timeout_ms);
+    if (timeout < 0) {
+        return INVALID_ADAPTIVE_TIMEOUT;
+    }
+    conf->adaptive_timeout_max_ms = timeout;
+    return NULL;
+}
+
 static const char *enable_captcha_subdomain(cmd_parms *cmd, void *config, int arg) {
     px_config *conf = get_config(cmd, config);
     if (!conf) {
@@ -1133,6 +1880,84 @@ static const char* set_client_base_url(cmd_parms *cmd, void *config, const char
     return NULL;
 }
 
+static const char* set_key_cache_size(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int cache_size = atoi(arg);
+    if (cache_size < 0) {
+        return INVALID_KEY_CACHE_SIZE;
+    }
+    conf->key_cache_size = cache_size;
+    return NULL;
+}
+
+static const char* set_verdict_cache_size(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int cache_size = atoi(arg);
+    if (cache_size < 0) {
+        return INVALID_VERDICT_CACHE_SIZE;
+    }
+    conf->verdict_cache_size = cache_size;
+    return NULL;
+}
+
+static const char* set_negative_cache_size(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int cache_size = atoi(arg);
+    if (cache_size < 0) {
+        return INVALID_NEGATIVE_CACHE_SIZE;
+    }
+    conf->negative_cache_size = cache_size;
+    return NULL;
+}
+
+static const char* set_negative_cache_ttl(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int ttl = atoi(arg);
+    if (ttl <= 0) {
+        return INVALID_NEGATIVE_CACHE_TTL;
+    }
+    conf->negative_cache_ttl = ttl;
+    return NULL;
+}
+
+static const char* set_key_derivation_budget(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int budget = atoi(arg);
+    if (budget < 0) {
+        return INVALID_KEY_DERIVATION_BUDGET;
+    }
+    conf->key_derivation_budget = budget;
+    return NULL;
+}
+
+static const char* set_key_derivation_burst(cmd_parms *cmd, void *config, const char *arg) {
+    px_config *conf = get_config(cmd, config);
+    if (!conf) {
+        return ERROR_CONFIG_MISSING;
+    }
+    int burst = atoi(arg);
+    if (burst < 0) {
+        return INVALID_KEY_DERIVATION_BURST;
+    }
+    conf->key_derivation_burst = burst;
+    return NULL;
+}
+
 static int px_hook_post_request(request_rec *r) {
     px_config *conf = ap_get_module_config(r->server->module_config, &perimeterx_module);
     return px_handle_request(r, conf);
@@ -1151,12 +1976,30 @@ static void *create_config(apr_pool_t *p) {
         conf->skip_mod_by_envvar = false;
         conf->curl_pool_size = 100;
         conf->redirect_curl_pool_size = 40;
+        conf->curl_pool_min_size = 0;
+        conf->redirect_curl_pool_min_size = 0;
+        conf->curl_pool_idle_timeout = apr_time_from_sec(60);
+        conf->curl_io_threads = 0;
+        conf->suspend_requests = false;
+        conf->hedge_risk_requests = false;
+        conf->hedge_percentile = 95;
+        conf->hedge_budget_percent = 5;
+        conf->adaptive_timeout_multiplier = 0;
+        conf->adaptive_timeout_min_ms = 100;
+        conf->adaptive_timeout_max_ms = 0;
+        conf->curl_http2 = false;
+        conf->curl_warm_connections = 0;
+        conf->curl_tcp_keepalive = 0;
+        conf->curl_connection_idle_timeout = 0;
+        conf->curl_tcp_fastopen = false;
         conf->base_url = DEFAULT_BASE_URL;
         conf->risk_api_url = apr_pstrcat(p, conf->base_url, RISK_API, NULL);
         conf->captcha_api_url = apr_pstrcat(p, conf->base_url, CAPTCHA_API, NULL);
         conf->activities_api_url = apr_pstrcat(p, conf->base_url, ACTIVITIES_API, NULL);
         conf->app_id = NULL;
-        conf->payload_key = NULL;
+        conf->payload_keys = apr_array_make(p, 2, sizeof(px_payload_key*));
+        conf->payload_key_last = 0;
+        conf->key_hint_cache = NULL;
         conf->auth_token = NULL;
         conf->auth_header = NULL;
         conf->client_path_prefix = NULL;
@@ -1173,6 +2016,14 @@ static void *create_config(apr_pool_t *p) {
         conf->background_activity_queue_size = 1000;
         conf->px_errors_threshold = 100;
         conf->health_check_interval = apr_time_from_sec(60); // 1 minute
+        // 0 keeps opening on MaxPXErrorsThreshold alone, like the health check before the breakers
+        conf->breaker_error_rate = 0;
+        conf->breaker_max_latency_ms = 0;
+        conf->breaker_probe_min_ms = 1000;
+        conf->breaker_probe_max_ms = 60000;
+        conf->breaker_ramp_ms = 0;
+        conf->breaker_ramp_exponential = false;
+        conf->redirect_breaker = NULL;
         conf->px_health_check = false;
         conf->score_header_name = SCORE_HEADER_NAME;
         conf->vid_header_enabled = false;
@@ -1189,6 +2040,18 @@ static void *create_config(apr_pool_t *p) {
         conf->first_party_enabled = true;
         conf->first_party_xhr_enabled = true;
         conf->client_base_uri = "https://client.perimeterx.net";
+        conf->key_cache_size = 1000;
+        conf->key_cache = NULL;
+        conf->verdict_cache_size = 0;
+        conf->verdict_cache = NULL;
+        conf->negative_cache_size = 0;
+        conf->negative_cache_ttl = 60;
+        conf->negative_cache = NULL;
+        conf->key_derivation_budget = 0;
+        conf->key_derivation_burst = 0;
+        conf->key_derivation_bucket = NULL;
+        conf->key_derivations = 0;
+        conf->key_derivations_throttled = 0;
     }
     return conf;
 }
@@ -1209,11 +2072,11 @@ static const command_rec px_directives[] = {
             NULL,
             OR_ALL,
             "PX Application ID"),
-    AP_INIT_TAKE1("CookieKey",
+    AP_INIT_ITERATE("CookieKey",
             set_payload_key,
             NULL,
             OR_ALL,
-            "Cookie decryption key"),
+            "Cookie decryption keys, several keys can be active while the key is rotated"),
     AP_INIT_TAKE1("AuthToken",
             set_auth_token,
             NULL,
@@ -1274,6 +2137,86 @@ static const command_rec px_directives[] = {
             NULL,
             OR_ALL,
             "Determines number of curl active handles"),
+    AP_INIT_TAKE1("CurlPoolMinSize",
+            set_curl_pool_min_size,
+            NULL,
+            OR_ALL,
+            "Number of curl handles created at startup and kept when idle"),
+    AP_INIT_TAKE1("RedirectCurlPoolMinSize",
+            set_redirect_curl_pool_min_size,
+            NULL,
+            OR_ALL,
+            "Number of redirect curl handles created at startup and kept when idle"),
+    AP_INIT_TAKE1("CurlPoolIdleTimeout",
+            set_curl_pool_idle_timeout,
+            NULL,
+            OR_ALL,
+            "Seconds after which idle curl handles above the min size are released, 0 keeps them"),
+    AP_INIT_TAKE1("CurlIOThreads",
+            set_curl_io_threads,
+            NULL,
+            OR_ALL,
+            "Number of threads running the outbound PerimeterX requests of a child, 0 runs them on the request thread"),
+    AP_INIT_FLAG("CurlHTTP2",
+            set_curl_http2,
+            NULL,
+            OR_ALL,
+            "Toggle HTTP/2 to the PerimeterX endpoints, requests of an io thread share one connection per host"),
+    AP_INIT_TAKE1("CurlWarmConnections",
+            set_curl_warm_connections,
+            NULL,
+            OR_ALL,
+            "Number of connections a child opens to each PerimeterX endpoint when it starts"),
+    AP_INIT_TAKE1("CurlTCPKeepAlive",
+            set_curl_tcp_keepalive,
+            NULL,
+            OR_ALL,
+            "Seconds an upstream connection is idle before tcp keepalive probes are sent, 0 disables them"),
+    AP_INIT_TAKE1("CurlConnectionIdleTimeout",
+            set_curl_connection_idle_timeout,
+            NULL,
+            OR_ALL,
+            "Seconds an idle upstream connection is kept for reuse, 0 keeps the libcurl default"),
+    AP_INIT_FLAG("CurlTCPFastOpen",
+            set_curl_tcp_fastopen,
+            NULL,
+            OR_ALL,
+            "Toggle tcp fast open for upstream connections"),
+    AP_INIT_FLAG("SuspendRequests",
+            set_suspend_requests,
+            NULL,
+            OR_ALL,
+            "Toggle releasing the worker thread while a request waits for the Risk API, needs the event mpm and CurlIOThreads"),
+    AP_INIT_FLAG("HedgeRiskRequests",
+            set_hedge_risk_requests,
+            NULL,
+            OR_ALL,
+            "Toggle sending a slow Risk API request again on another connection, the first response is used"),
+    AP_INIT_TAKE1("HedgePercentile",
+            set_hedge_percentile,
+            NULL,
+            OR_ALL,
+            "Percentile of the Risk API response time after which a request is hedged"),
+    AP_INIT_TAKE1("HedgeBudgetPercent",
+            set_hedge_budget_percent,
+            NULL,
+            OR_ALL,
+            "Max hedged Risk API requests, in percent of all Risk API requests"),
+    AP_INIT_TAKE1("AdaptiveTimeoutMultiplier",
+            set_adaptive_timeout_multiplier,
+            NULL,
+            OR_ALL,
+            "Sets the timeout of each PerimeterX endpoint to this multiple of its p99 response time, 0 keeps the configured timeouts"),
+    AP_INIT_TAKE1("AdaptiveTimeoutMinMS",
+            set_adaptive_timeout_min_ms,
+            NULL,
+            OR_ALL,
+            "Lowest adaptive timeout in milliseconds"),
+    AP_INIT_TAKE1("AdaptiveTimeoutMaxMS",
+            set_adaptive_timeout_max_ms,
+            NULL,
+            OR_ALL,
+            "Highest adaptive timeout in milliseconds, 0 uses APITimeoutMS and CaptchaTimeout"),
     AP_INIT_TAKE1("BaseURL",
             set_base_url,
             NULL,
@@ -1354,12 +2297,47 @@ static const command_rec px_directives[] = {
             set_px_errors_count_interval,
             NULL,
             OR_ALL,
-            "Time in milliseconds until we set the px server errors count back to zero"),
+            "Time in milliseconds over which the circuit breakers count errors and latency"),
+    AP_INIT_TAKE1("BreakerErrorRatePercent",
+            set_breaker_error_rate,
+            NULL,
+            OR_ALL,
+            "Percent of failed requests that opens a circuit breaker once MaxPXErrorsThreshold is reached, 0 opens it on the threshold alone"),
+    AP_INIT_TAKE1("BreakerMaxLatencyMS",
+            set_breaker_max_latency_ms,
+            NULL,
+            OR_ALL,
+            "p99 response time in milliseconds that opens a circuit breaker, 0 ignores latency"),
+    AP_INIT_TAKE1("BreakerProbeMinMS",
+            set_breaker_probe_min_ms,
+            NULL,
+            OR_ALL,
+            "Milliseconds before the first health check of an open circuit breaker"),
+    AP_INIT_TAKE1("BreakerProbeMaxMS",
+            set_breaker_probe_max_ms,
+            NULL,
+            OR_ALL,
+            "Longest interval in milliseconds between health checks of an open circuit breaker"),
+    AP_INIT_TAKE1("BreakerRampMS",
+            set_breaker_ramp_ms,
+            NULL,
+            OR_ALL,
+            "Milliseconds over which the Risk API calls grow back after a circuit breaker recovered, 0 resumes all of them at once"),
+    AP_INIT_FLAG("BreakerRampExponential",
+            set_breaker_ramp_exponential,
+            NULL,
+            OR_ALL,
+            "Toggle doubling the Risk API calls over the ramp instead of growing them linearly"),
     AP_INIT_TAKE1("ProxyURL",
             set_proxy_url,
             NULL,
             OR_ALL,
             "Proxy URL for outgoing PerimeterX service API"),
+    AP_INIT_TAKE1("CurlCAInfo",
+            set_curl_ca_info,
+            NULL,
+            OR_ALL,
+            "CA certificates file used to verify the PerimeterX service, the libcurl default when unset"),
     AP_INIT_FLAG("ScoreHeader",
             set_score_header,
             NULL,
@@ -1445,15 +2423,175 @@ static const command_rec px_directives[] = {
             NULL,
             OR_ALL,
             "Sets base url which client activity requersts will be redirected to"),
+    AP_INIT_TAKE1("CookieKeyCacheSize",
+            set_key_cache_size,
+            NULL,
+            OR_ALL,
+            "Number of derived cookie keys cached per child, 0 disables the cache"),
+    AP_INIT_TAKE1("CookieVerdictCacheSize",
+            set_verdict_cache_size,
+            NULL,
+            OR_ALL,
+            "Number of validated cookies cached per child, 0 disables the cache"),
+    AP_INIT_TAKE1("CookieNegativeCacheSize",
+            set_negative_cache_size,
+            NULL,
+            OR_ALL,
+            "Number of invalid cookies remembered per child, 0 disables the cache"),
+    AP_INIT_TAKE1("CookieNegativeCacheTTL",
+            set_negative_cache_ttl,
+            NULL,
+            OR_ALL,
+            "Seconds an invalid cookie is remembered"),
+    AP_INIT_TAKE1("CookieKeyDerivationBudget",
+            set_key_derivation_budget,
+            NULL,
+            OR_ALL,
+            "Cookie key derivation iterations per second allowed per child, 0 disables the limit"),
+    AP_INIT_TAKE1("CookieKeyDerivationBurst",
+            set_key_derivation_burst,
+            NULL,
+            OR_ALL,
+            "Cookie key derivation iterations allowed in a burst, defaults to one second of budget"),
     { NULL }
 };
 
+static void px_status_print(request_rec *r, int flags, const char *name, apr_uint32_t value) {
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "PX%s: %u\n", name, value);
+    } else {
+        ap_rprintf(r, "<dt>%s: %u</dt>\n", name, value);
+    }
+}
+
+static void px_status_print_rtt(request_rec *r, int flags, const char *name, const px_config *conf, px_rolling_histogram *rtt, long timeout) {
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "RttP50Ms", NULL), (apr_uint32_t)apr_time_as_msec(px_rolling_histogram_percentile(rtt, 50)));
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "RttP99Ms", NULL), (apr_uint32_t)apr_time_as_msec(px_rolling_histogram_percentile(rtt, 99)));
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "TimeoutMs", NULL), (apr_uint32_t)px_adaptive_timeout(conf, rtt, timeout));
+}
+
+static void px_status_print_breaker(request_rec *r, int flags, const char *name, px_breaker *breaker) {
+    if (!breaker) {
+        return;
+    }
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "BreakerState", NULL), apr_atomic_read32(&breaker->state));
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "BreakerTrips", NULL), apr_atomic_read32(&breaker->trips));
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "BreakerProbes", NULL), apr_atomic_read32(&breaker->probes));
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "BreakerAdmitPercent", NULL), (apr_uint32_t)((apr_uint64_t)apr_atomic_read32(&breaker->admit) * 100 / PX_BREAKER_ADMIT_ALL));
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "BreakerRamped", NULL), apr_atomic_read32(&breaker->ramped));
+}
+
+static void px_status_print_curl_pool(request_rec *r, int flags, const char *name, curl_pool *pool) {
+    curl_pool_stats stats;
+    curl_pool_get_stats(pool, &stats);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "MaxSize", NULL), stats.max_size);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "Handles", NULL), stats.handles);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "Created", NULL), stats.created);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "Reaped", NULL), stats.reaped);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "Acquired", NULL), stats.acquired);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "Waits", NULL), stats.waits);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "Timeouts", NULL), stats.timeouts);
+    px_status_print(r, flags, apr_pstrcat(r->pool, name, "WaitTimeMs", NULL), (apr_uint32_t)apr_time_as_msec(stats.wait_time));
+}
+
+// reports this child's PerimeterX counters on mod_status page
+static int px_hook_status(request_rec *r, int flags) {
+    px_config *conf = ap_get_module_config(r->server->module_config, &perimeterx_module);
+    if (!conf || !conf->module_enabled) {
+        return OK;
+    }
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("<hr />\n<h2>PerimeterX (this child)</h2>\n<dl>\n", r);
+    }
+
+    px_cache_stats key_cache_stats;
+    px_cache_get_stats(conf->key_cache, &key_cache_stats);
+    px_status_print(r, flags, "KeyCacheSize", key_cache_stats.size);
+    px_status_print(r, flags, "KeyCacheHits", key_cache_stats.hits);
+    px_status_print(r, flags, "KeyCacheMisses", key_cache_stats.misses);
+    px_status_print(r, flags, "KeyCacheEvictions", key_cache_stats.evictions);
+    for (int i = 0; i < conf->payload_keys->nelts; ++i) {
+        px_payload_key *key = APR_ARRAY_IDX(conf->payload_keys, i, px_payload_key*);
+        px_status_print(r, flags, apr_pstrcat(r->pool, "CookieKey", key->id, NULL), apr_atomic_read32(&key->cookies));
+    }
+    px_cache_stats key_hint_cache_stats;
+    px_cache_get_stats(conf->key_hint_cache, &key_hint_cache_stats);
+    px_status_print(r, flags, "KeyHintHits", key_hint_cache_stats.hits);
+    px_status_print(r, flags, "KeyHintMisses", key_hint_cache_stats.misses);
+    px_status_print_curl_pool(r, flags, "CurlPool", conf->risk_endpoint->pool);
+    px_status_print_curl_pool(r, flags, "CaptchaCurlPool", conf->captcha_endpoint->pool);
+    px_status_print_curl_pool(r, flags, "ActivitiesCurlPool", conf->activities_endpoint->pool);
+    px_status_print_curl_pool(r, flags, "RedirectCurlPool", conf->redirect_curl_pool);
+    px_io_stats io_stats;
+    px_io_get_stats(conf->io, &io_stats);
+    px_status_print(r, flags, "IOSubmitted", io_stats.submitted);
+    px_status_print(r, flags, "IOCompleted", io_stats.completed);
+    px_status_print(r, flags, "IOExpired", io_stats.expired);
+    px_status_print(r, flags, "IORttMs", (apr_uint32_t)apr_time_as_msec(io_stats.rtt_total));
+    px_status_print(r, flags, "IORttP50Ms", (apr_uint32_t)apr_time_as_msec(io_stats.rtt_p50));
+    px_status_print(r, flags, "IORttP99Ms", (apr_uint32_t)apr_time_as_msec(io_stats.rtt_p99));
+    px_status_print(r, flags, "IOConnects", io_stats.connects);
+    px_status_print(r, flags, "IOTLSHandshakes", io_stats.tls_handshakes);
+    px_share_stats share_stats;
+    px_share_get_stats(&share_stats);
+    px_status_print(r, flags, "ShareTransfers", share_stats.transfers);
+    px_status_print(r, flags, "ConnectionsReused", share_stats.reused);
+    px_status_print(r, flags, "ConnectionReusePct", share_stats.transfers ? (apr_uint32_t)((apr_uint64_t)share_stats.reused * 100 / share_stats.transfers) : 0);
+    px_status_print(r, flags, "TLSHandshakes", share_stats.tls_handshakes);
+    px_status_print(r, flags, "TLSResumed", share_stats.tls_resumed);
+    px_status_print(r, flags, "TLSResumptionPct", share_stats.tls_handshakes ? (apr_uint32_t)((apr_uint64_t)share_stats.tls_resumed * 100 / share_stats.tls_handshakes) : 0);
+    px_status_print(r, flags, "ConnectionsWarmed", apr_atomic_read32(&conf->connections_warmed));
+    px_status_print(r, flags, "RequestsSuspended", apr_atomic_read32(&conf->requests_suspended));
+    px_status_print_rtt(r, flags, "Risk", conf, conf->risk_endpoint->rtt, conf->api_timeout_ms);
+    px_status_print_rtt(r, flags, "Captcha", conf, conf->captcha_endpoint->rtt, conf->captcha_timeout);
+    px_status_print_rtt(r, flags, "Activities", conf, conf->activities_endpoint->rtt, conf->api_timeout_ms);
+    px_status_print_rtt(r, flags, "FirstParty", conf, conf->redirect_rtt, conf->api_timeout_ms);
+    if (conf->health) {
+        px_status_print(r, flags, "HealthCheckLeader", px_breaker_lease_holder(&conf->health->lease, apr_time_now()));
+    }
+    px_status_print_breaker(r, flags, "Risk", conf->risk_endpoint->breaker);
+    px_status_print_breaker(r, flags, "Captcha", conf->captcha_endpoint->breaker);
+    px_status_print_breaker(r, flags, "Activities", conf->activities_endpoint->breaker);
+    px_status_print_breaker(r, flags, "FirstParty", conf->redirect_breaker);
+    px_status_print(r, flags, "HedgesFired", apr_atomic_read32(&conf->risk_endpoint->hedges_fired));
+    px_status_print(r, flags, "HedgesWon", apr_atomic_read32(&conf->risk_endpoint->hedges_won));
+    px_status_print(r, flags, "KeyDerivations", apr_atomic_read32(&conf->key_derivations));
+    px_status_print(r, flags, "KeyDerivationsThrottled", apr_atomic_read32(&conf->key_derivations_throttled));
+
+    px_cache_stats verdict_cache_stats;
+    px_cache_get_stats(conf->verdict_cache, &verdict_cache_stats);
+    px_status_print(r, flags, "VerdictCacheSize", verdict_cache_stats.size);
+    px_status_print(r, flags, "VerdictCacheHits", verdict_cache_stats.hits);
+    px_status_print(r, flags, "VerdictCacheMisses", verdict_cache_stats.misses);
+    px_status_print(r, flags, "VerdictCacheEvictions", verdict_cache_stats.evictions);
+    px_status_print(r, flags, "VerdictCacheExpired", verdict_cache_stats.expired);
+
+    px_cache_stats negative_cache_stats;
+    px_cache_get_stats(conf->negative_cache, &negative_cache_stats);
+    px_status_print(r, flags, "NegativeCacheSize", negative_cache_stats.size);
+    px_status_print(r, flags, "NegativeCacheHits", negative_cache_stats.hits);
+    px_status_print(r, flags, "NegativeCacheMisses", negative_cache_stats.misses);
+    px_status_print(r, flags, "NegativeCacheEvictions", negative_cache_stats.evictions);
+    px_status_print(r, flags, "NegativeCacheExpired", negative_cache_stats.expired);
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("</dl>\n", r);
+    }
+    return OK;
+}
+
 static void perimeterx_register_hooks(apr_pool_t *pool) {
     static const char *const asz_pre[] = { "mod_setenvif.c", NULL };
 
     ap_hook_post_read_request(px_hook_post_request, asz_pre, NULL, APR_HOOK_MIDDLE);
+#if PX_SUSPEND_SUPPORTED
+    ap_hook_quick_handler(px_hook_quick_handler, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_hook_suspend_connection(px_hook_suspend_connection, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
     ap_hook_child_init(px_hook_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_pre_config(px_hook_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(px_hook_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK(ap, status_hook, px_hook_status, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 static void *create_server_config(apr_pool_t *pool, server_rec *s) {
@@ -0,0 +1,227 @@
+#include "px_breaker.h"
+
+#include <unistd.h>
+
+#include <apr_atomic.h>
+
+void px_breaker_init(px_breaker *breaker, const px_breaker_options *options) {
+    breaker->options = *options;
+    if (breaker->options.min_errors == 0) {
+        breaker->options.min_errors = 1;
+    }
+    breaker->slot_length = options->window / PX_BREAKER_SLOTS;
+    if (breaker->slot_length <= 0) {
+        breaker->slot_length = 1;
+    }
+    px_rolling_histogram_init(&breaker->rtt, options->window);
+    breaker->backoff = options->probe_min;
+    // children forked together have the same clock and addresses, not the same pid
+    breaker->seed = (apr_uint32_t)apr_time_now() ^ ((apr_uint32_t)getpid() << 16);
+    if (breaker->seed == 0) {
+        breaker->seed = 1;
+    }
+    breaker->admit = PX_BREAKER_ADMIT_ALL;
+    breaker->state = PX_BREAKER_CLOSED;
+}
+
+px_breaker *px_breaker_create(apr_pool_t *p, const px_breaker_options *options) {
+    px_breaker *breaker = (px_breaker*)apr_pcalloc(p, sizeof(px_breaker));
+    px_breaker_init(breaker, options);
+    return breaker;
+}
+
+bool px_breaker_is_open(px_breaker *breaker) {
+    return breaker && apr_atomic_read32(&breaker->state) == PX_BREAKER_OPEN;
+}
+
+bool px_breaker_admit(px_breaker *breaker) {
+    if (!breaker) {
+        return true;
+    }
+    apr_uint32_t state = apr_atomic_read32(&breaker->state);
+    if (state != PX_BREAKER_HALF_OPEN) {
+        return state == PX_BREAKER_CLOSED;
+    }
+    apr_uint64_t admit = apr_atomic_read32(&breaker->admit);
+    if (admit >= PX_BREAKER_ADMIT_ALL) {
+        return true;
+    }
+    // the n-th request is admitted when it moves the admitted total to the next whole request, which spreads them
+    // evenly and needs no random numbers shared by the children
+    apr_uint64_t n = apr_atomic_inc32(&breaker->admit_count);
+    if (((n + 1) * admit) / PX_BREAKER_ADMIT_ALL != (n * admit) / PX_BREAKER_ADMIT_ALL) {
+        return true;
+    }
+    apr_atomic_inc32(&breaker->ramped);
+    return false;
+}
+
+static apr_uint32_t period_of(const px_breaker *breaker, apr_time_t now) {
+    return (apr_uint32_t)(now / breaker->slot_length);
+}
+
+void px_breaker_record(px_breaker *breaker, CURLcode status, double request_rtt) {
+    if (!breaker) {
+        return;
+    }
+    apr_uint32_t period = period_of(breaker, apr_time_now());
+    px_breaker_slot *slot = &breaker->slots[period % PX_BREAKER_SLOTS];
+    apr_uint32_t old = apr_atomic_read32(&slot->period);
+    // the thread that moves the slot to the current period clears it
+    if (old != period && apr_atomic_cas32(&slot->period, period, old) == old) {
+        apr_atomic_set32(&slot->requests, 0);
+        apr_atomic_set32(&slot->errors, 0);
+    }
+    apr_atomic_inc32(&slot->requests);
+    if (status == CURLE_OK) {
+        px_rolling_histogram_add(&breaker->rtt, (apr_uint64_t)(request_rtt * APR_USEC_PER_SEC));
+    } else if (status != CURLE_HTTP_RETURNED_ERROR) {
+        apr_atomic_inc32(&slot->errors);
+    }
+}
+
+// stale slots are skipped by the totals and cleared by the next request landing in them
+static void window_clear(px_breaker *breaker) {
+    for (int i = 0; i < PX_BREAKER_SLOTS; ++i) {
+        apr_atomic_set32(&breaker->slots[i].period, 0);
+    }
+    for (int i = 0; i < PX_HISTOGRAM_SLOTS; ++i) {
+        apr_atomic_set32(&breaker->rtt.periods[i], 0);
+    }
+}
+
+static bool window_tripped(px_breaker *breaker, apr_time_t now) {
+    const px_breaker_options *options = &breaker->options;
+    apr_uint32_t period = period_of(breaker, now);
+    apr_uint64_t requests = 0;
+    apr_uint64_t errors = 0;
+    for (int i = 0; i < PX_BREAKER_SLOTS; ++i) {
+        px_breaker_slot *slot = &breaker->slots[i];
+        if (period - apr_atomic_read32(&slot->period) < PX_BREAKER_SLOTS) {
+            requests += apr_atomic_read32(&slot->requests);
+            errors += apr_atomic_read32(&slot->errors);
+        }
+    }
+    if (errors >= options->min_errors && errors * 100 >= (apr_uint64_t)options->error_rate * requests) {
+        return true;
+    }
+    return options->max_latency > 0 && px_rolling_histogram_count(&breaker->rtt) >= options->min_errors
+        && (apr_interval_time_t)px_rolling_histogram_percentile(&breaker->rtt, 99) >= options->max_latency;
+}
+
+// between half and all of the backoff, so the children of a server do not probe in step
+static apr_time_t jittered(px_breaker *breaker, apr_time_t now) {
+    // xorshift32
+    apr_uint32_t x = breaker->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    breaker->seed = x;
+    apr_interval_time_t half = breaker->backoff / 2;
+    return now + half + (half > 0 ? (apr_interval_time_t)(x % (apr_uint64_t)half) : 0);
+}
+
+static void backoff_double(px_breaker *breaker) {
+    breaker->backoff *= 2;
+    if (breaker->backoff > breaker->options.probe_max) {
+        breaker->backoff = breaker->options.probe_max;
+    }
+}
+
+// the fraction admitted at elapsed into the ramp, starting from 1/128
+static apr_uint32_t ramp_admit(const px_breaker *breaker, apr_interval_time_t elapsed) {
+    const px_breaker_options *options = &breaker->options;
+    const apr_uint32_t least = PX_BREAKER_ADMIT_ALL >> 7;
+    if (elapsed >= options->ramp) {
+        return PX_BREAKER_ADMIT_ALL;
+    }
+    if (options->ramp_exponential) {
+        // seven doublings over the ramp, linear within each of them
+        apr_uint64_t steps = (apr_uint64_t)elapsed * 7;
+        apr_uint32_t base = least << (steps / options->ramp);
+        return base + (apr_uint32_t)(base * (steps % options->ramp) / options->ramp);
+    }
+    apr_uint32_t admit = (apr_uint32_t)((apr_uint64_t)elapsed * PX_BREAKER_ADMIT_ALL / options->ramp);
+    return admit > least ? admit : least;
+}
+
+static void breaker_open(px_breaker *breaker, apr_time_t now) {
+    breaker->next_probe = jittered(breaker, now);
+    apr_atomic_inc32(&breaker->trips);
+    apr_atomic_set32(&breaker->admit, 0);
+    apr_atomic_set32(&breaker->state, PX_BREAKER_OPEN);
+}
+
+void px_breaker_tick(px_breaker *breaker, apr_time_t now) {
+    switch (apr_atomic_read32(&breaker->state)) {
+    case PX_BREAKER_CLOSED:
+        if (window_tripped(breaker, now)) {
+            breaker->backoff = breaker->options.probe_min;
+            breaker_open(breaker, now);
+        }
+        break;
+    case PX_BREAKER_HALF_OPEN:
+        // the endpoint failed again under traffic, it gets longer to recover
+        if (window_tripped(breaker, now)) {
+            backoff_double(breaker);
+            breaker_open(breaker, now);
+        } else if (now >= breaker->half_open_until) {
+            breaker->backoff = breaker->options.probe_min;
+            apr_atomic_set32(&breaker->admit, PX_BREAKER_ADMIT_ALL);
+            apr_atomic_set32(&breaker->state, PX_BREAKER_CLOSED);
+        } else {
+            apr_atomic_set32(&breaker->admit, ramp_admit(breaker, now - breaker->half_open_since));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+bool px_breaker_probe_due(const px_breaker *breaker, apr_time_t now) {
+    return apr_atomic_read32((volatile apr_uint32_t*)&breaker->state) == PX_BREAKER_OPEN && now >= breaker->next_probe;
+}
+
+void px_breaker_probe_done(px_breaker *breaker, bool healthy, apr_time_t now) {
+    apr_atomic_inc32(&breaker->probes);
+    if (!healthy) {
+        backoff_double(breaker);
+        breaker->next_probe = jittered(breaker, now);
+        return;
+    }
+    // the errors that opened the breaker must not close it again right away
+    window_clear(breaker);
+    breaker->half_open_since = now;
+    breaker->half_open_until = now + (breaker->options.ramp > breaker->slot_length ? breaker->options.ramp : breaker->slot_length);
+    apr_atomic_set32(&breaker->admit, ramp_admit(breaker, 0));
+    apr_atomic_set32(&breaker->state, PX_BREAKER_HALF_OPEN);
+}
+
+static apr_uint64_t lease_of(apr_uint32_t id, apr_uint32_t until) {
+    return ((apr_uint64_t)id << 32) | until;
+}
+
+bool px_breaker_lease_take(px_breaker_lease *lease, apr_uint32_t id, apr_time_t now, apr_interval_time_t length) {
+    // msec wrap around every 49 days, ends are compared by their distance
+    apr_uint32_t now_ms = (apr_uint32_t)apr_time_as_msec(now);
+    apr_uint64_t holder = __atomic_load_n(&lease->holder, __ATOMIC_ACQUIRE);
+    apr_uint32_t holder_id = (apr_uint32_t)(holder >> 32);
+    if (holder_id != 0 && holder_id != id && (apr_int32_t)((apr_uint32_t)holder - now_ms) > 0) {
+        return false;
+    }
+    apr_uint64_t taken = lease_of(id, now_ms + (apr_uint32_t)apr_time_as_msec(length));
+    return __atomic_compare_exchange_n(&lease->holder, &holder, taken, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+void px_breaker_lease_release(px_breaker_lease *lease, apr_uint32_t id) {
+    apr_uint64_t holder = __atomic_load_n(&lease->holder, __ATOMIC_ACQUIRE);
+    if ((apr_uint32_t)(holder >> 32) == id) {
+        __atomic_compare_exchange_n(&lease->holder, &holder, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+}
+
+apr_uint32_t px_breaker_lease_holder(px_breaker_lease *lease, apr_time_t now) {
+    apr_uint64_t holder = __atomic_load_n(&lease->holder, __ATOMIC_ACQUIRE);
+    apr_uint32_t now_ms = (apr_uint32_t)apr_time_as_msec(now);
+    return (apr_int32_t)((apr_uint32_t)holder - now_ms) > 0 ? (apr_uint32_t)(holder >> 32) : 0;
+}
@@ -0,0 +1,93 @@
+#ifndef PX_BREAKER_H
+#define PX_BREAKER_H
+
+#include <stdbool.h>
+
+#include <curl/curl.h>
+#include <apr_pools.h>
+#include <apr_time.h>
+
+#include "px_histogram.h"
+
+// the window is counted in this many slots, the oldest is cleared as time moves on
+#define PX_BREAKER_SLOTS 10
+// the fraction of requests a recovering breaker admits is kept in 1/65536
+#define PX_BREAKER_ADMIT_ALL 65536
+
+typedef enum {
+    PX_BREAKER_CLOSED,
+    PX_BREAKER_OPEN,
+    PX_BREAKER_HALF_OPEN,
+} px_breaker_state;
+
+typedef struct px_breaker_options_t {
+    apr_interval_time_t window;
+    // errors in the window before the error rate is considered, also the samples needed for the latency
+    apr_uint32_t min_errors;
+    apr_uint32_t error_rate; // in percent of the requests in the window, 0 trips on min_errors alone
+    apr_interval_time_t max_latency; // p99 of the window that trips the breaker, 0 ignores latency
+    // delay between probes of an open breaker, doubled after every failed probe
+    apr_interval_time_t probe_min;
+    apr_interval_time_t probe_max;
+    // after a successful probe the admitted requests grow over the ramp, 0 admits all of them at once. exponential
+    // doubles them from 1/128, linear grows them evenly.
+    apr_interval_time_t ramp;
+    bool ramp_exponential;
+} px_breaker_options;
+
+typedef struct px_breaker_slot_t {
+    volatile apr_uint32_t period;
+    volatile apr_uint32_t requests;
+    volatile apr_uint32_t errors;
+} px_breaker_slot;
+
+// requests record their outcome and read the state, every transition is made by a single monitor thread. holds no
+// pointers, so it can be placed in shared memory and used by every child of a server.
+typedef struct px_breaker_t {
+    volatile apr_uint32_t state;
+    px_breaker_slot slots[PX_BREAKER_SLOTS];
+    px_rolling_histogram rtt;
+    px_breaker_options options;
+    apr_interval_time_t slot_length;
+    volatile apr_uint32_t trips;
+    volatile apr_uint32_t probes;
+    volatile apr_uint32_t admit; // of PX_BREAKER_ADMIT_ALL, while half open
+    volatile apr_uint32_t admit_count;
+    volatile apr_uint32_t ramped; // requests turned away by the ramp
+    // only used by the monitor, the lease holder when shared
+    apr_interval_time_t backoff;
+    apr_time_t next_probe;
+    apr_time_t half_open_since;
+    apr_time_t half_open_until;
+    apr_uint32_t seed;
+} px_breaker;
+
+// the monitor of breakers shared by several processes is the holder of their lease
+typedef struct px_breaker_lease_t {
+    volatile apr_uint64_t holder; // id in the high word, end of the lease in msec in the low word
+} px_breaker_lease;
+
+px_breaker *px_breaker_create(apr_pool_t *p, const px_breaker_options *options);
+// sets up zeroed memory, such as a shared memory segment
+void px_breaker_init(px_breaker *breaker, const px_breaker_options *options);
+// read before every request, false when breaker is NULL
+bool px_breaker_is_open(px_breaker *breaker);
+// read before a request calls the endpoint, false when the breaker is open or its ramp turns the request away. true
+// when breaker is NULL.
+bool px_breaker_admit(px_breaker *breaker);
+// counts a finished request, transport errors and timeouts are errors. no-op when breaker is NULL.
+void px_breaker_record(px_breaker *breaker, CURLcode status, double request_rtt);
+
+// monitor side: tick checks the window, opens or closes the breaker and moves the ramp, probe_due is true once an open breaker
+// should be probed and probe_done moves it to half open or backs off
+void px_breaker_tick(px_breaker *breaker, apr_time_t now);
+bool px_breaker_probe_due(const px_breaker *breaker, apr_time_t now);
+void px_breaker_probe_done(px_breaker *breaker, bool healthy, apr_time_t now);
+
+// takes or renews the lease for id until now + length, false while another id holds it
+bool px_breaker_lease_take(px_breaker_lease *lease, apr_uint32_t id, apr_time_t now, apr_interval_time_t length);
+// lets another process take the lease at once, no-op unless id holds it
+void px_breaker_lease_release(px_breaker_lease *lease, apr_uint32_t id);
+apr_uint32_t px_breaker_lease_holder(px_breaker_lease *lease, apr_time_t now);
+
+#endif /* PX_BREAKER_H */
@@ -0,0 +1,244 @@
+#include "px_cache.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <apr_atomic.h>
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+// max number of independently locked shards in a cache
+static const int MAX_CACHE_SHARDS = 16;
+// min number of entries in a single shard
+static const int MIN_SHARD_CAPACITY = 64;
+
+struct px_cache_entry_t {
+    unsigned char key[PX_CACHE_KEY_LEN];
+    apr_time_t expires;
+    px_cache_entry *hash_next;
+    px_cache_entry *lru_prev;
+    px_cache_entry *lru_next;
+    unsigned char *value;
+};
+
+struct px_cache_shard_t {
+    apr_thread_mutex_t *mutex;
+    int capacity;
+    int size;
+    unsigned int nbuckets;
+    px_cache_entry **buckets;
+    px_cache_entry *entries;
+    // most recently used entry is at the head
+    px_cache_entry *lru_head;
+    px_cache_entry *lru_tail;
+    px_cache_entry *free_list;
+};
+
+static apr_uint32_t key_hash(const unsigned char *key) {
+    return (apr_uint32_t)key[0] | (apr_uint32_t)key[1] << 8 | (apr_uint32_t)key[2] << 16 | (apr_uint32_t)key[3] << 24;
+}
+
+static px_cache_shard *key_shard(px_cache *cache, const unsigned char *key) {
+    return &cache->shards[key[4] % cache->nshards];
+}
+
+static void lru_unlink(px_cache_shard *shard, px_cache_entry *e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        shard->lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        shard->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_head(px_cache_shard *shard, px_cache_entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = e;
+    }
+    shard->lru_head = e;
+    if (!shard->lru_tail) {
+        shard->lru_tail = e;
+    }
+}
+
+static px_cache_entry **bucket_find(px_cache_shard *shard, const unsigned char *key) {
+    px_cache_entry **pe = &shard->buckets[key_hash(key) & (shard->nbuckets - 1)];
+    while (*pe && memcmp((*pe)->key, key, PX_CACHE_KEY_LEN) != 0) {
+        pe = &(*pe)->hash_next;
+    }
+    return pe;
+}
+
+// unlinks an entry from both the hash chain and the lru list and returns it to the free list
+static void entry_release(px_cache_shard *shard, px_cache_entry *e) {
+    px_cache_entry **pe = bucket_find(shard, e->key);
+    if (*pe == e) {
+        *pe = e->hash_next;
+    }
+    lru_unlink(shard, e);
+    e->hash_next = shard->free_list;
+    shard->free_list = e;
+    shard->size -= 1;
+}
+
+px_cache *px_cache_create(apr_pool_t *p, int capacity, apr_size_t value_size) {
+    if (capacity < 1) {
+        return NULL;
+    }
+    px_cache *cache = (px_cache*)apr_pcalloc(p, sizeof(px_cache));
+    cache->capacity = capacity;
+    cache->value_size = value_size;
+    cache->nshards = capacity / MIN_SHARD_CAPACITY;
+    if (cache->nshards < 1) {
+        cache->nshards = 1;
+    } else if (cache->nshards > MAX_CACHE_SHARDS) {
+        cache->nshards = MAX_CACHE_SHARDS;
+    }
+    cache->shards = (px_cache_shard*)apr_pcalloc(p, sizeof(px_cache_shard) * cache->nshards);
+
+    for (int i = 0; i < cache->nshards; ++i) {
+        px_cache_shard *shard = &cache->shards[i];
+        if (apr_thread_mutex_create(&shard->mutex, APR_THREAD_MUTEX_DEFAULT, p) != APR_SUCCESS) {
+            return NULL;
+        }
+        // spread the remainder over the first shards so the total matches capacity
+        shard->capacity = capacity / cache->nshards + (i < capacity % cache->nshards ? 1 : 0);
+        shard->nbuckets = 1;
+        while (shard->nbuckets < (unsigned int)shard->capacity) {
+            shard->nbuckets <<= 1;
+        }
+        shard->buckets = (px_cache_entry**)apr_pcalloc(p, sizeof(px_cache_entry*) * shard->nbuckets);
+        shard->entries = (px_cache_entry*)apr_pcalloc(p, sizeof(px_cache_entry) * shard->capacity);
+        unsigned char *values = (unsigned char*)apr_pcalloc(p, value_size * shard->capacity);
+        for (int j = shard->capacity - 1; j >= 0; --j) {
+            px_cache_entry *e = &shard->entries[j];
+            e->value = values + value_size * j;
+            e->hash_next = shard->free_list;
+            shard->free_list = e;
+        }
+    }
+    return cache;
+}
+
+bool px_cache_get(px_cache *cache, const unsigned char *key, void *value) {
+    if (!cache) {
+        return false;
+    }
+    bool found = false;
+    px_cache_shard *shard = key_shard(cache, key);
+    apr_thread_mutex_lock(shard->mutex);
+    px_cache_entry *e = *bucket_find(shard, key);
+    if (e) {
+        if (e->expires && e->expires <= apr_time_now()) {
+            entry_release(shard, e);
+            apr_atomic_inc32(&cache->expired);
+        } else {
+            memcpy(value, e->value, cache->value_size);
+            lru_unlink(shard, e);
+            lru_push_head(shard, e);
+            found = true;
+        }
+    }
+    apr_thread_mutex_unlock(shard->mutex);
+    apr_atomic_inc32(found ? &cache->hits : &cache->misses);
+    return found;
+}
+
+void px_cache_set(px_cache *cache, const unsigned char *key, const void *value, apr_time_t expires) {
+    if (!cache) {
+        return;
+    }
+    px_cache_shard *shard = key_shard(cache, key);
+    apr_thread_mutex_lock(shard->mutex);
+    px_cache_entry **pe = bucket_find(shard, key);
+    px_cache_entry *e = *pe;
+    if (e) {
+        // entry already exists (another thread raced us), refresh it
+        lru_unlink(shard, e);
+    } else {
+        if (!shard->free_list) {
+            // evict the least recently used entry
+            entry_release(shard, shard->lru_tail);
+            apr_atomic_inc32(&cache->evictions);
+            pe = bucket_find(shard, key);
+        }
+        e = shard->free_list;
+        shard->free_list = e->hash_next;
+        memcpy(e->key, key, PX_CACHE_KEY_LEN);
+        e->hash_next = NULL;
+        *pe = e;
+        shard->size += 1;
+        apr_atomic_inc32(&cache->inserts);
+    }
+    memcpy(e->value, value, cache->value_size);
+    e->expires = expires;
+    lru_push_head(shard, e);
+    apr_thread_mutex_unlock(shard->mutex);
+}
+
+void px_cache_remove(px_cache *cache, const unsigned char *key) {
+    if (!cache) {
+        return;
+    }
+    px_cache_shard *shard = key_shard(cache, key);
+    apr_thread_mutex_lock(shard->mutex);
+    px_cache_entry *e = *bucket_find(shard, key);
+    if (e) {
+        entry_release(shard, e);
+    }
+    apr_thread_mutex_unlock(shard->mutex);
+}
+
+void px_cache_get_stats(px_cache *cache, px_cache_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!cache) {
+        return;
+    }
+    stats->capacity = cache->capacity;
+    for (int i = 0; i < cache->nshards; ++i) {
+        apr_thread_mutex_lock(cache->shards[i].mutex);
+        stats->size += cache->shards[i].size;
+        apr_thread_mutex_unlock(cache->shards[i].mutex);
+    }
+    stats->hits = apr_atomic_read32(&cache->hits);
+    stats->misses = apr_atomic_read32(&cache->misses);
+    stats->inserts = apr_atomic_read32(&cache->inserts);
+    stats->evictions = apr_atomic_read32(&cache->evictions);
+    stats->expired = apr_atomic_read32(&cache->expired);
+}
+
+int px_cache_key(unsigned char *key, ...) {
+    int ret = 0;
+    unsigned int key_len = PX_CACHE_KEY_LEN;
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || !EVP_DigestInit_ex(md, EVP_sha256(), NULL)) {
+        goto out;
+    }
+    va_list ap;
+    va_start(ap, key);
+    const void *data;
+    while ((data = va_arg(ap, const void*)) != NULL) {
+        apr_uint32_t len = (apr_uint32_t)va_arg(ap, apr_size_t);
+        // length prefix each field so ("ab", "c") and ("a", "bc") do not collide
+        if (!EVP_DigestUpdate(md, &len, sizeof(len)) || !EVP_DigestUpdate(md, data, len)) {
+            va_end(ap);
+            goto out;
+        }
+    }
+    va_end(ap);
+    ret = EVP_DigestFinal_ex(md, key, &key_len);
+out:
+    EVP_MD_CTX_free(md);
+    return ret;
+}
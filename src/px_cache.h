@@ -0,0 +1,46 @@
+#ifndef PX_CACHE_H
+#define PX_CACHE_H
+
+#include <stdbool.h>
+
+#include <apr_pools.h>
+#include <apr_time.h>
+#include <apr_thread_mutex.h>
+
+// cache keys are fixed size fingerprints (sha256) of the cached data
+#define PX_CACHE_KEY_LEN 32
+
+typedef struct px_cache_entry_t px_cache_entry;
+typedef struct px_cache_shard_t px_cache_shard;
+
+typedef struct px_cache_t {
+    int capacity;
+    apr_size_t value_size;
+    int nshards;
+    px_cache_shard *shards;
+    volatile apr_uint32_t hits;
+    volatile apr_uint32_t misses;
+    volatile apr_uint32_t inserts;
+    volatile apr_uint32_t evictions;
+    volatile apr_uint32_t expired;
+} px_cache;
+
+typedef struct px_cache_stats_t {
+    int capacity;
+    int size;
+    apr_uint32_t hits;
+    apr_uint32_t misses;
+    apr_uint32_t inserts;
+    apr_uint32_t evictions;
+    apr_uint32_t expired;
+} px_cache_stats;
+
+px_cache *px_cache_create(apr_pool_t *p, int capacity, apr_size_t value_size);
+bool px_cache_get(px_cache *cache, const unsigned char *key, void *value);
+void px_cache_set(px_cache *cache, const unsigned char *key, const void *value, apr_time_t expires);
+void px_cache_remove(px_cache *cache, const unsigned char *key);
+void px_cache_get_stats(px_cache *cache, px_cache_stats *stats);
+// computes a cache key out of (data, len) pairs, list must be terminated with NULL
+int px_cache_key(unsigned char *key, ...);
+
+#endif /* PX_CACHE_H */
@@ -1,6 +1,7 @@
 #include "px_client.h"
 #include <http_log.h>
 #include <apr_strings.h>
+#include <apr_atomic.h>
 #include <util_cookies.h>
 
 #include "curl_pool.h"
@@ -11,6 +12,14 @@
 APLOG_USE_MODULE(perimeterx);
 #endif
 
+// response times in the window needed before their percentiles are trusted
+#define RTT_MIN_SAMPLES 100
+#define RTT_WINDOW apr_time_from_sec(60)
+// budget tokens of one hedge, requests earn hedge_budget of them each
+#define HEDGE_COST 100
+// hedges that can be saved up while requests are fast
+#define HEDGE_BURST 10
+
 static const char *VID_OPT1 = "_pxvid";
 static const char *VID_OPT2 = "pxvid";
 static const char *CLIENT_URI = "/%s/main.min.js";
@@ -36,30 +45,306 @@ static const redirect_response DEFAULT_GIF_RESPONSE = {
     .response_content_type = "image/gif",
 };
 
-CURLcode post_request(const char *url, const char *payload, long timeout, px_config *conf, const request_context *ctx, char **response_data, double *request_rtt) {
-    CURL *curl = curl_pool_get_wait(conf->curl_pool);
+static void endpoint_handle_init(CURL *curl, void *data) {
+    px_endpoint *endpoint = (px_endpoint*)data;
+    px_share_attach(endpoint->config->share, curl);
+    post_request_init(curl, endpoint->url, endpoint->headers, endpoint->config);
+}
+
+static apr_status_t endpoint_cleanup(void *data) {
+    px_endpoint *endpoint = (px_endpoint*)data;
+    curl_slist_free_all(endpoint->headers);
+    return APR_SUCCESS;
+}
+
+px_endpoint *px_endpoint_create(apr_pool_t *p, const char *url, px_config *conf, int min_size, int max_size) {
+    px_endpoint *endpoint = (px_endpoint*)apr_pcalloc(p, sizeof(px_endpoint));
+    endpoint->url = url;
+    endpoint->config = conf;
+    endpoint->headers = post_request_headers(conf);
+    endpoint->rtt = px_rtt_create(p);
+    // registered before the pool, so the handles are gone when the headers are released
+    apr_pool_cleanup_register(p, endpoint, endpoint_cleanup, apr_pool_cleanup_null);
+    endpoint->pool = curl_pool_create(p, min_size, max_size, conf->curl_pool_idle_timeout, false, endpoint_handle_init, endpoint);
+    return endpoint;
+}
+
+static void response_hold(post_response *response, CURLcode status, CURL *curl, curl_pool *pool) {
+    response->curl = curl;
+    response->pool = pool;
+    if (status != CURLE_OK) {
+        post_response_release(response);
+    }
+}
+
+px_rolling_histogram *px_rtt_create(apr_pool_t *p) {
+    return px_rolling_histogram_create(p, RTT_WINDOW);
+}
+
+void px_rtt_add(px_rolling_histogram *rtt, CURLcode status, double request_rtt, long timeout) {
+    if (status == CURLE_OK) {
+        px_rolling_histogram_add(rtt, (apr_uint64_t)(request_rtt * APR_USEC_PER_SEC));
+    } else if (status == CURLE_OPERATION_TIMEDOUT) {
+        // otherwise the responses cut off by a short timeout would never let it grow
+        px_rolling_histogram_add(rtt, apr_time_from_msec(timeout));
+    }
+}
+
+void px_endpoint_record(px_endpoint *endpoint, CURLcode status, double request_rtt, long timeout) {
+    px_rtt_add(endpoint->rtt, status, request_rtt, timeout);
+    px_breaker_record(endpoint->breaker, status, request_rtt);
+}
+
+long px_adaptive_timeout(const px_config *conf, px_rolling_histogram *rtt, long timeout) {
+    if (!conf->adaptive_timeout_multiplier || px_rolling_histogram_count(rtt) < RTT_MIN_SAMPLES) {
+        return timeout;
+    }
+    long max = conf->adaptive_timeout_max_ms > 0 ? conf->adaptive_timeout_max_ms : timeout;
+    long adaptive = (long)apr_time_as_msec(px_rolling_histogram_percentile(rtt, 99)) * conf->adaptive_timeout_multiplier;
+    if (adaptive < conf->adaptive_timeout_min_ms) {
+        adaptive = conf->adaptive_timeout_min_ms;
+    }
+    return adaptive < max ? adaptive : max;
+}
+
+// 0 when hedging is off or there are not enough samples yet
+static long hedge_delay(px_endpoint *endpoint, long timeout) {
+    if (!endpoint->hedge_percentile || !endpoint->config->io || px_rolling_histogram_count(endpoint->rtt) < RTT_MIN_SAMPLES) {
+        return 0;
+    }
+    long delay = (long)apr_time_as_msec(px_rolling_histogram_percentile(endpoint->rtt, endpoint->hedge_percentile));
+    if (delay < 1) {
+        delay = 1;
+    }
+    // a hedge sent at the timeout could not answer in time
+    return delay < timeout ? delay : 0;
+}
+
+static void hedge_budget_earn(px_endpoint *endpoint) {
+    apr_uint32_t tokens = apr_atomic_read32(&endpoint->hedge_tokens);
+    for (;;) {
+        apr_uint32_t earned = tokens + endpoint->hedge_budget;
+        if (earned > HEDGE_COST * HEDGE_BURST) {
+            earned = HEDGE_COST * HEDGE_BURST;
+        }
+        apr_uint32_t prev = apr_atomic_cas32(&endpoint->hedge_tokens, earned, tokens);
+        if (prev == tokens) {
+            return;
+        }
+        tokens = prev;
+    }
+}
+
+static bool hedge_budget_take(px_endpoint *endpoint) {
+    apr_uint32_t tokens = apr_atomic_read32(&endpoint->hedge_tokens);
+    while (tokens >= HEDGE_COST) {
+        apr_uint32_t prev = apr_atomic_cas32(&endpoint->hedge_tokens, tokens - HEDGE_COST, tokens);
+        if (prev == tokens) {
+            return true;
+        }
+        tokens = prev;
+    }
+    return false;
+}
+
+// the second copy of a slow post request
+typedef struct hedge_t {
+    px_endpoint *endpoint;
+    const char *payload;
+    long timeout;
+    server_rec *server;
+    post_request_state state;
+    CURL *curl;
+} hedge;
+
+static CURL *hedge_start(void *baton) {
+    hedge *h = (hedge*)baton;
+    if (!hedge_budget_take(h->endpoint)) {
+        return NULL;
+    }
+    CURL *curl = curl_pool_get(h->endpoint->pool);
+    if (curl == NULL) {
+        return NULL;
+    }
+    post_request_start(&h->state, curl, h->payload, h->timeout, h->server);
+    // the connection of the first request may be the slow part
+    curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+    h->curl = curl;
+    apr_atomic_inc32(&h->endpoint->hedges_fired);
+    return curl;
+}
+
+// post_request_helper that sends the request again once it is slower than the hedge percentile, curl is replaced by
+// the handle of the winning request
+static CURLcode post_request_hedged(px_endpoint *endpoint, CURL **curl, const char *payload, long timeout, long delay, px_config *conf, server_rec *server, const char **response_data, double *request_rtt) {
+    post_request_state state;
+    hedge h;
+    memset(&h, 0, sizeof(h));
+    h.endpoint = endpoint;
+    h.payload = payload;
+    h.timeout = timeout;
+    h.server = server;
+    post_request_start(&state, *curl, payload, timeout, server);
+    CURL *winner;
+    CURLcode status = px_io_perform_hedged(conf->io, *curl, timeout, delay, hedge_start, &h, &winner);
+    if (h.curl) {
+        curl_easy_setopt(h.curl, CURLOPT_FRESH_CONNECT, 0L);
+    }
+    if (winner != h.curl) {
+        if (h.curl) {
+            curl_pool_put(endpoint->pool, h.curl);
+        }
+        status = post_request_end(&state, *curl, status, conf, response_data);
+        if (CURLE_OK != curl_easy_getinfo(*curl, CURLINFO_TOTAL_TIME, request_rtt)) {
+            *request_rtt = 0;
+        }
+        return status;
+    }
+
+    apr_atomic_inc32(&endpoint->hedges_won);
+    curl_pool_put(endpoint->pool, *curl);
+    *curl = h.curl;
+    status = post_request_end(&h.state, h.curl, status, conf, response_data);
+    // the caller waited for the delay as well
+    if (CURLE_OK != curl_easy_getinfo(h.curl, CURLINFO_TOTAL_TIME, request_rtt)) {
+        *request_rtt = 0;
+    }
+    *request_rtt += delay / 1000.0;
+    return status;
+}
+
+void post_response_release(post_response *response) {
+    if (response->curl) {
+        curl_pool_put(response->pool, response->curl);
+        response->curl = NULL;
+        response->data = NULL;
+    }
+}
+
+CURLcode post_request(px_endpoint *endpoint, const char *payload, long timeout, px_config *conf, const request_context *ctx, post_response *response, double *request_rtt) {
+    if (response) {
+        memset(response, 0, sizeof(*response));
+    }
+    if (px_breaker_is_open(endpoint->breaker)) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, "[%s]: post_req_request: circuit breaker is open", ctx->app_id);
+        return CURLE_COULDNT_CONNECT;
+    }
+    CURL *curl = curl_pool_get_wait(endpoint->pool);
     if (curl == NULL) {
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, ctx->r->server, "[%s]: post_req_request: could not obtain curl handle", ctx->app_id);
         return CURLE_FAILED_INIT;
     }
-    CURLcode status = post_request_helper(curl, url, payload, timeout, conf, ctx->r->server, response_data);
-    if (request_rtt && (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, request_rtt))) {
-        *request_rtt = 0;
+    timeout = px_adaptive_timeout(conf, endpoint->rtt, timeout);
+    CURLcode status;
+    double rtt = 0;
+    long delay = hedge_delay(endpoint, timeout);
+    if (endpoint->hedge_percentile) {
+        hedge_budget_earn(endpoint);
+    }
+    if (delay > 0) {
+        status = post_request_hedged(endpoint, &curl, payload, timeout, delay, conf, ctx->r->server, response ? &response->data : NULL, &rtt);
+    } else {
+        status = post_request_helper(curl, payload, timeout, conf, ctx->r->server, response ? &response->data : NULL);
+        if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &rtt)) {
+            rtt = 0;
+        }
+    }
+    px_endpoint_record(endpoint, status, rtt, timeout);
+    if (request_rtt) {
+        *request_rtt = rtt;
+    }
+    // the body stays in the handle until the caller is done with it
+    if (response) {
+        response_hold(response, status, curl, endpoint->pool);
+    } else {
+        curl_pool_put(endpoint->pool, curl);
     }
-    curl_pool_put(conf->curl_pool, curl);
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, "[%s]: post_req_request: post request payload  %s", ctx->app_id, payload);
     return status;
 }
 
+struct post_request_async_t {
+    post_request_state state;
+    post_response response;
+    CURL *curl;
+    px_endpoint *endpoint;
+    px_config *conf;
+    apr_pool_t *pool;
+    long timeout;
+    post_request_cb cb;
+    void *baton;
+};
+
+static void post_request_done(CURLcode status, void *baton) {
+    post_request_async *post = (post_request_async*)baton;
+    double request_rtt;
+    status = post_request_end(&post->state, post->curl, status, post->conf, &post->response.data);
+    if (CURLE_OK != curl_easy_getinfo(post->curl, CURLINFO_TOTAL_TIME, &request_rtt)) {
+        request_rtt = 0;
+    }
+    px_endpoint_record(post->endpoint, status, request_rtt, post->timeout);
+    response_hold(&post->response, status, post->curl, post->endpoint->pool);
+    post->cb(status, &post->response, request_rtt, post->baton);
+}
+
+// a request that ends without reading the response still returns the handle
+static apr_status_t post_request_cleanup(void *data) {
+    post_response_release(&((post_request_async*)data)->response);
+    return APR_SUCCESS;
+}
+
+post_request_async *post_request_prepare(px_endpoint *endpoint, const char *payload, long timeout, px_config *conf, const request_context *ctx, post_request_cb cb, void *baton) {
+    if (!conf->io || px_breaker_is_open(endpoint->breaker)) {
+        return NULL;
+    }
+    // waiting for a handle would hold the thread the caller wants to free
+    CURL *curl = curl_pool_get(endpoint->pool);
+    if (curl == NULL) {
+        return NULL;
+    }
+    post_request_async *post = (post_request_async*)apr_pcalloc(ctx->r->pool, sizeof(post_request_async));
+    post->curl = curl;
+    post->endpoint = endpoint;
+    post->conf = conf;
+    post->pool = ctx->r->pool;
+    post->timeout = px_adaptive_timeout(conf, endpoint->rtt, timeout);
+    post->cb = cb;
+    post->baton = baton;
+    // the request is suspended until the transfer is done, so its pool cannot go away while the io thread has the handle
+    post->response.curl = curl;
+    post->response.pool = endpoint->pool;
+    apr_pool_cleanup_register(ctx->r->pool, post, post_request_cleanup, apr_pool_cleanup_null);
+    // curl does not copy the body and the caller frees it before the transfer runs
+    post_request_start(&post->state, curl, apr_pstrdup(ctx->r->pool, payload), post->timeout, ctx->r->server);
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, "[%s]: post_request_prepare: post request payload  %s", ctx->app_id, payload);
+    return post;
+}
+
+void post_request_submit(post_request_async *post) {
+    px_io_submit(post->conf->io, post->pool, post->curl, post->timeout, post_request_done, post);
+}
+
 CURLcode forward_to_perimeterx(request_rec *r, px_config *conf, redirect_response *res, const char *base_url, const char *uri, const char *vid) {
+    if (px_breaker_is_open(conf->redirect_breaker)) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, "[%s]: forward_to_perimeterx: circuit breaker is open", conf->app_id);
+        return CURLE_COULDNT_CONNECT;
+    }
     CURL *curl = curl_pool_get_wait(conf->redirect_curl_pool);
     if (curl == NULL) {
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, r->server, "[%s]: forward_to_perimeterx: could not obtain curl handle", conf->app_id);
         return CURLE_FAILED_INIT;
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, "[%s]: forward_to_perimeterx: redirecting request", conf->app_id);
-    CURLcode status = redirect_helper(curl, base_url, uri, vid, conf, r, &res->content, &res->response_headers, &res->content_size);
+    long timeout = px_adaptive_timeout(conf, conf->redirect_rtt, conf->api_timeout_ms);
+    CURLcode status = redirect_helper(curl, base_url, uri, vid, timeout, conf, r, &res->content, &res->response_headers, &res->content_size);
+    double request_rtt;
+    if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &request_rtt)) {
+        request_rtt = 0;
+    }
+    px_rtt_add(conf->redirect_rtt, status, request_rtt, timeout);
+    px_breaker_record(conf->redirect_breaker, status, request_rtt);
      // Return curl to pool
     curl_pool_put(conf->redirect_curl_pool, curl);
     return status;
@@ -3,7 +3,40 @@
 
 #include "px_types.h"
 
-CURLcode post_request(const char *url, const char *payload, long timeout, px_config *conf, const request_context *ctx, char **response_data, double *request_rtt);
+// response times of about the last minute, they drive hedging and adaptive timeouts
+px_rolling_histogram *px_rtt_create(apr_pool_t *p);
+// successful requests add their response time and timed out ones their timeout, other failures are not counted
+void px_rtt_add(px_rolling_histogram *rtt, CURLcode status, double request_rtt, long timeout);
+// px_rtt_add to the rtt of endpoint, and the outcome to its circuit breaker
+void px_endpoint_record(px_endpoint *endpoint, CURLcode status, double request_rtt, long timeout);
+// timeout unless AdaptiveTimeoutMultiplier is set and rtt has enough samples, then the multiple of the p99 of rtt
+// clamped between AdaptiveTimeoutMinMS and AdaptiveTimeoutMaxMS, or timeout when no max is set
+long px_adaptive_timeout(const px_config *conf, px_rolling_histogram *rtt, long timeout);
+
+// a pool of handles set up for url, min_size of them are created upfront. requests fail at once with
+// CURLE_COULDNT_CONNECT while the circuit breaker of the endpoint is open.
+px_endpoint *px_endpoint_create(apr_pool_t *p, const char *url, px_config *conf, int min_size, int max_size);
+
+// a successful response, data points into the buffer of the handle, which is kept until post_response_release
+typedef struct post_response_t {
+    const char *data;
+    CURL *curl;
+    curl_pool *pool;
+} post_response;
+// timeout is adapted with px_adaptive_timeout. response may be NULL when the body is not needed, otherwise it has to be
+// released
+CURLcode post_request(px_endpoint *endpoint, const char *payload, long timeout, px_config *conf, const request_context *ctx, post_response *response, double *request_rtt);
+// returns the handle to its pool, safe to call more than once
+void post_response_release(post_response *response);
+
+typedef struct post_request_async_t post_request_async;
+// gets the response of a post_request_async on the io thread, response->data is NULL on failure. the response is
+// released with the request pool at the latest.
+typedef void (*post_request_cb)(CURLcode status, post_response *response, double request_rtt, void *baton);
+// a post request run by the io threads, returns NULL when there are no io threads or no idle curl handle
+post_request_async *post_request_prepare(px_endpoint *endpoint, const char *payload, long timeout, px_config *conf, const request_context *ctx, post_request_cb cb, void *baton);
+void post_request_submit(post_request_async *post);
+
 const redirect_response *redirect_client(request_rec *r, px_config *conf);
 const redirect_response *redirect_xhr(request_rec *r, px_config *conf);
 
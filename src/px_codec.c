@@ -0,0 +1,258 @@
+#include "px_codec.h"
+
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PX_CODEC_SIMD
+#include <immintrin.h>
+#endif
+
+static const char ENCODE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0xff marks characters outside of the alphabet
+static const unsigned char DECODE[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// simd kernels process whole blocks and return the number of input bytes consumed, the scalar code finishes the rest.
+// decode kernels stop at the first block with an invalid character and leave the error to the scalar code.
+typedef size_t (*codec_kernel)(const unsigned char *in, size_t len, unsigned char *out);
+static codec_kernel decode_kernel = NULL;
+static codec_kernel encode_kernel = NULL;
+
+#ifdef PX_CODEC_SIMD
+
+#define SSE_TARGET __attribute__((target("sse4.1,ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// translates 16 base64 characters into 6 bit values, returns false if any of them is not in the alphabet.
+// the nibble lookup tables classify each character so a single test catches every invalid one.
+static inline __attribute__((always_inline)) SSE_TARGET
+bool sse_translate(__m128i *str) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(*str, 4), mask_2f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(*str, mask_2f));
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm_testz_si128(lo, hi)) {
+        return false;
+    }
+    __m128i eq_2f = _mm_cmpeq_epi8(*str, mask_2f);
+    *str = _mm_add_epi8(*str, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+    return true;
+}
+
+static SSE_TARGET size_t decode_sse(const unsigned char *in, size_t len, unsigned char *out) {
+    size_t i = 0;
+    // every store writes 16 bytes for 12 decoded ones, keep enough input left so it stays inside the output
+    for (; i + 24 <= len; i += 16) {
+        __m128i str = _mm_loadu_si128((const __m128i*)(in + i));
+        if (!sse_translate(&str)) {
+            break;
+        }
+        __m128i merged = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        packed = _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128((__m128i*)(out + i / 4 * 3), packed);
+    }
+    return i;
+}
+
+static AVX2_TARGET size_t decode_avx2(const unsigned char *in, size_t len, unsigned char *out) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i pack_shuffle = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t i = 0;
+    // every store writes 32 bytes for 24 decoded ones
+    for (; i + 48 <= len; i += 32) {
+        __m256i str = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(str, mask_2f));
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+
+        __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        packed = _mm256_shuffle_epi8(packed, pack_shuffle);
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+        _mm256_storeu_si256((__m256i*)(out + i / 4 * 3), packed);
+    }
+    // finish with 16 byte blocks
+    return i + decode_sse(in + i, len - i, out + i / 4 * 3);
+}
+
+static SSE_TARGET size_t encode_sse(const unsigned char *in, size_t len, unsigned char *out) {
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    // every load reads 16 bytes for 12 encoded ones
+    for (; i + 16 <= len; i += 12) {
+        __m128i str = _mm_loadu_si128((const __m128i*)(in + i));
+        // split every 3 bytes into 4 six bit indices, one per output byte
+        str = _mm_shuffle_epi8(str, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(str, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(str, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(t0, t1);
+
+        // map the index ranges A-Z, a-z, 0-9, + and / to the offset added to the index
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, range), indices);
+        _mm_storeu_si128((__m128i*)(out + i / 3 * 4), chars);
+    }
+    return i;
+}
+
+#endif /* PX_CODEC_SIMD */
+
+void px_codec_init(void) {
+#ifdef PX_CODEC_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1")) {
+        decode_kernel = decode_sse;
+        encode_kernel = encode_sse;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        decode_kernel = decode_avx2;
+    }
+#endif
+}
+
+size_t px_base64_decode_len(size_t len) {
+    return (len + 3) / 4 * 3;
+}
+
+long px_base64_decode(const char *in, size_t len, unsigned char *out) {
+    const unsigned char *s = (const unsigned char*)in;
+    // up to two padding characters, only allowed on a whole number of quantums
+    if (len > 0 && s[len - 1] == '=') {
+        if (len % 4 != 0) {
+            return -1;
+        }
+        len -= (len > 1 && s[len - 2] == '=') ? 2 : 1;
+    }
+    if (len % 4 == 1) {
+        return -1;
+    }
+
+    size_t i = decode_kernel ? decode_kernel(s, len, out) : 0;
+    unsigned char *o = out + i / 4 * 3;
+    unsigned char err = 0;
+    for (; i + 4 <= len; i += 4) {
+        unsigned char a = DECODE[s[i]], b = DECODE[s[i + 1]], c = DECODE[s[i + 2]], d = DECODE[s[i + 3]];
+        err |= a | b | c | d;
+        *o++ = a << 2 | b >> 4;
+        *o++ = b << 4 | c >> 2;
+        *o++ = c << 6 | d;
+    }
+    if (len - i >= 2) {
+        unsigned char a = DECODE[s[i]], b = DECODE[s[i + 1]];
+        err |= a | b;
+        *o++ = a << 2 | b >> 4;
+        if (len - i == 3) {
+            unsigned char c = DECODE[s[i + 2]];
+            err |= c;
+            *o++ = b << 4 | c >> 2;
+        }
+    }
+    // valid values are 6 bits, an invalid character sets the high bit
+    if (err & 0x80) {
+        return -1;
+    }
+    return o - out;
+}
+
+size_t px_base64_encode_len(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+size_t px_base64_encode(const unsigned char *in, size_t len, char *out) {
+    size_t i = encode_kernel ? encode_kernel(in, len, (unsigned char*)out) : 0;
+    char *o = out + i / 3 * 4;
+    for (; i + 3 <= len; i += 3) {
+        *o++ = ENCODE[in[i] >> 2];
+        *o++ = ENCODE[(in[i] & 0x03) << 4 | in[i + 1] >> 4];
+        *o++ = ENCODE[(in[i + 1] & 0x0f) << 2 | in[i + 2] >> 6];
+        *o++ = ENCODE[in[i + 2] & 0x3f];
+    }
+    if (len - i > 0) {
+        *o++ = ENCODE[in[i] >> 2];
+        if (len - i == 1) {
+            *o++ = ENCODE[(in[i] & 0x03) << 4];
+            *o++ = '=';
+        } else {
+            *o++ = ENCODE[(in[i] & 0x03) << 4 | in[i + 1] >> 4];
+            *o++ = ENCODE[(in[i + 1] & 0x0f) << 2];
+        }
+        *o++ = '=';
+    }
+    *o = '\0';
+    return o - out;
+}
+
+// nibble to lowercase hex without branches, values above 9 are moved from ':' to 'a'
+static inline char hex_digit(unsigned int n) {
+    return (char)(n + '0' + (((9 - (int)n) >> 8) & ('a' - '0' - 10)));
+}
+
+void px_hex_encode(const unsigned char *in, size_t len, char *out) {
+    for (size_t i = 0; i < len; ++i) {
+        out[2 * i] = hex_digit(in[i] >> 4);
+        out[2 * i + 1] = hex_digit(in[i] & 0x0f);
+    }
+}
+
+// hex character to its value without branches, returns -1 for characters that are not hex digits
+static inline int hex_value(unsigned char c) {
+    int digit = c - '0';
+    int letter = (c | 0x20) - 'a';
+    // all ones when the value is in range
+    int digit_mask = ~((digit | (9 - digit)) >> 31);
+    int letter_mask = ~((letter | (5 - letter)) >> 31);
+    return (digit & digit_mask) | ((letter + 10) & letter_mask) | ~(digit_mask | letter_mask);
+}
+
+bool px_hex_decode(const char *in, size_t len, unsigned char *out) {
+    int err = 0;
+    for (size_t i = 0; i < len; ++i) {
+        int hi = hex_value(in[2 * i]);
+        int lo = hex_value(in[2 * i + 1]);
+        err |= hi | lo;
+        out[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return err >= 0;
+}
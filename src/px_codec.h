@@ -0,0 +1,24 @@
+#ifndef PX_CODEC_H
+#define PX_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// selects the simd kernels supported by the cpu, must be called before any thread uses the codecs
+void px_codec_init(void);
+
+// max number of bytes decoded from len base64 characters
+size_t px_base64_decode_len(size_t len);
+// decodes standard base64, padding is optional. returns the decoded length or -1 if the input is not valid base64
+long px_base64_decode(const char *in, size_t len, unsigned char *out);
+// number of characters needed to encode len bytes, not including the terminating nul
+size_t px_base64_encode_len(size_t len);
+// encodes with padding and nul terminates out, returns the encoded length
+size_t px_base64_encode(const unsigned char *in, size_t len, char *out);
+
+// encodes len bytes as 2 * len lowercase hex characters, out is not nul terminated
+void px_hex_encode(const unsigned char *in, size_t len, char *out);
+// decodes 2 * len hex characters into len bytes, returns false if in is not valid hex
+bool px_hex_decode(const char *in, size_t len, unsigned char *out);
+
+#endif /* PX_CODEC_H */
@@ -0,0 +1,145 @@
+#include "px_cookie_json.h"
+#include "px_json_scan.h"
+
+#include <string.h>
+
+// max number of strings and numbers terminated in scratch
+#define MAX_TOKENS 8
+
+enum {
+    FIELD_VID = 1 << 0,
+    FIELD_UUID = 1 << 1,
+    FIELD_SCORE = 1 << 2,
+    FIELD_TS = 1 << 3,
+    FIELD_ACTION = 1 << 4,
+    FIELD_HASH = 1 << 5,
+    FIELD_A = 1 << 6,
+    FIELD_B = 1 << 7,
+};
+
+static const unsigned int FIELDS_V1 = FIELD_VID | FIELD_UUID | FIELD_SCORE | FIELD_TS | FIELD_HASH | FIELD_A | FIELD_B;
+static const unsigned int FIELDS_V3 = FIELD_VID | FIELD_UUID | FIELD_SCORE | FIELD_TS | FIELD_ACTION;
+
+typedef struct cookie_parser_t {
+    risk_payload *payload;
+    // positions that are set to nul once the whole object parsed
+    char *ends[MAX_TOKENS];
+    int nends;
+} cookie_parser;
+
+static bool add_end(cookie_parser *cp, char *end) {
+    if (cp->nends == MAX_TOKENS) {
+        return false;
+    }
+    cp->ends[cp->nends++] = end;
+    return true;
+}
+
+static const char *parse_string(px_json_scan *scan, cookie_parser *cp) {
+    const char *start = px_json_scan_plain_string(scan, NULL);
+    if (!start || !add_end(cp, scan->p - 1)) {
+        return NULL;
+    }
+    return start;
+}
+
+static const char *parse_integer(px_json_scan *scan, cookie_parser *cp, long long *value) {
+    const char *start = px_json_scan_integer(scan, value);
+    if (!start || !add_end(cp, scan->p)) {
+        return NULL;
+    }
+    return start;
+}
+
+static const char *parse_int(px_json_scan *scan, cookie_parser *cp, int *value) {
+    const char *start = px_json_scan_int(scan, value);
+    if (!start || !add_end(cp, scan->p)) {
+        return NULL;
+    }
+    return start;
+}
+
+static bool member_score1(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    cookie_parser *cp = (cookie_parser*)out;
+    risk_payload *payload = cp->payload;
+    if (key_len != 1) {
+        return false;
+    }
+    switch (key[0]) {
+        case 'a':
+            return px_json_claim(scan, FIELD_A) && (payload->a = parse_int(scan, cp, &payload->a_val)) != NULL;
+        case 'b':
+            return px_json_claim(scan, FIELD_B) && (payload->b = parse_int(scan, cp, &payload->b_val)) != NULL;
+    }
+    return false;
+}
+
+static bool member1(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    cookie_parser *cp = (cookie_parser*)out;
+    risk_payload *payload = cp->payload;
+    if (key_len != 1) {
+        return false;
+    }
+    switch (key[0]) {
+        case 'v':
+            return px_json_claim(scan, FIELD_VID) && (payload->vid = parse_string(scan, cp)) != NULL;
+        case 'u':
+            return px_json_claim(scan, FIELD_UUID) && (payload->uuid = parse_string(scan, cp)) != NULL;
+        case 'h':
+            return px_json_claim(scan, FIELD_HASH) && (payload->hash = parse_string(scan, cp)) != NULL;
+        case 't':
+            return px_json_claim(scan, FIELD_TS) && (payload->timestamp = parse_integer(scan, cp, &payload->ts)) != NULL;
+        case 's':
+            return px_json_claim(scan, FIELD_SCORE) && px_json_scan_object(scan, member_score1, cp);
+    }
+    return false;
+}
+
+static bool member3(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    cookie_parser *cp = (cookie_parser*)out;
+    risk_payload *payload = cp->payload;
+    if (key_len != 1) {
+        return false;
+    }
+    switch (key[0]) {
+        case 'v':
+            return px_json_claim(scan, FIELD_VID) && (payload->vid = parse_string(scan, cp)) != NULL;
+        case 'u':
+            return px_json_claim(scan, FIELD_UUID) && (payload->uuid = parse_string(scan, cp)) != NULL;
+        case 'a':
+            return px_json_claim(scan, FIELD_ACTION) && (payload->action = parse_string(scan, cp)) != NULL;
+        case 't':
+            return px_json_claim(scan, FIELD_TS) && (payload->timestamp = parse_integer(scan, cp, &payload->ts)) != NULL;
+        case 's':
+            return px_json_claim(scan, FIELD_SCORE) && parse_int(scan, cp, &payload->score) != NULL;
+    }
+    return false;
+}
+
+bool px_cookie_json_parse(const char *raw, char *scratch, int version, risk_payload *payload) {
+    if (version != 1 && version != 3) {
+        return false;
+    }
+    memset(payload, 0, sizeof(*payload));
+    memcpy(scratch, raw, strlen(raw) + 1);
+
+    px_json_scan scan = { .p = scratch };
+    cookie_parser cp = { .payload = payload };
+    px_json_skip_ws(&scan);
+    if (!px_json_scan_object(&scan, version == 3 ? member3 : member1, &cp)) {
+        return false;
+    }
+    px_json_skip_ws(&scan);
+    if (*scan.p != '\0' || scan.seen != (version == 3 ? FIELDS_V3 : FIELDS_V1)) {
+        return false;
+    }
+
+    for (int i = 0; i < cp.nends; ++i) {
+        *cp.ends[i] = '\0';
+    }
+    if (version == 1) {
+        payload->score = payload->b_val;
+        payload->action = "c";
+    }
+    return true;
+}
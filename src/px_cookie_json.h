@@ -0,0 +1,13 @@
+#ifndef PX_COOKIE_JSON_H
+#define PX_COOKIE_JSON_H
+
+#include <stdbool.h>
+
+#include "px_types.h"
+
+// decodes the decrypted v1/v3 cookie json without allocating. raw is copied into scratch (strlen(raw) + 1 bytes) and
+// the payload strings point into scratch. only plain, well formed cookies are accepted, anything unusual (escapes,
+// unknown or duplicate keys, non integer numbers...) returns false and has to go through jansson.
+bool px_cookie_json_parse(const char *raw, char *scratch, int version, risk_payload *payload);
+
+#endif /* PX_COOKIE_JSON_H */
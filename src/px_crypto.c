@@ -0,0 +1,149 @@
+#include "px_crypto.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+static HMAC_CTX *HMAC_CTX_new(void)
+{
+   HMAC_CTX *ctx = OPENSSL_malloc(sizeof(*ctx));
+   if (ctx != NULL) {
+       HMAC_CTX_init(ctx);
+   }
+   return ctx;
+}
+
+static void HMAC_CTX_free(HMAC_CTX *ctx)
+{
+   if (ctx != NULL) {
+       HMAC_CTX_cleanup(ctx);
+       OPENSSL_free(ctx);
+   }
+}
+#endif
+
+static void thread_free(px_crypto_thread *tc) {
+    HMAC_CTX_free(tc->hmac_keyed);
+    HMAC_CTX_free(tc->hmac);
+    EVP_CIPHER_CTX_free(tc->cipher);
+}
+
+static apr_status_t px_crypto_cleanup(void *data) {
+    px_crypto *crypto = (px_crypto*)data;
+    px_crypto_thread *tc = crypto->threads;
+    while (tc) {
+        px_crypto_thread *next = tc->next;
+        thread_free(tc);
+        free(tc);
+        tc = next;
+    }
+    crypto->threads = NULL;
+    apr_threadkey_private_delete(crypto->thread_key);
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+    EVP_MD_free((EVP_MD*)crypto->sha256);
+    EVP_CIPHER_free((EVP_CIPHER*)crypto->aes_256_cbc);
+#endif
+    return APR_SUCCESS;
+}
+
+px_crypto *px_crypto_create(apr_pool_t *p, const char *payload_key) {
+    if (!payload_key) {
+        return NULL;
+    }
+    px_crypto *crypto = (px_crypto*)apr_pcalloc(p, sizeof(px_crypto));
+    crypto->payload_key = payload_key;
+    if (apr_thread_mutex_create(&crypto->mutex, APR_THREAD_MUTEX_DEFAULT, p) != APR_SUCCESS) {
+        return NULL;
+    }
+    if (apr_threadkey_private_create(&crypto->thread_key, NULL, p) != APR_SUCCESS) {
+        return NULL;
+    }
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+    // EVP_sha256() and friends do an implicit (locked) provider fetch on every use in openssl 3
+    crypto->sha256 = EVP_MD_fetch(NULL, "SHA256", NULL);
+    crypto->aes_256_cbc = EVP_CIPHER_fetch(NULL, "AES-256-CBC", NULL);
+#else
+    crypto->sha256 = EVP_sha256();
+    crypto->aes_256_cbc = EVP_aes_256_cbc();
+#endif
+    apr_pool_cleanup_register(p, crypto, px_crypto_cleanup, apr_pool_cleanup_null);
+    if (!crypto->sha256 || !crypto->aes_256_cbc) {
+        return NULL;
+    }
+    if (!px_pbkdf2_key_init(&crypto->pbkdf2_key, payload_key, strlen(payload_key), crypto->sha256)) {
+        return NULL;
+    }
+    return crypto;
+}
+
+px_crypto_thread *px_crypto_thread_get(px_crypto *crypto) {
+    if (!crypto) {
+        return NULL;
+    }
+    void *data = NULL;
+    if (apr_threadkey_private_get(&data, crypto->thread_key) == APR_SUCCESS && data) {
+        return (px_crypto_thread*)data;
+    }
+
+    px_crypto_thread *tc = (px_crypto_thread*)calloc(1, sizeof(px_crypto_thread));
+    if (!tc) {
+        return NULL;
+    }
+    tc->hmac_keyed = HMAC_CTX_new();
+    tc->hmac = HMAC_CTX_new();
+    tc->cipher = EVP_CIPHER_CTX_new();
+    if (!tc->hmac_keyed || !tc->hmac || !tc->cipher
+            || !HMAC_Init_ex(tc->hmac_keyed, crypto->payload_key, strlen(crypto->payload_key), crypto->sha256, NULL)
+            || apr_threadkey_private_set(tc, crypto->thread_key) != APR_SUCCESS) {
+        thread_free(tc);
+        free(tc);
+        return NULL;
+    }
+
+    apr_thread_mutex_lock(crypto->mutex);
+    tc->next = crypto->threads;
+    crypto->threads = tc;
+    apr_thread_mutex_unlock(crypto->mutex);
+    return tc;
+}
+
+const EVP_MD *px_crypto_sha256(px_crypto *crypto) {
+    return crypto ? crypto->sha256 : EVP_sha256();
+}
+
+const EVP_CIPHER *px_crypto_aes_256_cbc(px_crypto *crypto) {
+    return crypto ? crypto->aes_256_cbc : EVP_aes_256_cbc();
+}
+
+HMAC_CTX *px_crypto_hmac_begin(px_crypto *crypto, px_crypto_thread *tc, const char *key) {
+    if (tc) {
+        // the configured key is already set up, only the state has to be copied
+        if (strcmp(key, crypto->payload_key) == 0) {
+            return HMAC_CTX_copy(tc->hmac, tc->hmac_keyed) ? tc->hmac : NULL;
+        }
+        return HMAC_Init_ex(tc->hmac, key, strlen(key), crypto->sha256, NULL) ? tc->hmac : NULL;
+    }
+
+    HMAC_CTX *hmac = HMAC_CTX_new();
+    if (hmac && !HMAC_Init_ex(hmac, key, strlen(key), px_crypto_sha256(crypto), NULL)) {
+        HMAC_CTX_free(hmac);
+        return NULL;
+    }
+    return hmac;
+}
+
+void px_crypto_hmac_end(px_crypto_thread *tc, HMAC_CTX *hmac) {
+    if (!tc || hmac != tc->hmac) {
+        HMAC_CTX_free(hmac);
+    }
+}
+
+EVP_CIPHER_CTX *px_crypto_cipher_begin(px_crypto_thread *tc) {
+    return tc ? tc->cipher : EVP_CIPHER_CTX_new();
+}
+
+void px_crypto_cipher_end(px_crypto_thread *tc, EVP_CIPHER_CTX *cipher) {
+    if (!tc || cipher != tc->cipher) {
+        EVP_CIPHER_CTX_free(cipher);
+    }
+}
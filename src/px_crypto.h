@@ -0,0 +1,49 @@
+#ifndef PX_CRYPTO_H
+#define PX_CRYPTO_H
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <apr_pools.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+
+#include "px_pbkdf2.h"
+
+// openssl state owned by a single thread, created on first use and reused by every request on that thread
+typedef struct px_crypto_thread_t {
+    // hmac state keyed with the payload key, copied into hmac before every digest
+    HMAC_CTX *hmac_keyed;
+    HMAC_CTX *hmac;
+    EVP_CIPHER_CTX *cipher;
+    struct px_crypto_thread_t *next;
+} px_crypto_thread;
+
+typedef struct px_crypto_t {
+    const char *payload_key;
+    // ipad/opad states of the payload key for the pbkdf2 kernel
+    px_pbkdf2_key pbkdf2_key;
+    // explicitly fetched algorithms, shared by all threads
+    const EVP_MD *sha256;
+    const EVP_CIPHER *aes_256_cbc;
+    apr_threadkey_t *thread_key;
+    apr_thread_mutex_t *mutex;
+    // all thread states, released together when the pool is destroyed
+    px_crypto_thread *threads;
+} px_crypto;
+
+px_crypto *px_crypto_create(apr_pool_t *p, const char *payload_key);
+// returns the calling thread state or NULL if it could not be created, callers then fall back to one-off contexts
+px_crypto_thread *px_crypto_thread_get(px_crypto *crypto);
+
+const EVP_MD *px_crypto_sha256(px_crypto *crypto);
+const EVP_CIPHER *px_crypto_aes_256_cbc(px_crypto *crypto);
+
+// returns an hmac context initialized with key, must be released with px_crypto_hmac_end
+HMAC_CTX *px_crypto_hmac_begin(px_crypto *crypto, px_crypto_thread *tc, const char *key);
+void px_crypto_hmac_end(px_crypto_thread *tc, HMAC_CTX *hmac);
+// returns a cipher context, must be released with px_crypto_cipher_end
+EVP_CIPHER_CTX *px_crypto_cipher_begin(px_crypto_thread *tc);
+void px_crypto_cipher_end(px_crypto_thread *tc, EVP_CIPHER_CTX *cipher);
+
+#endif /* PX_CRYPTO_H */
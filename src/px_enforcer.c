@@ -151,13 +151,13 @@ bool verify_captcha(request_context *ctx, px_config *conf) {
         return true;
     }
 
-    char *response_str = NULL;
-    CURLcode status = post_request(conf->captcha_api_url, payload, conf->captcha_timeout, conf, ctx, &response_str, &ctx->api_rtt);
+    post_response response;
+    CURLcode status = post_request(conf->captcha_endpoint, payload, conf->captcha_timeout, conf, ctx, &response, &ctx->api_rtt);
     free(payload);
     if (status == CURLE_OK) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "verify_captcha: server response ", response_str, NULL));
-        captcha_response *c = parse_captcha_response(response_str, ctx);
-        free(response_str);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "verify_captcha: server response ", response.data, NULL));
+        captcha_response *c = parse_captcha_response(response.data, ctx);
+        post_response_release(&response);
         bool passed = (c && c->status == 0);
         if (passed) {
             ctx->pass_reason = PASS_REASON_CAPTCHA;
@@ -226,7 +226,17 @@ bool px_should_verify_request(request_rec *r, px_config *conf) {
     return true;
 }
 
-risk_response* risk_api_get(request_context *ctx, px_config *conf) {
+// a Risk API call running on an io thread while its request is suspended
+struct risk_api_call_t {
+    request_context *ctx;
+    post_request_async *post;
+    CURLcode status;
+    post_response *response;
+    void (*done_cb)(void *baton);
+    void *done_baton;
+};
+
+static char *risk_api_payload(request_context *ctx, px_config *conf) {
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Evaluating Risk API request, call reason: ", get_call_reason_string(ctx->call_reason), NULL));
     char *risk_payload = create_risk_payload(ctx, conf);
     if (!risk_payload) {
@@ -235,15 +245,14 @@ risk_response* risk_api_get(request_context *ctx, px_config *conf) {
     }
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "risk payload: ", risk_payload, NULL));
+    return risk_payload;
+}
 
-    char *risk_response_str;
-    CURLcode status = post_request(conf->risk_api_url, risk_payload, conf->api_timeout_ms, conf, ctx, &risk_response_str, &ctx->api_rtt);
+static risk_response *risk_api_response(request_context *ctx, CURLcode status, const char *risk_response_str) {
     ctx->made_api_call = true;
-    free(risk_payload);
     if (status == CURLE_OK) {
         risk_response *risk_response = parse_risk_response(risk_response_str, ctx);
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Risk API response returned successfully, risk score: ", apr_itoa(ctx->r->pool, risk_response->score), NULL));
-        free(risk_response_str);
         return risk_response;
     }
 
@@ -258,6 +267,46 @@ risk_response* risk_api_get(request_context *ctx, px_config *conf) {
     return NULL;
 }
 
+risk_response* risk_api_get(request_context *ctx, px_config *conf) {
+    char *risk_payload = risk_api_payload(ctx, conf);
+    if (!risk_payload) {
+        return NULL;
+    }
+
+    post_response response;
+    CURLcode status = post_request(conf->risk_endpoint, risk_payload, conf->api_timeout_ms, conf, ctx, &response, &ctx->api_rtt);
+    free(risk_payload);
+    risk_response *risk_response = risk_api_response(ctx, status, response.data);
+    post_response_release(&response);
+    return risk_response;
+}
+
+static void risk_api_call_done(CURLcode status, post_response *response, double request_rtt, void *baton) {
+    risk_api_call *call = (risk_api_call*)baton;
+    call->status = status;
+    call->response = response;
+    call->ctx->api_rtt = request_rtt;
+    call->done_cb(call->done_baton);
+}
+
+risk_api_call *risk_api_prepare(request_context *ctx, px_config *conf, void (*done_cb)(void *baton), void *done_baton) {
+    char *risk_payload = risk_api_payload(ctx, conf);
+    if (!risk_payload) {
+        return NULL;
+    }
+    risk_api_call *call = (risk_api_call*)apr_pcalloc(ctx->r->pool, sizeof(risk_api_call));
+    call->ctx = ctx;
+    call->done_cb = done_cb;
+    call->done_baton = done_baton;
+    call->post = post_request_prepare(conf->risk_endpoint, risk_payload, conf->api_timeout_ms, conf, ctx, risk_api_call_done, call);
+    free(risk_payload);
+    return call->post ? call : NULL;
+}
+
+void risk_api_submit(risk_api_call *call) {
+    post_request_submit(call->post);
+}
+
 request_context* create_context(request_rec *r, const px_config *conf) {
     request_context *ctx = (request_context*) apr_pcalloc(r->pool, sizeof(request_context));
 
@@ -287,8 +336,9 @@ request_context* create_context(request_rec *r, const px_config *conf) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, conf->app_id , "create_context: request IP is NULL");
     }
 
-    ctx->px_payload1 = apr_pstrdup(r->pool, px_payload1);
-    ctx->px_payload3 = apr_pstrdup(r->pool, px_payload3);
+    // both are already allocated from the request pool
+    ctx->px_payload1 = px_payload1;
+    ctx->px_payload3 = px_payload3;
     if (px_payload3) {
         ctx->px_payload = px_payload3;
         ctx->px_payload_version = 3;
@@ -323,33 +373,38 @@ request_context* create_context(request_rec *r, const px_config *conf) {
     return ctx;
 }
 
-bool px_verify_request(request_context *ctx, px_config *conf) {
-    bool request_valid = true;
+static bool handle_risk_response(request_context *ctx, px_config *conf, risk_response *risk_response) {
+    if (!risk_response) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, ctx->r->server, LOGGER_ERROR_FORMAT, ctx->app_id, "Unexpected exception while evaluating risk.");
+        return true;
+    }
+    ctx->score = risk_response->score;
 
-    risk_response *risk_response;
+    if (risk_response->action_data_body){
+        ctx->action_data_body = risk_response->action_data_body;
+    }
 
-    if (conf->captcha_enabled && ctx->px_captcha) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Captcha cookie found, evaluating");
-        if (verify_captcha(ctx, conf)) {
-            // clean users cookie on captcha verification
-            apr_status_t res1 = ap_cookie_remove2(ctx->r, PX_PAYLOAD_COOKIE_V1_PREFIX, NULL, ctx->r->headers_out, ctx->r->err_headers_out, NULL);
-            if (res1 != APR_SUCCESS) {
-                ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Could not remove _px from request");
-            }
-            apr_status_t res3 = ap_cookie_remove2(ctx->r, PX_PAYLOAD_COOKIE_V3_PREFIX, NULL, ctx->r->headers_out, ctx->r->err_headers_out, NULL);
-            if (res3 != APR_SUCCESS) {
-                ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Could not remove _px3 from request");
-            }
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Captcha API response validation status: passed");
-            return request_valid;
-        } else {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Captcha API response validation status: failed");
-            ctx->call_reason = CALL_REASON_CAPTCHA_FAILED;
-            risk_response = risk_api_get(ctx, conf);
-            goto handle_response;
-        }
+    if (!ctx->uuid && risk_response->uuid) {
+        ctx->uuid = risk_response->uuid;
+    }
+
+    if (risk_response->action) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, "[%s] px_verify_request: parsing action (%s)", ctx->app_id, risk_response->action);
+        ctx->action = parseBlockAction(risk_response->action);
+    }
+
+    bool request_valid = ctx->score < conf->blocking_score;
+    if (!request_valid) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Risk score is higher or equal to blocking score. score: ", apr_itoa(ctx->r->pool, ctx->score), " blocking score: ",  apr_itoa(ctx->r->pool, conf->blocking_score), NULL));
+        ctx->block_reason = BLOCK_REASON_SERVER;
+    } else {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Risk score is lower than blocking score. score: ", apr_itoa(ctx->r->pool, ctx->score), " blocking score: ", apr_itoa(ctx->r->pool, conf->blocking_score), NULL));
+        ctx->pass_reason = PASS_REASON_S2S;
     }
+    return request_valid;
+}
 
+bool px_verify_payload(request_context *ctx, px_config *conf, bool *request_valid) {
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "No Captcha cookie present on the request");
     validation_result_t vr;
 
@@ -366,34 +421,49 @@ bool px_verify_request(request_context *ctx, px_config *conf) {
     } else if (ctx->token_origin == TOKEN_ORIGIN_HEADER && strcmp(ctx->px_payload, MOBILE_SDK_PINNING_ERROR) == 0) {
         vr = VALIDATION_RESULT_MOBILE_SDK_PINNING_ERROR;
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Mobile special token - pinning issue");
-    } else {
-        vr = VALIDATION_RESULT_DECRYPTION_FAILED;
-        risk_payload *c = decode_payload(ctx->px_payload, conf->payload_key, ctx);
-        if (c) {
-            ctx->score = c->score;
-            ctx->vid = c->vid;
-            ctx->uuid = c->uuid;
-            ctx->action = parseBlockAction(c->action);
-            vr = validate_payload(c, ctx, conf->payload_key);
-        } else {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool,"Cookie decryption failed, value: ", ctx->px_payload, NULL));
-            ctx->px_payload_orig = ctx->px_payload;
+    } else if (lookup_payload_verdict(ctx, conf)) {
+        vr = VALIDATION_RESULT_VALID;
+    } else if (!lookup_payload_failure(ctx, conf, &vr)) {
+        // reject malformed and forged payloads before paying for the key derivation
+        px_payload_tokens tokens;
+        vr = prevalidate_payload(ctx, conf, &tokens);
+        if (vr == VALIDATION_RESULT_VALID) {
+            vr = VALIDATION_RESULT_DECRYPTION_FAILED;
+            risk_payload *c = decode_payload(&tokens, conf, ctx);
+            if (c) {
+                ctx->score = c->score;
+                ctx->vid = c->vid;
+                ctx->uuid = c->uuid;
+                ctx->action = parseBlockAction(c->action);
+                vr = validate_payload(c, ctx, conf);
+                if (vr == VALIDATION_RESULT_VALID) {
+                    store_payload_verdict(c, ctx, conf);
+                }
+            }
         }
+        store_payload_failure(vr, ctx, conf);
+    }
+    // a failure replayed from the negative cache left the same fields on ctx
+    if (vr == VALIDATION_RESULT_DECRYPTION_FAILED) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool,"Cookie decryption failed, value: ", ctx->px_payload, NULL));
+        ctx->px_payload_orig = ctx->px_payload;
+    } else if (vr == VALIDATION_RESULT_INVALID && !ctx->px_payload_decrypted) {
+        // signature was rejected before decryption, send the original payload instead
+        ctx->px_payload_orig = ctx->px_payload;
     }
     switch (vr) {
         case VALIDATION_RESULT_VALID:
-            request_valid = ctx->score < conf->blocking_score;
-            if (!request_valid) {
+            *request_valid = ctx->score < conf->blocking_score;
+            if (!*request_valid) {
                 ctx->block_reason = BLOCK_REASON_PAYLOAD;
             } else if (is_sensitive_route_prefix(ctx->r, conf) || is_sensitive_route(ctx->r, conf)) {
                 ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Sensitive route match, sending Risk API. path: ", ctx->uri, NULL));
                 ctx->call_reason = CALL_REASON_SENSITIVE_ROUTE;
-                risk_response = risk_api_get(ctx, conf);
-                goto handle_response;
+                return false;
             } else {
                 ctx->pass_reason = PASS_REASON_PAYLOAD;
             }
-            break;
+            return true;
         case VALIDATION_RESULT_EXPIRED:
         case VALIDATION_RESULT_DECRYPTION_FAILED:
         case VALIDATION_RESULT_NULL_PAYLOAD:
@@ -401,43 +471,67 @@ bool px_verify_request(request_context *ctx, px_config *conf) {
         case VALIDATION_RESULT_MOBILE_SDK_CONNECTION_ERROR:
         case VALIDATION_RESULT_MOBILE_SDK_PINNING_ERROR:
             set_call_reason(ctx, vr);
-            risk_response = risk_api_get(ctx, conf);
-handle_response:
-            if (risk_response) {
-                ctx->score = risk_response->score;
+            return false;
+        default:
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "px_verify_request: cookie decode failed returning valid result");
+            *request_valid = true;
+            return true;
+    }
+}
 
-                if (risk_response->action_data_body){
-                    ctx->action_data_body = risk_response->action_data_body;
-                }
+bool px_risk_api_admit(request_context *ctx, px_config *conf) {
+    // asked again when a suspended call falls back to this thread
+    if (!ctx->risk_api_admitted) {
+        if (conf->risk_endpoint && !px_breaker_admit(conf->risk_endpoint->breaker)) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Risk API is recovering, request passes without it");
+            ctx->pass_reason = PASS_REASON_S2S_RAMP;
+            return false;
+        }
+        ctx->risk_api_admitted = true;
+    }
+    return true;
+}
 
-                if (!ctx->uuid && risk_response->uuid) {
-                    ctx->uuid = risk_response->uuid;
-                }
+bool px_verify_risk_api(request_context *ctx, px_config *conf) {
+    if (!px_risk_api_admit(ctx, conf)) {
+        return true;
+    }
+    return handle_risk_response(ctx, conf, risk_api_get(ctx, conf));
+}
 
-                if (risk_response->action) {
-                    ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, "[%s] px_verify_request: parsing action (%s)", ctx->app_id, risk_response->action);
-                    ctx->action = parseBlockAction(risk_response->action);
-                }
+bool px_verify_risk_api_call(risk_api_call *call, px_config *conf) {
+    risk_response *risk_response = risk_api_response(call->ctx, call->status, call->response->data);
+    post_response_release(call->response);
+    return handle_risk_response(call->ctx, conf, risk_response);
+}
 
-                request_valid = ctx->score < conf->blocking_score;
-                if (!request_valid) {
-                    ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Risk score is higher or equal to blocking score. score: ", apr_itoa(ctx->r->pool, ctx->score), " blocking score: ",  apr_itoa(ctx->r->pool, conf->blocking_score), NULL));
-                    ctx->block_reason = BLOCK_REASON_SERVER;
-                } else {
-                    ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Risk score is lower than blocking score. score: ", apr_itoa(ctx->r->pool, ctx->score), " blocking score: ", apr_itoa(ctx->r->pool, conf->blocking_score), NULL));
-                    ctx->pass_reason = PASS_REASON_S2S;
-                }
-            } else {
-                ap_log_error(APLOG_MARK, APLOG_ERR, 0, ctx->r->server, LOGGER_ERROR_FORMAT, ctx->app_id, "Unexpected exception while evaluating risk.");
-                return true;
+bool px_verify_request(request_context *ctx, px_config *conf) {
+    if (conf->captcha_enabled && ctx->px_captcha) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Captcha cookie found, evaluating");
+        if (verify_captcha(ctx, conf)) {
+            // clean users cookie on captcha verification
+            apr_status_t res1 = ap_cookie_remove2(ctx->r, PX_PAYLOAD_COOKIE_V1_PREFIX, NULL, ctx->r->headers_out, ctx->r->err_headers_out, NULL);
+            if (res1 != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Could not remove _px from request");
             }
-            break;
-        default:
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "px_verify_request: cookie decode failed returning valid result");
+            apr_status_t res3 = ap_cookie_remove2(ctx->r, PX_PAYLOAD_COOKIE_V3_PREFIX, NULL, ctx->r->headers_out, ctx->r->err_headers_out, NULL);
+            if (res3 != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Could not remove _px3 from request");
+            }
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Captcha API response validation status: passed");
             return true;
+        } else {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "Captcha API response validation status: failed");
+            ctx->call_reason = CALL_REASON_CAPTCHA_FAILED;
+            return px_verify_risk_api(ctx, conf);
+        }
     }
 
-    return request_valid;
+    bool request_valid;
+    if (px_verify_payload(ctx, conf, &request_valid)) {
+        return request_valid;
+    }
+    return px_verify_risk_api(ctx, conf);
 }
 
 #if DEBUG
@@ -6,6 +6,22 @@
 request_context* create_context(request_rec *r, const px_config *conf);
 bool px_should_verify_request(request_rec *r, px_config *conf);
 bool px_verify_request(request_context *ctx, px_config *conf);
+
+typedef struct risk_api_call_t risk_api_call;
+
+// px_verify_request without the Risk API call, for requests that wait for it without holding a thread. returns true
+// and sets request_valid when the cookie decides the request, false when the Risk API has to be asked.
+bool px_verify_payload(request_context *ctx, px_config *conf, bool *request_valid);
+// false while the Risk API recovers and the request is not one of those let through to it, the request then passes
+bool px_risk_api_admit(request_context *ctx, px_config *conf);
+// asks the Risk API on this thread for a request px_verify_payload did not decide
+bool px_verify_risk_api(request_context *ctx, px_config *conf);
+// prepares the Risk API call for a request px_verify_payload did not decide. done_cb runs on an io thread once the
+// call completed, returns NULL when the call has to be made synchronously.
+risk_api_call *risk_api_prepare(request_context *ctx, px_config *conf, void (*done_cb)(void *baton), void *done_baton);
+void risk_api_submit(risk_api_call *call);
+// verdict of a completed call, must not run before done_cb
+bool px_verify_risk_api_call(risk_api_call *call, px_config *conf);
 #if DEBUG
 const char *json_context(request_context *ctx);
 #endif
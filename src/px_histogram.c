@@ -0,0 +1,129 @@
+#include "px_histogram.h"
+
+#include <apr_atomic.h>
+
+// values below 8 get a bucket each, above that 8 buckets per power of two
+static unsigned int bucket_of(apr_uint64_t value) {
+    if (value < 8) {
+        return (unsigned int)value;
+    }
+    unsigned int octave = 63 - __builtin_clzll(value);
+    unsigned int bucket = (octave - 2) * 8 + (unsigned int)((value >> (octave - 3)) & 7);
+    return bucket < PX_HISTOGRAM_BUCKETS ? bucket : PX_HISTOGRAM_BUCKETS - 1;
+}
+
+static apr_uint64_t bucket_upper(unsigned int bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    unsigned int octave = bucket / 8 + 2;
+    apr_uint64_t sub = bucket % 8;
+    return ((8 + sub + 1) << (octave - 3)) - 1;
+}
+
+px_histogram *px_histogram_create(apr_pool_t *p) {
+    return (px_histogram*)apr_pcalloc(p, sizeof(px_histogram));
+}
+
+void px_histogram_add(px_histogram *h, apr_uint64_t value) {
+    apr_atomic_inc32(&h->buckets[bucket_of(value)]);
+    apr_atomic_inc32(&h->count);
+}
+
+// the bucket counts of every histogram in hs are summed up
+static apr_uint64_t percentile_of(const px_histogram **hs, int n, double percentile) {
+    apr_uint64_t count = 0;
+    for (int h = 0; h < n; ++h) {
+        count += apr_atomic_read32((volatile apr_uint32_t*)&hs[h]->count);
+    }
+    if (count == 0) {
+        return 0;
+    }
+    // rank of the value, 1 based
+    apr_uint64_t rank = (apr_uint64_t)(count * percentile / 100.0 + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    apr_uint64_t seen = 0;
+    for (unsigned int i = 0; i < PX_HISTOGRAM_BUCKETS; ++i) {
+        for (int h = 0; h < n; ++h) {
+            seen += apr_atomic_read32((volatile apr_uint32_t*)&hs[h]->buckets[i]);
+        }
+        if (seen >= rank) {
+            return bucket_upper(i);
+        }
+    }
+    return bucket_upper(PX_HISTOGRAM_BUCKETS - 1);
+}
+
+apr_uint64_t px_histogram_percentile(const px_histogram *h, double percentile) {
+    if (!h) {
+        return 0;
+    }
+    return percentile_of(&h, 1, percentile);
+}
+
+void px_rolling_histogram_init(px_rolling_histogram *h, apr_interval_time_t window) {
+    h->slot_length = window / PX_HISTOGRAM_SLOTS;
+    if (h->slot_length <= 0) {
+        h->slot_length = 1;
+    }
+}
+
+px_rolling_histogram *px_rolling_histogram_create(apr_pool_t *p, apr_interval_time_t window) {
+    px_rolling_histogram *h = (px_rolling_histogram*)apr_pcalloc(p, sizeof(px_rolling_histogram));
+    px_rolling_histogram_init(h, window);
+    return h;
+}
+
+static apr_uint32_t period_now(const px_rolling_histogram *h) {
+    return (apr_uint32_t)(apr_time_now() / h->slot_length);
+}
+
+void px_rolling_histogram_add(px_rolling_histogram *h, apr_uint64_t value) {
+    apr_uint32_t period = period_now(h);
+    unsigned int slot = period % PX_HISTOGRAM_SLOTS;
+    apr_uint32_t old = apr_atomic_read32(&h->periods[slot]);
+    // the thread that moves the slot to the current period clears it
+    if (old != period && apr_atomic_cas32(&h->periods[slot], period, old) == old) {
+        px_histogram *cleared = &h->slots[slot];
+        for (unsigned int i = 0; i < PX_HISTOGRAM_BUCKETS; ++i) {
+            apr_atomic_set32(&cleared->buckets[i], 0);
+        }
+        apr_atomic_set32(&cleared->count, 0);
+    }
+    px_histogram_add(&h->slots[slot], value);
+}
+
+// the slots that still belong to the window
+static int live_slots(px_rolling_histogram *h, const px_histogram **live) {
+    apr_uint32_t period = period_now(h);
+    int n = 0;
+    for (unsigned int slot = 0; slot < PX_HISTOGRAM_SLOTS; ++slot) {
+        if (period - apr_atomic_read32(&h->periods[slot]) < PX_HISTOGRAM_SLOTS) {
+            live[n++] = &h->slots[slot];
+        }
+    }
+    return n;
+}
+
+apr_uint32_t px_rolling_histogram_count(px_rolling_histogram *h) {
+    if (!h) {
+        return 0;
+    }
+    const px_histogram *live[PX_HISTOGRAM_SLOTS];
+    int n = live_slots(h, live);
+    apr_uint32_t count = 0;
+    for (int i = 0; i < n; ++i) {
+        count += apr_atomic_read32((volatile apr_uint32_t*)&live[i]->count);
+    }
+    return count;
+}
+
+apr_uint64_t px_rolling_histogram_percentile(px_rolling_histogram *h, double percentile) {
+    if (!h) {
+        return 0;
+    }
+    const px_histogram *live[PX_HISTOGRAM_SLOTS];
+    return percentile_of(live, live_slots(h, live), percentile);
+}
@@ -0,0 +1,40 @@
+#ifndef PX_HISTOGRAM_H
+#define PX_HISTOGRAM_H
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+// 8 buckets per power of two, values are placed with 12.5% precision up to about 2^34
+#define PX_HISTOGRAM_BUCKETS 256
+// a rolling histogram covers its window with this many histograms, the oldest is cleared as time moves on
+#define PX_HISTOGRAM_SLOTS 4
+
+// lock free histogram of non negative values, such as latencies in usec
+typedef struct px_histogram_t {
+    volatile apr_uint32_t buckets[PX_HISTOGRAM_BUCKETS];
+    volatile apr_uint32_t count;
+} px_histogram;
+
+px_histogram *px_histogram_create(apr_pool_t *p);
+void px_histogram_add(px_histogram *h, apr_uint64_t value);
+// upper bound of the bucket holding the given percentile (0-100), 0 when the histogram is empty or NULL
+apr_uint64_t px_histogram_percentile(const px_histogram *h, double percentile);
+
+// histogram of the values added during about the last window. values added while a slot is cleared may be lost.
+typedef struct px_rolling_histogram_t {
+    px_histogram slots[PX_HISTOGRAM_SLOTS];
+    // the period each slot holds, in slot lengths since the epoch
+    volatile apr_uint32_t periods[PX_HISTOGRAM_SLOTS];
+    apr_interval_time_t slot_length;
+} px_rolling_histogram;
+
+px_rolling_histogram *px_rolling_histogram_create(apr_pool_t *p, apr_interval_time_t window);
+// sets up zeroed memory, for a histogram that is not allocated from a pool
+void px_rolling_histogram_init(px_rolling_histogram *h, apr_interval_time_t window);
+void px_rolling_histogram_add(px_rolling_histogram *h, apr_uint64_t value);
+// number of values in the window, 0 when h is NULL
+apr_uint32_t px_rolling_histogram_count(px_rolling_histogram *h);
+// px_histogram_percentile of the values in the window
+apr_uint64_t px_rolling_histogram_percentile(px_rolling_histogram *h, double percentile);
+
+#endif /* PX_HISTOGRAM_H */
@@ -0,0 +1,415 @@
+#include "px_io.h"
+
+#include <string.h>
+
+#include <apr_atomic.h>
+#include <apr_time.h>
+#include <apr_thread_cond.h>
+#include <http_log.h>
+
+#ifdef APLOG_USE_MODULE
+APLOG_USE_MODULE(perimeterx);
+#endif
+
+// curl_multi_poll and curl_multi_wakeup
+#define PX_IO_SUPPORTED (LIBCURL_VERSION_NUM >= 0x074400)
+// longest sleep of an idle io thread, in ms
+#define POLL_INTERVAL 1000
+
+struct px_io_waiter_t {
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+};
+
+// a transfer, lives on the stack of the request thread until it is completed
+typedef struct px_io_job_t {
+    CURL *curl;
+    apr_time_t submitted;
+    apr_time_t deadline;
+    // either a request thread sleeps on the waiter or done_cb is called
+    px_io_waiter *waiter;
+    px_io_done_cb done_cb;
+    void *baton;
+    bool done;
+    CURLcode result;
+    px_io_thread *thread;
+    // the other transfer of a hedged pair, both run on the same io thread
+    struct px_io_job_t *sibling;
+    struct px_io_job_t *next;
+} px_io_job;
+
+struct px_io_thread_t {
+    px_io *io;
+    apr_thread_t *thread;
+#if PX_IO_SUPPORTED
+    CURLM *multi;
+#endif
+    // lock free stack of submitted jobs, the io thread takes all of them at once
+    px_io_job *queue;
+    // jobs added to the multi handle, only used by the io thread
+    px_io_job *active;
+    volatile apr_uint32_t stop;
+};
+
+#if PX_IO_SUPPORTED
+
+static void complete(px_io_thread *t, px_io_job *job, CURLcode result) {
+    px_io *io = t->io;
+    apr_atomic_inc32(&io->completed);
+    if (result != CURLE_ABORTED_BY_CALLBACK) {
+        apr_uint64_t rtt = apr_time_now() - job->submitted;
+        __atomic_fetch_add(&io->rtt_total, rtt, __ATOMIC_RELAXED);
+        px_histogram_add(io->rtt, rtt);
+    }
+    long connects = 0;
+    if (curl_easy_getinfo(job->curl, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK && connects > 0) {
+        apr_atomic_add32(&io->connects, connects);
+        double appconnect = 0;
+        if (curl_easy_getinfo(job->curl, CURLINFO_APPCONNECT_TIME, &appconnect) == CURLE_OK && appconnect > 0) {
+            apr_atomic_inc32(&io->tls_handshakes);
+        }
+    }
+
+    if (job->done_cb) {
+        job->done_cb(result, job->baton);
+        return;
+    }
+
+    // the request thread returns (and the job goes away) once the mutex is released
+    px_io_waiter *waiter = job->waiter;
+    apr_thread_mutex_lock(waiter->mutex);
+    job->result = result;
+    job->done = true;
+    apr_thread_cond_signal(waiter->cond);
+    apr_thread_mutex_unlock(waiter->mutex);
+}
+
+static px_io_job *remove_active(px_io_thread *t, CURL *curl) {
+    for (px_io_job **p = &t->active; *p; p = &(*p)->next) {
+        if ((*p)->curl == curl) {
+            px_io_job *job = *p;
+            *p = job->next;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// the first successful transfer of a hedged pair wins, the other one is aborted
+static void complete_hedged(px_io_thread *t, px_io_job *job, CURLcode result) {
+    px_io_job *loser = NULL;
+    if (result == CURLE_OK && job->sibling) {
+        loser = remove_active(t, job->sibling->curl);
+        if (loser) {
+            curl_multi_remove_handle(t->multi, loser->curl);
+        }
+    }
+    complete(t, job, result);
+    if (loser) {
+        complete(t, loser, CURLE_ABORTED_BY_CALLBACK);
+    }
+}
+
+static void *APR_THREAD_FUNC io_thread(apr_thread_t *thread, void *data) {
+    px_io_thread *t = (px_io_thread*)data;
+    int running = 0;
+    while (!apr_atomic_read32(&t->stop)) {
+        // adopt the submitted jobs in submission order
+        px_io_job *submitted = __atomic_exchange_n(&t->queue, NULL, __ATOMIC_ACQUIRE);
+        px_io_job *reversed = NULL;
+        while (submitted) {
+            px_io_job *next = submitted->next;
+            submitted->next = reversed;
+            reversed = submitted;
+            submitted = next;
+        }
+        while (reversed) {
+            px_io_job *job = reversed;
+            reversed = job->next;
+            if (job->sibling) {
+                // a hedge is pointless once the transfer it duplicates succeeded
+                if (job->sibling->done && job->sibling->result == CURLE_OK) {
+                    complete(t, job, CURLE_ABORTED_BY_CALLBACK);
+                    continue;
+                }
+                job->sibling->sibling = job;
+            }
+            CURLMcode rc = curl_multi_add_handle(t->multi, job->curl);
+            if (rc != CURLM_OK) {
+                complete(t, job, CURLE_FAILED_INIT);
+                continue;
+            }
+            job->next = t->active;
+            t->active = job;
+        }
+
+        curl_multi_perform(t->multi, &running);
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(t->multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL *curl = msg->easy_handle;
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(t->multi, curl);
+            px_io_job *job = remove_active(t, curl);
+            if (job) {
+                complete_hedged(t, job, result);
+            }
+        }
+
+        // deadlines are enforced here, not only by libcurl, so a request thread never waits longer than asked
+        apr_time_t now = apr_time_now();
+        apr_time_t next_deadline = now + apr_time_from_msec(POLL_INTERVAL);
+        for (px_io_job **p = &t->active; *p;) {
+            px_io_job *job = *p;
+            if (job->deadline <= now) {
+                *p = job->next;
+                curl_multi_remove_handle(t->multi, job->curl);
+                apr_atomic_inc32(&t->io->expired);
+                complete(t, job, CURLE_OPERATION_TIMEDOUT);
+                continue;
+            }
+            if (job->deadline < next_deadline) {
+                next_deadline = job->deadline;
+            }
+            p = &job->next;
+        }
+
+        long timeout_ms = -1;
+        curl_multi_timeout(t->multi, &timeout_ms);
+        long deadline_ms = (long)apr_time_as_msec(next_deadline - now) + 1;
+        if (timeout_ms < 0 || timeout_ms > deadline_ms) {
+            timeout_ms = deadline_ms;
+        }
+        if (timeout_ms > 0) {
+            curl_multi_poll(t->multi, NULL, 0, (int)timeout_ms, NULL);
+        }
+    }
+
+    // the child is going away, fail whatever is still queued or running
+    for (px_io_job *job = __atomic_exchange_n(&t->queue, NULL, __ATOMIC_ACQUIRE); job;) {
+        px_io_job *next = job->next;
+        complete(t, job, CURLE_ABORTED_BY_CALLBACK);
+        job = next;
+    }
+    for (px_io_job *job = t->active; job;) {
+        px_io_job *next = job->next;
+        curl_multi_remove_handle(t->multi, job->curl);
+        complete(t, job, CURLE_ABORTED_BY_CALLBACK);
+        job = next;
+    }
+    t->active = NULL;
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t px_io_cleanup(void *data) {
+    px_io *io = (px_io*)data;
+    for (int i = 0; i < io->nthreads; ++i) {
+        px_io_thread *t = &io->threads[i];
+        if (!t->thread) {
+            continue;
+        }
+        apr_atomic_set32(&t->stop, 1);
+        curl_multi_wakeup(t->multi);
+        apr_status_t rv;
+        apr_thread_join(&rv, t->thread);
+        curl_multi_cleanup(t->multi);
+        t->thread = NULL;
+    }
+    apr_threadkey_private_delete(io->waiter_key);
+    return APR_SUCCESS;
+}
+
+px_io *px_io_create(apr_pool_t *p, server_rec *s, int nthreads) {
+    apr_pool_t *pool;
+    if (nthreads <= 0 || apr_pool_create(&pool, p) != APR_SUCCESS) {
+        return NULL;
+    }
+    px_io *io = (px_io*)apr_pcalloc(pool, sizeof(px_io));
+    io->pool = pool;
+    io->server = s;
+    io->nthreads = nthreads;
+    io->threads = (px_io_thread*)apr_pcalloc(pool, sizeof(px_io_thread) * nthreads);
+    io->rtt = px_histogram_create(pool);
+    if (apr_thread_mutex_create(&io->mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS
+            || apr_threadkey_private_create(&io->waiter_key, NULL, pool) != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+    // a pre cleanup, the threads are joined before their subpools go away. destroying the pool on a failure below
+    // stops the threads already started.
+    apr_pool_pre_cleanup_register(pool, io, px_io_cleanup);
+
+    for (int i = 0; i < nthreads; ++i) {
+        px_io_thread *t = &io->threads[i];
+        t->io = io;
+        t->multi = curl_multi_init();
+        if (!t->multi) {
+            apr_pool_destroy(pool);
+            return NULL;
+        }
+        // transfers to the same host share connections and, over http/2, a single connection
+        curl_multi_setopt(t->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        if (apr_thread_create(&t->thread, NULL, io_thread, t, pool) != APR_SUCCESS) {
+            t->thread = NULL;
+            curl_multi_cleanup(t->multi);
+            apr_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return io;
+}
+
+static px_io_waiter *waiter_get(px_io *io) {
+    void *data = NULL;
+    if (apr_threadkey_private_get(&data, io->waiter_key) == APR_SUCCESS && data) {
+        return (px_io_waiter*)data;
+    }
+
+    // the io pool is only used under the mutex once the threads are running
+    px_io_waiter *waiter = NULL;
+    apr_thread_mutex_lock(io->mutex);
+    px_io_waiter *w = (px_io_waiter*)apr_pcalloc(io->pool, sizeof(px_io_waiter));
+    if (apr_thread_mutex_create(&w->mutex, APR_THREAD_MUTEX_DEFAULT, io->pool) == APR_SUCCESS
+            && apr_thread_cond_create(&w->cond, io->pool) == APR_SUCCESS
+            && apr_threadkey_private_set(w, io->waiter_key) == APR_SUCCESS) {
+        waiter = w;
+    }
+    apr_thread_mutex_unlock(io->mutex);
+    return waiter;
+}
+
+static void enqueue(px_io_thread *t, px_io_job *job) {
+    job->thread = t;
+    apr_atomic_inc32(&t->io->submitted);
+    job->next = __atomic_load_n(&t->queue, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&t->queue, &job->next, job, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    curl_multi_wakeup(t->multi);
+}
+
+static void submit(px_io *io, px_io_job *job, long timeout_ms) {
+    job->submitted = apr_time_now();
+    job->deadline = job->submitted + apr_time_from_msec(timeout_ms);
+    enqueue(&io->threads[apr_atomic_inc32(&io->next_thread) % io->nthreads], job);
+}
+
+CURLcode px_io_perform(px_io *io, CURL *curl, long timeout_ms) {
+    px_io_waiter *waiter = io ? waiter_get(io) : NULL;
+    if (!waiter) {
+        return curl_easy_perform(curl);
+    }
+
+    px_io_job job;
+    memset(&job, 0, sizeof(job));
+    job.curl = curl;
+    job.waiter = waiter;
+    submit(io, &job, timeout_ms);
+
+    apr_thread_mutex_lock(waiter->mutex);
+    while (!job.done) {
+        apr_thread_cond_wait(waiter->cond, waiter->mutex);
+    }
+    apr_thread_mutex_unlock(waiter->mutex);
+    return job.result;
+}
+
+CURLcode px_io_perform_hedged(px_io *io, CURL *curl, long timeout_ms, long hedge_delay_ms, px_io_hedge_cb hedge_cb, void *baton, CURL **winner) {
+    *winner = curl;
+    px_io_waiter *waiter = io ? waiter_get(io) : NULL;
+    if (!waiter) {
+        return curl_easy_perform(curl);
+    }
+
+    px_io_job job;
+    px_io_job hedge;
+    memset(&job, 0, sizeof(job));
+    memset(&hedge, 0, sizeof(hedge));
+    job.curl = curl;
+    job.waiter = waiter;
+    submit(io, &job, timeout_ms);
+
+    apr_time_t hedge_at = job.submitted + apr_time_from_msec(hedge_delay_ms);
+    apr_thread_mutex_lock(waiter->mutex);
+    apr_time_t now;
+    while (!job.done && (now = apr_time_now()) < hedge_at) {
+        apr_thread_cond_timedwait(waiter->cond, waiter->mutex, hedge_at - now);
+    }
+    bool hedged = false;
+    if (!job.done) {
+        apr_thread_mutex_unlock(waiter->mutex);
+        hedge.curl = hedge_cb(baton);
+        if (hedge.curl) {
+            // same deadline and io thread as the first transfer, so it never extends the wait
+            hedge.waiter = waiter;
+            hedge.sibling = &job;
+            hedge.submitted = apr_time_now();
+            hedge.deadline = job.deadline;
+            enqueue(job.thread, &hedge);
+            hedged = true;
+        }
+        apr_thread_mutex_lock(waiter->mutex);
+    }
+    // the loser is aborted by the io thread, both jobs are done before they leave the stack
+    while (!job.done || (hedged && !hedge.done)) {
+        apr_thread_cond_wait(waiter->cond, waiter->mutex);
+    }
+    apr_thread_mutex_unlock(waiter->mutex);
+
+    if (hedged && job.result != CURLE_OK && hedge.result == CURLE_OK) {
+        *winner = hedge.curl;
+        return hedge.result;
+    }
+    return job.result;
+}
+
+bool px_io_submit(px_io *io, apr_pool_t *p, CURL *curl, long timeout_ms, px_io_done_cb done_cb, void *baton) {
+    if (!io) {
+        return false;
+    }
+    px_io_job *job = (px_io_job*)apr_pcalloc(p, sizeof(px_io_job));
+    job->curl = curl;
+    job->done_cb = done_cb;
+    job->baton = baton;
+    submit(io, job, timeout_ms);
+    return true;
+}
+
+#else
+
+px_io *px_io_create(apr_pool_t *p, server_rec *s, int nthreads) {
+    return NULL;
+}
+
+CURLcode px_io_perform(px_io *io, CURL *curl, long timeout_ms) {
+    return curl_easy_perform(curl);
+}
+
+CURLcode px_io_perform_hedged(px_io *io, CURL *curl, long timeout_ms, long hedge_delay_ms, px_io_hedge_cb hedge_cb, void *baton, CURL **winner) {
+    *winner = curl;
+    return curl_easy_perform(curl);
+}
+
+bool px_io_submit(px_io *io, apr_pool_t *p, CURL *curl, long timeout_ms, px_io_done_cb done_cb, void *baton) {
+    return false;
+}
+
+#endif
+
+void px_io_get_stats(px_io *io, px_io_stats *stats) {
+    if (!io) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    stats->submitted = apr_atomic_read32(&io->submitted);
+    stats->completed = apr_atomic_read32(&io->completed);
+    stats->expired = apr_atomic_read32(&io->expired);
+    stats->connects = apr_atomic_read32(&io->connects);
+    stats->tls_handshakes = apr_atomic_read32(&io->tls_handshakes);
+    stats->rtt_total = __atomic_load_n(&io->rtt_total, __ATOMIC_RELAXED);
+    stats->rtt_p50 = px_histogram_percentile(io->rtt, 50);
+    stats->rtt_p99 = px_histogram_percentile(io->rtt, 99);
+}
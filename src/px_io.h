@@ -0,0 +1,68 @@
+#ifndef PX_IO_H
+#define PX_IO_H
+
+#include <stdbool.h>
+
+#include <curl/curl.h>
+#include <apr_pools.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <httpd.h>
+
+#include "px_histogram.h"
+
+typedef struct px_io_thread_t px_io_thread;
+typedef struct px_io_waiter_t px_io_waiter;
+
+// called on the io thread once a submitted transfer completed, failed or timed out
+typedef void (*px_io_done_cb)(CURLcode result, void *baton);
+// called on the request thread once the hedge delay passed, returns a handle set up for the same transfer or NULL
+typedef CURL *(*px_io_hedge_cb)(void *baton);
+
+// outbound transfers of a child, run by a few threads each driving a curl multi handle
+typedef struct px_io_t {
+    apr_pool_t *pool;
+    server_rec *server;
+    int nthreads;
+    px_io_thread *threads;
+    volatile apr_uint32_t next_thread;
+    // per request thread completion, created on first use
+    apr_threadkey_t *waiter_key;
+    apr_thread_mutex_t *mutex;
+    volatile apr_uint32_t submitted;
+    volatile apr_uint32_t completed;
+    volatile apr_uint32_t expired;
+    volatile apr_uint32_t connects;
+    volatile apr_uint32_t tls_handshakes;
+    apr_uint64_t rtt_total; // in usec
+    px_histogram *rtt;
+} px_io;
+
+typedef struct px_io_stats_t {
+    apr_uint32_t submitted;
+    apr_uint32_t completed;
+    apr_uint32_t expired;
+    // new connections and the tls handshakes among them
+    apr_uint32_t connects;
+    apr_uint32_t tls_handshakes;
+    apr_uint64_t rtt_total; // in usec
+    apr_uint64_t rtt_p50;
+    apr_uint64_t rtt_p99;
+} px_io_stats;
+
+// returns NULL if the threads could not be started or libcurl is too old for curl_multi_poll, callers then keep
+// calling curl_easy_perform
+px_io *px_io_create(apr_pool_t *p, server_rec *s, int nthreads);
+// drop in replacement for curl_easy_perform: the transfer runs on an io thread and the caller sleeps until it is done.
+// the io thread fails the transfer with CURLE_OPERATION_TIMEDOUT once timeout_ms passed. runs curl_easy_perform when
+// io is NULL.
+CURLcode px_io_perform(px_io *io, CURL *curl, long timeout_ms);
+// px_io_perform, but when curl has not completed after hedge_delay_ms the handle returned by hedge_cb is started too.
+// the first transfer to succeed wins and the other one is aborted, winner is set to the handle whose result is returned.
+CURLcode px_io_perform_hedged(px_io *io, CURL *curl, long timeout_ms, long hedge_delay_ms, px_io_hedge_cb hedge_cb, void *baton, CURL **winner);
+// starts the transfer on an io thread and returns at once, done_cb gets the result. the job is allocated from p, which
+// has to outlive the transfer. returns false, without calling done_cb, when io is NULL.
+bool px_io_submit(px_io *io, apr_pool_t *p, CURL *curl, long timeout_ms, px_io_done_cb done_cb, void *baton);
+void px_io_get_stats(px_io *io, px_io_stats *stats);
+
+#endif /* PX_IO_H */
@@ -1,4 +1,5 @@
 #include "px_json.h"
+#include "px_response_json.h"
 
 #include <jansson.h>
 #include <apr_pools.h>
@@ -24,6 +25,7 @@ static const char *PASS_REASON_STR[] = {
     [PASS_REASON_CAPTCHA_TIMEOUT] = "captcha_timeout",
     [PASS_REASON_ERROR] = "error",
     [PASS_REASON_MONITOR_MODE] = "monitor_mode",
+    [PASS_REASON_S2S_RAMP] = "s2s_ramp",
 };
 
 // using cookie as value instead of payload, changing it will effect the collector
@@ -246,6 +248,11 @@ char *create_captcha_payload(const request_context *ctx, const px_config *conf)
 }
 
 captcha_response *parse_captcha_response(const char* captcha_response_str, const request_context *ctx) {
+    captcha_response fast;
+    if (px_captcha_response_json_parse(captcha_response_str, ctx->r->pool, &fast)) {
+        return (captcha_response*)apr_pmemdup(ctx->r->pool, &fast, sizeof(fast));
+    }
+
     json_error_t j_error;
     json_t *j_response = json_loads(captcha_response_str, 0, &j_error);
     if (!j_response) {
@@ -281,6 +288,12 @@ captcha_response *parse_captcha_response(const char* captcha_response_str, const
 }
 
 risk_response* parse_risk_response(const char* risk_response_str, const request_context *ctx) {
+    // plain responses are decoded straight from the handle buffer, the rest goes through jansson
+    risk_response fast;
+    if (px_risk_response_json_parse(risk_response_str, ctx->r->pool, &fast)) {
+        return (risk_response*)apr_pmemdup(ctx->r->pool, &fast, sizeof(fast));
+    }
+
     json_error_t j_error;
     json_t *j_response = json_loads(risk_response_str, 0, &j_error);
     if (!j_response) {
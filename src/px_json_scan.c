@@ -0,0 +1,250 @@
+#include "px_json_scan.h"
+
+#include <limits.h>
+#include <string.h>
+
+// longest integer accepted without overflow checks, also the longest fraction of a skipped number
+#define MAX_INTEGER_DIGITS 18
+// deepest nesting of skipped values
+#define MAX_SKIP_DEPTH 8
+
+void px_json_skip_ws(px_json_scan *scan) {
+    while (*scan->p == ' ' || *scan->p == '\t' || *scan->p == '\n' || *scan->p == '\r') {
+        scan->p++;
+    }
+}
+
+const char *px_json_scan_plain_string(px_json_scan *scan, size_t *len) {
+    char *p = scan->p;
+    if (*p != '"') {
+        return NULL;
+    }
+    char *start = ++p;
+    while ((unsigned char)*p >= 0x20 && (unsigned char)*p < 0x7f && *p != '"' && *p != '\\') {
+        p++;
+    }
+    if (*p != '"') {
+        return NULL;
+    }
+    if (len) {
+        *len = p - start;
+    }
+    scan->p = p + 1;
+    return start;
+}
+
+// \u escapes and non ascii bytes are left to jansson, which validates them
+const char *px_json_scan_string(px_json_scan *scan, size_t *decoded_len) {
+    char *p = scan->p;
+    if (*p != '"') {
+        return NULL;
+    }
+    const char *start = ++p;
+    size_t len = 0;
+    for (; *p != '"'; ++p, ++len) {
+        if ((unsigned char)*p < 0x20 || (unsigned char)*p >= 0x7f) {
+            return NULL;
+        }
+        if (*p == '\\') {
+            p++;
+            if (!*p || !strchr("\"\\/bfnrt", *p)) {
+                return NULL;
+            }
+        }
+    }
+    *decoded_len = len;
+    scan->p = p + 1;
+    return start;
+}
+
+char *px_json_decode_string(apr_pool_t *pool, const char *src, size_t decoded_len) {
+    char *str = apr_palloc(pool, decoded_len + 1);
+    char *dst = str;
+    for (; *src != '"'; ++src) {
+        if (*src != '\\') {
+            *dst++ = *src;
+            continue;
+        }
+        switch (*++src) {
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            default: *dst++ = *src; break;
+        }
+    }
+    *dst = '\0';
+    return str;
+}
+
+const char *px_json_scan_integer(px_json_scan *scan, long long *value) {
+    char *start = scan->p;
+    char *p = start;
+    bool negative = *p == '-';
+    if (negative) {
+        p++;
+    }
+    char *digits = p;
+    long long v = 0;
+    while (*p >= '0' && *p <= '9') {
+        if (p - digits == MAX_INTEGER_DIGITS) {
+            return NULL;
+        }
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if (p == digits || (*digits == '0' && (p - digits > 1 || negative))) {
+        return NULL;
+    }
+    if (*p == '.' || *p == 'e' || *p == 'E') {
+        return NULL;
+    }
+    scan->p = p;
+    *value = negative ? -v : v;
+    return start;
+}
+
+const char *px_json_scan_int(px_json_scan *scan, int *value) {
+    long long v;
+    const char *start = px_json_scan_integer(scan, &v);
+    if (!start || v < INT_MIN || v > INT_MAX) {
+        return NULL;
+    }
+    *value = (int)v;
+    return start;
+}
+
+bool px_json_scan_object(px_json_scan *scan, px_json_member_fn member, void *out) {
+    if (*scan->p != '{') {
+        return false;
+    }
+    scan->p++;
+    px_json_skip_ws(scan);
+    if (*scan->p == '}') {
+        scan->p++;
+        return true;
+    }
+    for (;;) {
+        size_t key_len;
+        const char *key = px_json_scan_plain_string(scan, &key_len);
+        if (!key) {
+            return false;
+        }
+        px_json_skip_ws(scan);
+        if (*scan->p != ':') {
+            return false;
+        }
+        scan->p++;
+        px_json_skip_ws(scan);
+        if (!member(scan, key, key_len, out)) {
+            return false;
+        }
+        px_json_skip_ws(scan);
+        if (*scan->p == '}') {
+            scan->p++;
+            return true;
+        }
+        if (*scan->p != ',') {
+            return false;
+        }
+        scan->p++;
+        px_json_skip_ws(scan);
+    }
+}
+
+// a number jansson loads without overflow: at most MAX_INTEGER_DIGITS digits before and after the point and no
+// exponent
+static bool scan_number(px_json_scan *scan) {
+    char *p = scan->p;
+    if (*p == '-') {
+        p++;
+    }
+    char *digits = p;
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (p == digits || p - digits > MAX_INTEGER_DIGITS || (*digits == '0' && p - digits > 1)) {
+        return false;
+    }
+    if (*p == '.') {
+        char *fraction = ++p;
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (p == fraction || p - fraction > MAX_INTEGER_DIGITS) {
+            return false;
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        return false;
+    }
+    scan->p = p;
+    return true;
+}
+
+static bool skip_literal(px_json_scan *scan, const char *literal) {
+    size_t len = strlen(literal);
+    if (strncmp(scan->p, literal, len)) {
+        return false;
+    }
+    scan->p += len;
+    return true;
+}
+
+static bool member_skip(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    return px_json_skip_value(scan, *(int*)out);
+}
+
+bool px_json_skip_value(px_json_scan *scan, int depth) {
+    size_t len;
+    if (depth > MAX_SKIP_DEPTH) {
+        return false;
+    }
+    switch (*scan->p) {
+        case '"':
+            return px_json_scan_string(scan, &len) != NULL;
+        case 't':
+            return skip_literal(scan, "true");
+        case 'f':
+            return skip_literal(scan, "false");
+        case 'n':
+            return skip_literal(scan, "null");
+        case '{':
+            depth++;
+            return px_json_scan_object(scan, member_skip, &depth);
+        case '[':
+            break;
+        default:
+            return scan_number(scan);
+    }
+    scan->p++;
+    px_json_skip_ws(scan);
+    if (*scan->p == ']') {
+        scan->p++;
+        return true;
+    }
+    for (;;) {
+        if (!px_json_skip_value(scan, depth + 1)) {
+            return false;
+        }
+        px_json_skip_ws(scan);
+        if (*scan->p == ']') {
+            scan->p++;
+            return true;
+        }
+        if (*scan->p != ',') {
+            return false;
+        }
+        scan->p++;
+        px_json_skip_ws(scan);
+    }
+}
+
+bool px_json_claim(px_json_scan *scan, unsigned int field) {
+    if (scan->seen & field) {
+        return false;
+    }
+    scan->seen |= field;
+    return true;
+}
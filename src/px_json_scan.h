@@ -0,0 +1,37 @@
+#ifndef PX_JSON_SCAN_H
+#define PX_JSON_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apr_pools.h>
+
+// the pieces of the schema decoders for cookies and api responses. they only accept plain json that jansson decodes
+// the same way, anything else fails and the caller falls back to jansson.
+typedef struct px_json_scan_t {
+    char *p;
+    // fields of the schema already decoded, see px_json_claim
+    unsigned int seen;
+} px_json_scan;
+
+typedef bool (*px_json_member_fn)(px_json_scan *scan, const char *key, size_t key_len, void *out);
+
+void px_json_skip_ws(px_json_scan *scan);
+// printable ascii string without escapes, returns its start or NULL
+const char *px_json_scan_plain_string(px_json_scan *scan, size_t *len);
+// ascii string with the escapes jansson decodes to ascii, other than \u. returns its start or NULL and the decoded length
+const char *px_json_scan_string(px_json_scan *scan, size_t *decoded_len);
+// decodes a string px_json_scan_string accepted into pool
+char *px_json_decode_string(apr_pool_t *pool, const char *start, size_t decoded_len);
+// integers jansson formats back to the same text: no leading zeros, no -0 and no fraction or exponent. returns the
+// start of the integer text or NULL.
+const char *px_json_scan_integer(px_json_scan *scan, long long *value);
+const char *px_json_scan_int(px_json_scan *scan, int *value);
+// calls member for every key, which has to consume the value
+bool px_json_scan_object(px_json_scan *scan, px_json_member_fn member, void *out);
+// validates a value the decoder does not use, depth is the nesting of the value
+bool px_json_skip_value(px_json_scan *scan, int depth);
+// marks a field as seen, duplicates are left to jansson
+bool px_json_claim(px_json_scan *scan, unsigned int field);
+
+#endif /* PX_JSON_SCAN_H */
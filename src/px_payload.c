@@ -1,13 +1,17 @@
 #include "px_payload.h"
+#include "px_crypto.h"
+#include "px_codec.h"
+#include "px_cookie_json.h"
 
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/bio.h>
 #include <openssl/sha.h>
 #include <openssl/hmac.h>
+#include <openssl/crypto.h>
 
 #include <jansson.h>
-#include <apr_base64.h>
+#include <apr_atomic.h>
 #include <apr_tables.h>
 #include <apr_strings.h>
 #include <http_log.h>
@@ -22,39 +26,17 @@ static const int ITERATIONS_UPPER_BOUND = 10000;
 static const int ITERATIONS_LOWER_BOUND = 0;
 static const int IV_LEN = 16;
 static const int KEY_LEN = 32;
-static const int HASH_LEN = 65;
+static const int HASH_LEN = 32;
+
+static const int HMAC_HEX_LEN = 64;
+static const int SALT_MAX_LEN = 128;
+static const int ITERATIONS_MAX_DIGITS = 5;
+// one base64 encoded aes block
+static const int ENCODED_PAYLOAD_MIN_LEN = 24;
+static const int ENCODED_PAYLOAD_MAX_LEN = 4096;
 
 static const char *SIGNING_NOFIELDS[] = { NULL };
-static const char *COOKIE_DELIMITER = ":";
-
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
-static HMAC_CTX *HMAC_CTX_new(void)
-{
-   HMAC_CTX *ctx = OPENSSL_malloc(sizeof(*ctx));
-   if (ctx != NULL) {
-       HMAC_CTX_init(ctx);
-   }
-   return ctx;
-}
 
-static void HMAC_CTX_free(HMAC_CTX *ctx)
-{
-   if (ctx != NULL) {
-       HMAC_CTX_cleanup(ctx);
-       OPENSSL_free(ctx);
-   }
-}
-#endif
-
-static unsigned char *decode_base64(const char *s, int *len, apr_pool_t *p) {
-    if (!s) {
-        return NULL;
-    }
-    int buffsize = apr_base64_decode_len(s) + 1;
-    unsigned char *o = (unsigned char*)apr_palloc(p, buffsize);
-    *len = apr_base64_decode((char*)o, s);
-    return o;
-}
 
 static risk_payload *parse_risk_payload3(const char *raw_payload, request_context *ctx) {
     json_error_t error;
@@ -149,7 +131,42 @@ static risk_payload *parse_risk_payload1(const char *raw_payload, request_contex
     return payload;
 }
 
-risk_payload *parse_risk_payload(const char *raw_payload, request_context *ctx) {
+#if DEBUG
+static const char *LOGGER_ERROR_FORMAT = "[PerimeterX - ERROR][%s] - %s";
+
+static bool str_equal(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// the schema decoder must agree with jansson on every cookie it accepts
+static void verify_risk_payload(const risk_payload *fast, const risk_payload *rp, request_context *ctx) {
+    bool equal = rp && str_equal(fast->timestamp, rp->timestamp) && fast->ts == rp->ts
+        && str_equal(fast->uuid, rp->uuid) && str_equal(fast->vid, rp->vid)
+        && fast->score == rp->score && str_equal(fast->action, rp->action);
+    if (equal && ctx->px_payload_version == 1) {
+        equal = str_equal(fast->hash, rp->hash) && str_equal(fast->a, rp->a) && str_equal(fast->b, rp->b)
+            && fast->a_val == rp->a_val && fast->b_val == rp->b_val;
+    }
+    if (!equal) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, ctx->r->server, LOGGER_ERROR_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "parse_risk_payload: cookie decoder differs from jansson, raw_payload: ", ctx->px_payload_decrypted, NULL));
+    }
+}
+#endif
+
+// scratch must hold strlen(raw_payload) + 1 bytes, the returned strings point into it
+risk_payload *parse_risk_payload(const char *raw_payload, char *scratch, request_context *ctx) {
+    risk_payload *fast = (risk_payload*)apr_palloc(ctx->r->pool, sizeof(risk_payload));
+    if (px_cookie_json_parse(raw_payload, scratch, ctx->px_payload_version, fast)) {
+#if DEBUG
+        verify_risk_payload(fast, ctx->px_payload_version == 1 ? parse_risk_payload1(raw_payload, ctx) : parse_risk_payload3(raw_payload, ctx), ctx);
+#endif
+        if (ctx->px_payload_version == 1) {
+            ctx->px_payload_hmac = fast->hash;
+        }
+        return fast;
+    }
+
+    // anything unusual goes through jansson
     risk_payload *rp = NULL;
     switch (ctx->px_payload_version) {
         case 1:
@@ -165,159 +182,222 @@ risk_payload *parse_risk_payload(const char *raw_payload, request_context *ctx)
     return rp;
 }
 
-static int digest_payload1(const risk_payload*payload, request_context *ctx, const char *payload_key, const char **signing_fields, char *buffer, int buffer_len) {
-
-    unsigned char hash[32];
-
-    HMAC_CTX *hmac = HMAC_CTX_new();
+static int hmac_update_str(HMAC_CTX *hmac, const char *s) {
+    return s ? HMAC_Update(hmac, (const unsigned char*)s, strlen(s)) : 1;
+}
 
-    if (!HMAC_Init_ex(hmac, payload_key, strlen(payload_key), EVP_sha256(), NULL)) {
+static int digest_payload1(const risk_payload*payload, request_context *ctx, const px_payload_key *key, const char **signing_fields, unsigned char *digest) {
+    px_crypto_thread *tc = px_crypto_thread_get(key->crypto);
+    HMAC_CTX *hmac = px_crypto_hmac_begin(key->crypto, tc, key->key);
+    if (!hmac) {
         return 0;
     }
 
-    if (payload->timestamp) {
-        if (!HMAC_Update(hmac,(unsigned char*) payload->timestamp, strlen(payload->timestamp))) {
-            return 0;
-        }
+    int ret = 0;
+    if (!hmac_update_str(hmac, payload->timestamp)
+            || !hmac_update_str(hmac, payload->a)
+            || !hmac_update_str(hmac, payload->b)
+            || !hmac_update_str(hmac, payload->uuid)
+            || !hmac_update_str(hmac, payload->vid)) {
+        goto out;
     }
-    if (payload->a) {
-        if (!HMAC_Update(hmac, (unsigned char*) payload->a, strlen(payload->a))) {
-            return 0;
+    for (; *signing_fields; signing_fields++) {
+        if (!hmac_update_str(hmac, *signing_fields)) {
+            goto out;
         }
     }
-    if (payload->b) {
-        if (!HMAC_Update(hmac,(unsigned char*) payload->b, strlen(payload->b))) {
-            return 0;
-        }
+    unsigned int digest_len = HASH_LEN;
+    ret = HMAC_Final(hmac, digest, &digest_len);
+out:
+    px_crypto_hmac_end(tc, hmac);
+    return ret;
+}
+
+static int digest_payload3(const risk_payload *payload, request_context *ctx, const px_payload_key *key, const char **signing_fields, unsigned char *digest) {
+    px_crypto_thread *tc = px_crypto_thread_get(key->crypto);
+    HMAC_CTX *hmac = px_crypto_hmac_begin(key->crypto, tc, key->key);
+    if (!hmac) {
+        return 0;
     }
-    if (payload->uuid) {
-        if (!HMAC_Update(hmac, (unsigned char*) payload->uuid, strlen(payload->uuid))) {
-            return 0;
+
+    int ret = 0;
+    const char *d = strchr(ctx->px_payload, ':');
+    if (d) {
+        d += 1; // point after :
+        if (!hmac_update_str(hmac, d)) {
+            goto out;
         }
     }
-    if (payload->vid) {
-        if (!HMAC_Update(hmac, (unsigned char*) payload->vid, strlen(payload->vid))) {
-            return 0;
+    for (; *signing_fields; signing_fields++) {
+        if (!hmac_update_str(hmac, *signing_fields)) {
+            goto out;
         }
     }
+    unsigned int digest_len = HASH_LEN;
+    ret = HMAC_Final(hmac, digest, &digest_len);
+out:
+    px_crypto_hmac_end(tc, hmac);
+    return ret;
+}
 
-    while (*signing_fields) {
-        if (!HMAC_Update(hmac, (unsigned char*) *signing_fields, strlen(*signing_fields))) {
-            return 0;
-        }
-        signing_fields++;
+static bool is_base64_field(const char *s, size_t len) {
+    size_t padding = 0;
+    while (padding < 2 && padding < len && s[len - 1 - padding] == '=') {
+        padding++;
     }
-
-    unsigned int len = buffer_len / 2;
-    if (!HMAC_Final(hmac, hash, &len)) {
-        return 0;
+    for (size_t i = 0; i < len - padding; ++i) {
+        char c = s[i];
+        if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/')) {
+            return false;
+        }
     }
-    HMAC_CTX_free(hmac);
+    return true;
+}
 
-    for (int i = 0; i < len; i++) {
-        sprintf(buffer + (i * 2), "%02x", hash[i]);
+static bool is_hex_field(const char *s, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        char c = s[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) {
+            return false;
+        }
     }
-
-    return 1;
+    return true;
 }
 
-static int digest_payload3(const risk_payload *payload, request_context *ctx, const char *payload_key, const char **signing_fields, char *buffer, int buffer_len) {
-    unsigned char hash[32];
-
-    HMAC_CTX *hmac = HMAC_CTX_new();
-    if (!HMAC_Init_ex(hmac, payload_key, strlen(payload_key), EVP_sha256(), NULL)) {
-        return 0;
-    }
-    const char *d = strchr(ctx->px_payload, ':');
-    if (d) {
-        d += 1; // point after :
-        if (!HMAC_Update(hmac, (unsigned char*)d, strlen(d))) {
-            return 0;
+// splits the payload into ([hmac:]salt:iterations:payload) views and validates them in a single pass, the payload
+// is neither copied nor modified. returns NULL if the payload is well formed, otherwise the reason it was rejected.
+static const char *tokenize_payload(const char *px_payload, int version, px_payload_tokens *tokens) {
+    const int nfields = version == 3 ? 4 : 3;
+    const char *fields[4];
+    size_t lens[4];
+
+    const char *p = px_payload;
+    for (int i = 0; i < nfields; ++i) {
+        const char *end = p;
+        while (*end && *end != ':') {
+            end++;
         }
-    }
-    while (*signing_fields) {
-        if (!HMAC_Update(hmac, (unsigned char*) *signing_fields, strlen(*signing_fields))) {
-            return 0;
+        if ((*end == '\0') != (i == nfields - 1)) {
+            return "wrong number of fields";
+        }
+        fields[i] = p;
+        lens[i] = end - p;
+        if (lens[i] == 0) {
+            return "empty field";
         }
-        signing_fields++;
+        p = end + 1;
     }
 
-    unsigned int len = buffer_len / 2;
-    if (!HMAC_Final(hmac, hash, &len)) {
-        return 0;
+    int f = 0;
+    tokens->hmac = NULL;
+    tokens->hmac_len = 0;
+    if (version == 3) {
+        if (lens[f] != HMAC_HEX_LEN || !is_hex_field(fields[f], lens[f])) {
+            return "invalid hmac";
+        }
+        tokens->hmac = fields[f];
+        tokens->hmac_len = lens[f];
+        f++;
+    }
+    if (lens[f] > SALT_MAX_LEN || !is_base64_field(fields[f], lens[f])) {
+        return "invalid salt";
+    }
+    tokens->salt = fields[f];
+    tokens->salt_len = lens[f];
+    f++;
+    if (lens[f] > ITERATIONS_MAX_DIGITS) {
+        return "invalid iterations";
+    }
+    int iterations = 0;
+    for (size_t i = 0; i < lens[f]; ++i) {
+        if (fields[f][i] < '0' || fields[f][i] > '9') {
+            return "invalid iterations";
+        }
+        iterations = iterations * 10 + (fields[f][i] - '0');
     }
-    HMAC_CTX_free(hmac);
-
-    for (int i = 0; i < len; i++) {
-        sprintf(buffer + (i * 2), "%02x", hash[i]);
+    if (iterations < ITERATIONS_LOWER_BOUND || iterations > ITERATIONS_UPPER_BOUND) {
+        return "iterations out of bounds";
     }
-
-    return 1;
+    tokens->iterations = iterations;
+    f++;
+    if (lens[f] < ENCODED_PAYLOAD_MIN_LEN || lens[f] > ENCODED_PAYLOAD_MAX_LEN || !is_base64_field(fields[f], lens[f])) {
+        return "invalid encrypted payload";
+    }
+    tokens->payload = fields[f];
+    tokens->payload_len = lens[f];
+    return NULL;
 }
 
-// create digest for payload, return 1 for success or 0 if an error occurred.
-static int digest_payload(const risk_payload *payload, request_context *ctx, const char *payload_key, const char **signing_fields, char *buffer, int buffer_len) {
+// create the raw digest (HASH_LEN bytes) for payload, return 1 for success or 0 if an error occurred.
+static int digest_payload(const risk_payload *payload, request_context *ctx, const px_payload_key *key, const char **signing_fields, unsigned char *digest) {
     if (ctx->px_payload_version == 3) {
-        return digest_payload3(payload, ctx, payload_key, signing_fields, buffer, buffer_len);
+        return digest_payload3(payload, ctx, key, signing_fields, digest);
     }
-    return digest_payload1(payload, ctx, payload_key, signing_fields, buffer, buffer_len);
+    return digest_payload1(payload, ctx, key, signing_fields, digest);
 }
 
-risk_payload *decode_payload(const char *px_payload, const char *payload_key, request_context *r_ctx) {
-    char *px_payload_cpy = apr_pstrdup(r_ctx->r->pool, px_payload);
-    char* saveptr;
-    // extract hmac from payload for v3
-    if (r_ctx->px_payload_version == 3) {
-        char *payload_hmac = apr_strtok(px_payload_cpy, COOKIE_DELIMITER, &saveptr);
-        if (payload_hmac == NULL) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: stoping payload decryption: no valid hmac for v3");
-            return NULL;
-        }
-        r_ctx->px_payload_hmac = apr_pstrdup(r_ctx->r->pool, payload_hmac);
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, apr_pstrcat(r_ctx->r->pool, "decode_payload: hmac for v3 is ", r_ctx->px_payload_hmac, NULL));
-        px_payload_cpy = NULL;
-    }
-    const char* encoded_salt = apr_strtok(px_payload_cpy, COOKIE_DELIMITER, &saveptr);
-    if (encoded_salt == NULL) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: stoping payload decryption: no valid salt in payload", r_ctx->app_id);
-        return NULL;
-    }
-    const char* iterations_str = apr_strtok(NULL, COOKIE_DELIMITER, &saveptr);
-    if (iterations_str == NULL) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: no valid iterations in payload");
-        return NULL;
+// derives the aes key and iv from the payload key, reusing recently derived keys when the key cache is enabled
+static int derive_payload_key(const px_payload_key *key, const unsigned char *salt, int salt_len, int iterations, unsigned char *out, px_config *conf, request_context *r_ctx) {
+    unsigned char cache_key[PX_CACHE_KEY_LEN];
+    bool cacheable = conf->key_cache && px_cache_key(cache_key,
+            key->key, (apr_size_t)strlen(key->key),
+            salt, (apr_size_t)salt_len,
+            &iterations, (apr_size_t)sizeof(iterations),
+            NULL);
+    if (cacheable && px_cache_get(conf->key_cache, cache_key, out)) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: derived key found in cache");
+        return 1;
+    }
+
+    // client controlled iterations are paid from the child budget, the cookie is sent to the risk api when it runs out
+    if (!px_token_bucket_take(conf->key_derivation_bucket, iterations)) {
+        apr_atomic_inc32(&conf->key_derivations_throttled);
+        r_ctx->px_payload_throttled = true;
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: key derivation budget exhausted");
+        return 0;
     }
-    int iterations = atoi(iterations_str);
-    // make sure iteratins is valid and not too big
-    if (iterations < ITERATIONS_LOWER_BOUND || iterations > ITERATIONS_UPPER_BOUND) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, apr_pstrcat(r_ctx->r->pool, "decode_payload: number of iterations is illegal - ", iterations, NULL));
-        return NULL;
+    apr_atomic_inc32(&conf->key_derivations);
+
+    int derived;
+    if (key->crypto) {
+        derived = px_pbkdf2_sha256(&key->crypto->pbkdf2_key, salt, salt_len, iterations, out, IV_LEN + KEY_LEN);
+    } else {
+        derived = PKCS5_PBKDF2_HMAC(key->key, strlen(key->key), salt, salt_len, iterations, EVP_sha256(), IV_LEN + KEY_LEN, out);
     }
-    const char* encoded_payload = apr_strtok(NULL, COOKIE_DELIMITER, &saveptr);
-    if (encoded_payload == NULL) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: stoping payload decryption: no valid encoded_payload in payload");
-        return NULL;
+    if (derived == 0) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: PKCS5_PBKDF2_HMAC_SHA256 failed");
+        return 0;
     }
-    // decode payload
-    int payload_len = 0;
-    unsigned char *payload = decode_base64(encoded_payload, &payload_len, r_ctx->r->pool);
-    if (!payload) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: failed to base64 decode payload");
-        return NULL;
+    if (cacheable) {
+        px_cache_set(conf->key_cache, cache_key, out, 0);
     }
+    return 1;
+}
 
+// decrypts and parses the payload with a single key
+static risk_payload *decode_payload_key(const px_payload_tokens *tokens, const px_payload_key *payload_key, px_config *conf, request_context *r_ctx) {
     // decode salt
-    int salt_len = 0;
-    unsigned char *salt = decode_base64(encoded_salt, &salt_len, r_ctx->r->pool);
-    if (!salt) {
+    unsigned char salt[SALT_MAX_LEN];
+    long salt_len = px_base64_decode(tokens->salt, tokens->salt_len, salt);
+    if (salt_len < 0) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: failed to base64 decode salt");
         return NULL;
     }
 
+    // decode payload, the buffer is decrypted in place and becomes the plaintext
+    // a second buffer of the same size right after it is scratch space for parsing the plaintext
+    size_t buffer_len = px_base64_decode_len(tokens->payload_len) + 1;
+    unsigned char *payload = apr_palloc(r_ctx->r->pool, buffer_len * 2);
+    long payload_len = px_base64_decode(tokens->payload, tokens->payload_len, payload);
+    if (payload_len < 0) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: failed to base64 decode payload");
+        return NULL;
+    }
+    int iterations = tokens->iterations;
+
     // pbkdf2
-    unsigned char *pbdk2_out = (unsigned char*)apr_palloc(r_ctx->r->pool, IV_LEN + KEY_LEN);
-    if (PKCS5_PBKDF2_HMAC(payload_key, strlen(payload_key), salt, salt_len, iterations, EVP_sha256(),  IV_LEN + KEY_LEN, pbdk2_out) == 0) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: PKCS5_PBKDF2_HMAC_SHA256 failed");
+    unsigned char pbdk2_out[IV_LEN + KEY_LEN];
+    if (!derive_payload_key(payload_key, salt, salt_len, iterations, pbdk2_out, conf, r_ctx)) {
         return NULL;
     }
     unsigned char key[KEY_LEN];
@@ -327,17 +407,18 @@ risk_payload *decode_payload(const char *px_payload, const char *payload_key, re
     memcpy(&iv, pbdk2_out+sizeof(key), sizeof(iv));
 
     // decrypt aes-256-cbc
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv) != 1) {
+    px_crypto_thread *tc = px_crypto_thread_get(payload_key->crypto);
+    EVP_CIPHER_CTX *ctx = px_crypto_cipher_begin(tc);
+    if (!ctx || EVP_DecryptInit_ex(ctx, px_crypto_aes_256_cbc(payload_key->crypto), NULL, key, iv) != 1) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: decryption failed in: Init");
-        EVP_CIPHER_CTX_free(ctx);
+        px_crypto_cipher_end(tc, ctx);
         return NULL;
     }
-    unsigned char *dpayload = apr_pcalloc(r_ctx->r->pool, payload_len + 1);
+    unsigned char *dpayload = payload;
     int len;
     if (EVP_DecryptUpdate(ctx, dpayload, &len, payload, payload_len) != 1) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: decryption failed in: Update");
-        EVP_CIPHER_CTX_free(ctx);
+        px_crypto_cipher_end(tc, ctx);
         return NULL;
     }
 
@@ -345,21 +426,134 @@ risk_payload *decode_payload(const char *px_payload, const char *payload_key, re
     if (EVP_DecryptFinal_ex(ctx, dpayload + len, &len) != 1) {
         ERR_print_errors_fp(stderr);
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r_ctx->r->server, LOGGER_DEBUG_FORMAT, r_ctx->app_id, "decode_payload: decryption failed in: Final");
-        EVP_CIPHER_CTX_free(ctx);
+        px_crypto_cipher_end(tc, ctx);
         return NULL;
     }
-    EVP_CIPHER_CTX_free(ctx);
+    px_crypto_cipher_end(tc, ctx);
 
     dpayload_len += len;
     dpayload[dpayload_len] = '\0';
     r_ctx->px_payload_decrypted = (char *)dpayload;
 
     // parse payload string to risk struct
-    risk_payload *c = parse_risk_payload(r_ctx->px_payload_decrypted, r_ctx);
+    risk_payload *c = parse_risk_payload(r_ctx->px_payload_decrypted, (char*)payload + buffer_len, r_ctx);
     return c;
 }
 
-validation_result_t validate_payload(const risk_payload *payload, request_context *ctx, const char *payload_key) {
+// fills order with the keys in the order they should be tried: the key which last matched a cookie with the same salt,
+// otherwise the key which matched the latest cookie, followed by the remaining keys as configured
+static int payload_key_order(const px_payload_tokens *tokens, px_config *conf, px_payload_key **order) {
+    apr_array_header_t *keys = conf->payload_keys;
+    if (keys->nelts == 0) {
+        return 0;
+    }
+    int first = apr_atomic_read32(&conf->payload_key_last);
+    unsigned char hint_key[PX_CACHE_KEY_LEN];
+    int hint;
+    if (conf->key_hint_cache && px_cache_key(hint_key, tokens->salt, (apr_size_t)tokens->salt_len, NULL)
+            && px_cache_get(conf->key_hint_cache, hint_key, &hint)) {
+        first = hint;
+    }
+    if (first >= keys->nelts) {
+        first = 0;
+    }
+
+    int n = 0;
+    order[n++] = APR_ARRAY_IDX(keys, first, px_payload_key*);
+    for (int i = 0; i < keys->nelts; ++i) {
+        if (i != first) {
+            order[n++] = APR_ARRAY_IDX(keys, i, px_payload_key*);
+        }
+    }
+    return n;
+}
+
+// records the key the cookie was signed or encrypted with
+static void select_payload_key(const px_payload_tokens *tokens, px_payload_key *key, px_config *conf, request_context *ctx) {
+    ctx->px_payload_key = key;
+    apr_atomic_inc32(&key->cookies);
+    if (apr_atomic_read32(&conf->payload_key_last) != (apr_uint32_t)key->index) {
+        apr_atomic_set32(&conf->payload_key_last, key->index);
+    }
+    unsigned char hint_key[PX_CACHE_KEY_LEN];
+    if (conf->key_hint_cache && px_cache_key(hint_key, tokens->salt, (apr_size_t)tokens->salt_len, NULL)) {
+        px_cache_set(conf->key_hint_cache, hint_key, &key->index, 0);
+    }
+    if (conf->payload_keys->nelts > 1) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie matched key ", key->id, NULL));
+    }
+}
+
+risk_payload *decode_payload(const px_payload_tokens *tokens, px_config *conf, request_context *r_ctx) {
+    // v3 cookies were matched to their key by the hmac
+    if (r_ctx->px_payload_key) {
+        return decode_payload_key(tokens, r_ctx->px_payload_key, conf, r_ctx);
+    }
+
+    // v1 cookies are signed over the plaintext, every key is tried until one decrypts the payload
+    px_payload_key *order[PX_PAYLOAD_KEYS_MAX];
+    int nkeys = payload_key_order(tokens, conf, order);
+    for (int i = 0; i < nkeys && !r_ctx->px_payload_throttled; ++i) {
+        r_ctx->px_payload_decrypted = NULL;
+        risk_payload *c = decode_payload_key(tokens, order[i], conf, r_ctx);
+        if (c) {
+            select_payload_key(tokens, order[i], conf, r_ctx);
+            return c;
+        }
+    }
+    return NULL;
+}
+
+// compares the payload hmac with the computed signature
+static validation_result_t verify_signature(const risk_payload *payload, request_context *ctx, const px_payload_key *key, const char *value) {
+    unsigned char expected[HASH_LEN];
+    if (strlen(ctx->px_payload_hmac) != HMAC_HEX_LEN || !px_hex_decode(ctx->px_payload_hmac, HASH_LEN, expected)) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie HMAC validation failed, malformed hmac, value: ", value, NULL));
+        return VALIDATION_RESULT_INVALID;
+    }
+
+    unsigned char signature[HASH_LEN];
+    const char *signing_fields_ua[] = { ctx->useragent, NULL };
+    const char **signing_fields = (ctx->token_origin == TOKEN_ORIGIN_COOKIE) ? signing_fields_ua : SIGNING_NOFIELDS;
+    if (!digest_payload(payload, ctx, key, signing_fields, signature)) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie HMAC validation failed, value: ", value, " user-agent: ", ctx->useragent, NULL));
+        return VALIDATION_RESULT_INVALID;
+    }
+
+    if (CRYPTO_memcmp(signature, expected, HASH_LEN) != 0) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie HMAC validation failed, value: ", value, " user-agent: ", ctx->useragent, NULL));
+        return VALIDATION_RESULT_INVALID;
+    }
+    return VALIDATION_RESULT_VALID;
+}
+
+// cheap checks that run before any key derivation: the payload structure and, for v3, the hmac which is computed
+// over the encrypted payload. returns VALIDATION_RESULT_VALID if the payload should be decrypted.
+validation_result_t prevalidate_payload(request_context *ctx, px_config *conf, px_payload_tokens *tokens) {
+    const char *reason = tokenize_payload(ctx->px_payload, ctx->px_payload_version, tokens);
+    if (reason) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "prevalidate_payload: malformed payload, ", reason, NULL));
+        return VALIDATION_RESULT_DECRYPTION_FAILED;
+    }
+    if (ctx->px_payload_version != 3) {
+        return VALIDATION_RESULT_VALID;
+    }
+
+    ctx->px_payload_hmac = apr_pstrmemdup(ctx->r->pool, tokens->hmac, tokens->hmac_len);
+    // during a key rotation a cookie costs one extra hmac per key tried, never an extra key derivation
+    px_payload_key *order[PX_PAYLOAD_KEYS_MAX];
+    int nkeys = payload_key_order(tokens, conf, order);
+    for (int i = 0; i < nkeys; ++i) {
+        if (verify_signature(NULL, ctx, order[i], ctx->px_payload) == VALIDATION_RESULT_VALID) {
+            ctx->px_payload_hmac_verified = true;
+            select_payload_key(tokens, order[i], conf, ctx);
+            return VALIDATION_RESULT_VALID;
+        }
+    }
+    return VALIDATION_RESULT_INVALID;
+}
+
+validation_result_t validate_payload(const risk_payload *payload, request_context *ctx, px_config *conf) {
     if (payload == NULL) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, "validate_payload: no _px payload");
         return VALIDATION_RESULT_NULL_PAYLOAD;
@@ -379,19 +573,129 @@ validation_result_t validate_payload(const risk_payload *payload, request_contex
         return VALIDATION_RESULT_EXPIRED;
     }
 
-    char signature[HASH_LEN];
-    const char *signing_fields_ua[] = { ctx->useragent, NULL };
-    const char **signing_fields = (ctx->token_origin == TOKEN_ORIGIN_COOKIE) ? signing_fields_ua : SIGNING_NOFIELDS;
-    if (!digest_payload(payload, ctx, payload_key, signing_fields, signature, HASH_LEN)) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie HMAC validation failed, value: ", ctx->px_payload_decrypted, " user-agent: ", ctx->useragent, NULL));
-        return VALIDATION_RESULT_INVALID;
-    }
-
-    if (memcmp(signature, ctx->px_payload_hmac, 64) != 0) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie HMAC validation failed, value: ", ctx->px_payload_decrypted, " user-agent: ", ctx->useragent, NULL));
-        return VALIDATION_RESULT_INVALID;
+    // v3 signature does not depend on the decrypted payload and was already verified by prevalidate_payload
+    if (!ctx->px_payload_hmac_verified) {
+        validation_result_t vr = verify_signature(payload, ctx, ctx->px_payload_key, ctx->px_payload_decrypted);
+        if (vr != VALIDATION_RESULT_VALID) {
+            return vr;
+        }
     }
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(ctx->r->pool, "Cookie evaluation ended successfully, risk score: ", apr_itoa(ctx->r->pool, ctx->score), NULL));
     return VALIDATION_RESULT_VALID;
 }
+
+// the key covers everything the signature is computed over, a full digest so a forged cookie cannot collide with a
+// validated one. computed once per request, returns NULL when it could not be.
+static const unsigned char *payload_cache_key(request_context *ctx) {
+    if (!ctx->px_payload_cache_key_set) {
+        const char *useragent = ctx->useragent ? ctx->useragent : "";
+        ctx->px_payload_cache_key_set = px_cache_key(ctx->px_payload_cache_key,
+                ctx->px_payload, (apr_size_t)strlen(ctx->px_payload),
+                useragent, (apr_size_t)strlen(useragent),
+                &ctx->token_origin, (apr_size_t)sizeof(ctx->token_origin),
+                &ctx->px_payload_version, (apr_size_t)sizeof(ctx->px_payload_version),
+                NULL);
+    }
+    return ctx->px_payload_cache_key_set ? ctx->px_payload_cache_key : NULL;
+}
+
+static bool copy_field(char *dst, const char *src, size_t max_len) {
+    size_t len = src ? strlen(src) : 0;
+    if (len > max_len) {
+        return false;
+    }
+    memcpy(dst, src ? src : "", len + 1);
+    return true;
+}
+
+bool lookup_payload_verdict(request_context *ctx, px_config *conf) {
+    const unsigned char *key;
+    px_payload_verdict verdict;
+    if (!conf->verdict_cache || !(key = payload_cache_key(ctx)) || !px_cache_get(conf->verdict_cache, key, &verdict)) {
+        return false;
+    }
+
+    apr_pool_t *pool = ctx->r->pool;
+    ctx->px_payload_decrypted = apr_pstrdup(pool, verdict.decrypted);
+    ctx->px_payload_hmac = apr_pstrdup(pool, verdict.hmac);
+    ctx->px_payload_hmac_verified = verdict.hmac_verified;
+    ctx->score = verdict.score;
+    ctx->vid = apr_pstrdup(pool, verdict.vid);
+    ctx->uuid = apr_pstrdup(pool, verdict.uuid);
+    ctx->action = verdict.action;
+    ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(pool, "Cookie verdict found in cache, risk score: ", apr_itoa(pool, ctx->score), NULL));
+    return true;
+}
+
+void store_payload_verdict(const risk_payload *payload, request_context *ctx, px_config *conf) {
+    const unsigned char *key;
+    px_payload_verdict verdict;
+    if (!conf->verdict_cache || ctx->score >= conf->blocking_score) {
+        return;
+    }
+    if (!copy_field(verdict.vid, ctx->vid, PX_VERDICT_ID_MAX_LEN)
+            || !copy_field(verdict.uuid, ctx->uuid, PX_VERDICT_ID_MAX_LEN)
+            || !copy_field(verdict.hmac, ctx->px_payload_hmac, PX_VERDICT_HMAC_MAX_LEN)
+            || !copy_field(verdict.decrypted, ctx->px_payload_decrypted, PX_VERDICT_DECRYPTED_MAX_LEN)
+            || !(key = payload_cache_key(ctx))) {
+        return;
+    }
+    verdict.score = ctx->score;
+    verdict.action = ctx->action;
+    verdict.hmac_verified = ctx->px_payload_hmac_verified;
+    // the entry dies with the cookie, expired cookies are always sent through validate_payload
+    px_cache_set(conf->verdict_cache, key, &verdict, apr_time_from_msec(payload->ts));
+}
+
+static const char *restore_field(apr_pool_t *pool, const char *src, unsigned int fields, unsigned int field) {
+    return fields & field ? apr_pstrdup(pool, src) : NULL;
+}
+
+bool lookup_payload_failure(request_context *ctx, px_config *conf, validation_result_t *vr) {
+    const unsigned char *key;
+    px_payload_failure failure;
+    if (!conf->negative_cache || !(key = payload_cache_key(ctx)) || !px_cache_get(conf->negative_cache, key, &failure)) {
+        return false;
+    }
+
+    apr_pool_t *pool = ctx->r->pool;
+    const px_payload_verdict *verdict = &failure.verdict;
+    ctx->px_payload_hmac = restore_field(pool, verdict->hmac, failure.fields, PX_FAILURE_HMAC);
+    ctx->px_payload_hmac_verified = verdict->hmac_verified;
+    if (failure.fields & PX_FAILURE_DECRYPTED) {
+        ctx->px_payload_decrypted = apr_pstrdup(pool, verdict->decrypted);
+        ctx->score = verdict->score;
+        ctx->vid = restore_field(pool, verdict->vid, failure.fields, PX_FAILURE_VID);
+        ctx->uuid = restore_field(pool, verdict->uuid, failure.fields, PX_FAILURE_UUID);
+        ctx->action = verdict->action;
+    }
+    *vr = failure.result;
+    ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, ctx->r->server, LOGGER_DEBUG_FORMAT, ctx->app_id, apr_pstrcat(pool, "Cookie failed validation recently, value: ", ctx->px_payload, NULL));
+    return true;
+}
+
+void store_payload_failure(validation_result_t vr, request_context *ctx, px_config *conf) {
+    const unsigned char *key;
+    px_payload_failure failure;
+    if (!conf->negative_cache || ctx->px_payload_throttled || (vr != VALIDATION_RESULT_DECRYPTION_FAILED && vr != VALIDATION_RESULT_INVALID)) {
+        return;
+    }
+    px_payload_verdict *verdict = &failure.verdict;
+    if (!copy_field(verdict->vid, ctx->vid, PX_VERDICT_ID_MAX_LEN)
+            || !copy_field(verdict->uuid, ctx->uuid, PX_VERDICT_ID_MAX_LEN)
+            || !copy_field(verdict->hmac, ctx->px_payload_hmac, PX_VERDICT_HMAC_MAX_LEN)
+            || !copy_field(verdict->decrypted, ctx->px_payload_decrypted, PX_VERDICT_DECRYPTED_MAX_LEN)
+            || !(key = payload_cache_key(ctx))) {
+        return;
+    }
+    failure.result = vr;
+    failure.fields = (ctx->px_payload_decrypted ? PX_FAILURE_DECRYPTED : 0)
+        | (ctx->px_payload_hmac ? PX_FAILURE_HMAC : 0)
+        | (ctx->vid ? PX_FAILURE_VID : 0)
+        | (ctx->uuid ? PX_FAILURE_UUID : 0);
+    verdict->score = ctx->score;
+    verdict->action = ctx->action;
+    verdict->hmac_verified = ctx->px_payload_hmac_verified;
+    px_cache_set(conf->negative_cache, key, &failure, apr_time_now() + apr_time_from_sec(conf->negative_cache_ttl));
+}
@@ -3,7 +3,64 @@
 
 #include "px_types.h"
 
-risk_payload *decode_payload(const char *px_payload, const char *payload_key, request_context *r_ctx);
-validation_result_t validate_payload(const risk_payload *payload, request_context *ctx, const char *payload_key);
+// size of the pbkdf2 output, aes-256 key followed by the iv
+#define PX_DERIVED_KEY_LEN 48
+
+// (pointer, length) views of the payload fields, they point into the payload and are not nul terminated
+typedef struct px_payload_tokens_t {
+    const char *hmac;
+    size_t hmac_len;
+    const char *salt;
+    size_t salt_len;
+    int iterations;
+    const char *payload;
+    size_t payload_len;
+} px_payload_tokens;
+
+// cookies are remembered only when every field fits, larger ones always take the full path
+#define PX_VERDICT_ID_MAX_LEN 64
+#define PX_VERDICT_HMAC_MAX_LEN 128
+#define PX_VERDICT_DECRYPTED_MAX_LEN 512
+
+// request_context fields filled by a validation, cached per child in verdict_cache and negative_cache
+typedef struct px_payload_verdict_t {
+    int score;
+    action_t action;
+    bool hmac_verified;
+    char vid[PX_VERDICT_ID_MAX_LEN + 1];
+    char uuid[PX_VERDICT_ID_MAX_LEN + 1];
+    char hmac[PX_VERDICT_HMAC_MAX_LEN + 1];
+    char decrypted[PX_VERDICT_DECRYPTED_MAX_LEN + 1];
+} px_payload_verdict;
+
+// the request_context fields of a px_payload_failure which were set, the others are replayed as NULL
+#define PX_FAILURE_DECRYPTED 0x1
+#define PX_FAILURE_HMAC 0x2
+#define PX_FAILURE_VID 0x4
+#define PX_FAILURE_UUID 0x8
+
+// a cookie which failed decryption or validation and what the failure left on the request, cached in negative_cache.
+// score, action, vid and uuid come from the decrypted cookie and are only replayed when it was decrypted.
+typedef struct px_payload_failure_t {
+    validation_result_t result;
+    unsigned int fields;
+    px_payload_verdict verdict;
+} px_payload_failure;
+
+// prevalidate_payload selects the key of v3 cookies by their hmac, decode_payload tries every key on v1 cookies. the
+// selected key is kept in ctx->px_payload_key for validate_payload.
+risk_payload *decode_payload(const px_payload_tokens *tokens, px_config *conf, request_context *r_ctx);
+validation_result_t prevalidate_payload(request_context *ctx, px_config *conf, px_payload_tokens *tokens);
+validation_result_t validate_payload(const risk_payload *payload, request_context *ctx, px_config *conf);
+// fills ctx from a cached verdict of the same cookie, returns false when the cookie has to be validated
+bool lookup_payload_verdict(request_context *ctx, px_config *conf);
+// caches the verdict of a cookie which passed validate_payload with a score below the blocking score
+void store_payload_verdict(const risk_payload *payload, request_context *ctx, px_config *conf);
+// returns true and the cached result when the same cookie recently failed decryption or validation, and fills ctx
+// like the failed validation did
+bool lookup_payload_failure(request_context *ctx, px_config *conf, validation_result_t *vr);
+// remembers decryption and validation failures for negative_cache_ttl seconds. other results and cookies rejected by
+// the key derivation budget are not remembered
+void store_payload_failure(validation_result_t vr, request_context *ctx, px_config *conf);
 
 #endif
@@ -0,0 +1,330 @@
+#include "px_pbkdf2.h"
+
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PX_PBKDF2_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define SHA256_WORDS 8
+#define SHA256_BLOCK 64
+// length in bits of a single block key followed by a digest, the only message size hashed in the iterations loop
+#define HMAC_INNER_BITS ((SHA256_BLOCK + SHA256_DIGEST_LENGTH) * 8)
+// longer salts are passed to openssl
+#define MAX_SALT_LEN 256
+
+static bool accelerated = false;
+
+static const uint32_t K256[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t SHA256_IV[SHA256_WORDS] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROTR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+// plain sha256 compression of a single block, only used to set up keys. the SHA256_* functions that would expose the
+// state are deprecated in openssl 3.
+static void sha256_compress(uint32_t *state, const unsigned char *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+    OPENSSL_cleanse(w, sizeof(w));
+}
+
+// computes the sha256 state after hashing a single key block xored with pad
+static void pad_state(const unsigned char *block, unsigned char pad, uint32_t *state) {
+    unsigned char padded[SHA256_BLOCK];
+    for (int i = 0; i < SHA256_BLOCK; ++i) {
+        padded[i] = block[i] ^ pad;
+    }
+    memcpy(state, SHA256_IV, sizeof(SHA256_IV));
+    sha256_compress(state, padded);
+    OPENSSL_cleanse(padded, sizeof(padded));
+}
+
+int px_pbkdf2_key_init(px_pbkdf2_key *key, const char *pass, size_t pass_len, const EVP_MD *md) {
+    unsigned char block[SHA256_BLOCK] = { 0 };
+    if (pass_len > SHA256_BLOCK) {
+        if (!EVP_Digest(pass, pass_len, block, NULL, md, NULL)) {
+            return 0;
+        }
+    } else {
+        memcpy(block, pass, pass_len);
+    }
+    key->pass = pass;
+    key->pass_len = pass_len;
+    key->md = md;
+    pad_state(block, 0x36, key->ipad);
+    pad_state(block, 0x5c, key->opad);
+    OPENSSL_cleanse(block, sizeof(block));
+    return 1;
+}
+
+#ifdef PX_PBKDF2_SHANI
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+#define ROUNDS4(s0, s1, m, i) do { \
+        __m128i k = _mm_add_epi32(m, _mm_load_si128((const __m128i*)&K256[i])); \
+        s1 = _mm_sha256rnds2_epu32(s1, s0, k); \
+        s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(k, 0x0E)); \
+    } while (0)
+
+#define SCHEDULE(m0, m1, m2, m3) \
+    m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3)
+
+// sha256 compression with the state in the ABEF/CDGH layout used by the sha extensions, the message is given as
+// four vectors of (already big endian decoded) words
+static inline __attribute__((always_inline)) SHANI_TARGET
+void shani_compress(__m128i *abef, __m128i *cdgh, __m128i m0, __m128i m1, __m128i m2, __m128i m3) {
+    __m128i s0 = *abef;
+    __m128i s1 = *cdgh;
+
+    ROUNDS4(s0, s1, m0, 0);
+    ROUNDS4(s0, s1, m1, 4);
+    ROUNDS4(s0, s1, m2, 8);
+    ROUNDS4(s0, s1, m3, 12);
+    for (int i = 16; i < 64; i += 16) {
+        SCHEDULE(m0, m1, m2, m3);
+        ROUNDS4(s0, s1, m0, i);
+        SCHEDULE(m1, m2, m3, m0);
+        ROUNDS4(s0, s1, m1, i + 4);
+        SCHEDULE(m2, m3, m0, m1);
+        ROUNDS4(s0, s1, m2, i + 8);
+        SCHEDULE(m3, m0, m1, m2);
+        ROUNDS4(s0, s1, m3, i + 12);
+    }
+
+    *abef = _mm_add_epi32(s0, *abef);
+    *cdgh = _mm_add_epi32(s1, *cdgh);
+}
+
+// converts state words A..H into the ABEF/CDGH layout
+static inline __attribute__((always_inline)) SHANI_TARGET
+void shani_to_state(__m128i w0, __m128i w1, __m128i *abef, __m128i *cdgh) {
+    __m128i t = _mm_shuffle_epi32(w0, 0xB1);
+    __m128i s1 = _mm_shuffle_epi32(w1, 0x1B);
+    *abef = _mm_alignr_epi8(t, s1, 8);
+    *cdgh = _mm_blend_epi16(s1, t, 0xF0);
+}
+
+// converts the ABEF/CDGH layout back into state words A..H, which are also the digest message words
+static inline __attribute__((always_inline)) SHANI_TARGET
+void shani_from_state(__m128i abef, __m128i cdgh, __m128i *w0, __m128i *w1) {
+    __m128i t = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i s1 = _mm_shuffle_epi32(cdgh, 0xB1);
+    *w0 = _mm_blend_epi16(t, s1, 0xF0);
+    *w1 = _mm_alignr_epi8(s1, t, 8);
+}
+
+// runs the iterations of two independent pbkdf2 blocks, interleaved so the latency bound sha rounds of one block
+// overlap with the other. u holds the first hmac of each block as big endian words and is replaced with the result.
+static SHANI_TARGET void shani_pbkdf2_2(const px_pbkdf2_key *key, int iterations, uint32_t *u_a, uint32_t *u_b) {
+    const __m128i pad0 = _mm_set_epi32(0, 0, 0, (int)0x80000000);
+    const __m128i pad1 = _mm_set_epi32(HMAC_INNER_BITS, 0, 0, 0);
+    __m128i ipad_abef, ipad_cdgh, opad_abef, opad_cdgh;
+    shani_to_state(_mm_loadu_si128((const __m128i*)&key->ipad[0]), _mm_loadu_si128((const __m128i*)&key->ipad[4]), &ipad_abef, &ipad_cdgh);
+    shani_to_state(_mm_loadu_si128((const __m128i*)&key->opad[0]), _mm_loadu_si128((const __m128i*)&key->opad[4]), &opad_abef, &opad_cdgh);
+
+    __m128i ua0 = _mm_loadu_si128((const __m128i*)&u_a[0]);
+    __m128i ua1 = _mm_loadu_si128((const __m128i*)&u_a[4]);
+    __m128i ub0 = _mm_loadu_si128((const __m128i*)&u_b[0]);
+    __m128i ub1 = _mm_loadu_si128((const __m128i*)&u_b[4]);
+    __m128i ta0 = ua0, ta1 = ua1, tb0 = ub0, tb1 = ub1;
+
+    for (int i = 1; i < iterations; ++i) {
+        __m128i a_abef = ipad_abef, a_cdgh = ipad_cdgh;
+        __m128i b_abef = ipad_abef, b_cdgh = ipad_cdgh;
+        shani_compress(&a_abef, &a_cdgh, ua0, ua1, pad0, pad1);
+        shani_compress(&b_abef, &b_cdgh, ub0, ub1, pad0, pad1);
+        shani_from_state(a_abef, a_cdgh, &ua0, &ua1);
+        shani_from_state(b_abef, b_cdgh, &ub0, &ub1);
+
+        a_abef = opad_abef, a_cdgh = opad_cdgh;
+        b_abef = opad_abef, b_cdgh = opad_cdgh;
+        shani_compress(&a_abef, &a_cdgh, ua0, ua1, pad0, pad1);
+        shani_compress(&b_abef, &b_cdgh, ub0, ub1, pad0, pad1);
+        shani_from_state(a_abef, a_cdgh, &ua0, &ua1);
+        shani_from_state(b_abef, b_cdgh, &ub0, &ub1);
+
+        ta0 = _mm_xor_si128(ta0, ua0);
+        ta1 = _mm_xor_si128(ta1, ua1);
+        tb0 = _mm_xor_si128(tb0, ub0);
+        tb1 = _mm_xor_si128(tb1, ub1);
+    }
+
+    _mm_storeu_si128((__m128i*)&u_a[0], ta0);
+    _mm_storeu_si128((__m128i*)&u_a[4], ta1);
+    _mm_storeu_si128((__m128i*)&u_b[0], tb0);
+    _mm_storeu_si128((__m128i*)&u_b[4], tb1);
+}
+
+static bool cpu_has_shani(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1u << 29)) != 0;
+}
+
+static void be_to_words(const unsigned char *in, uint32_t *out) {
+    for (int i = 0; i < SHA256_WORDS; ++i) {
+        out[i] = (uint32_t)in[4 * i] << 24 | (uint32_t)in[4 * i + 1] << 16 | (uint32_t)in[4 * i + 2] << 8 | in[4 * i + 3];
+    }
+}
+
+static void words_to_be(const uint32_t *in, unsigned char *out, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        out[i] = (unsigned char)(in[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+// computes U_1 = HMAC(pass, salt || INT(block)) for a pbkdf2 block
+static int first_hmac(const px_pbkdf2_key *key, const unsigned char *salt, size_t salt_len, uint32_t block, uint32_t *u) {
+    unsigned char msg[MAX_SALT_LEN + 4];
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    unsigned int digest_len = sizeof(digest);
+    memcpy(msg, salt, salt_len);
+    msg[salt_len] = block >> 24;
+    msg[salt_len + 1] = block >> 16;
+    msg[salt_len + 2] = block >> 8;
+    msg[salt_len + 3] = block;
+    if (!HMAC(key->md, key->pass, key->pass_len, msg, salt_len + 4, digest, &digest_len)) {
+        return 0;
+    }
+    be_to_words(digest, u);
+    return 1;
+}
+
+static int shani_pbkdf2(const px_pbkdf2_key *key, const unsigned char *salt, size_t salt_len, int iterations, unsigned char *out, size_t out_len) {
+    uint32_t block = 1;
+    while (out_len > 0) {
+        uint32_t u_a[SHA256_WORDS], u_b[SHA256_WORDS];
+        if (!first_hmac(key, salt, salt_len, block, u_a)) {
+            return 0;
+        }
+        // the second lane is wasted if only one block is left
+        bool two = out_len > SHA256_DIGEST_LENGTH;
+        if (two) {
+            if (!first_hmac(key, salt, salt_len, block + 1, u_b)) {
+                return 0;
+            }
+        } else {
+            memcpy(u_b, u_a, sizeof(u_b));
+        }
+        shani_pbkdf2_2(key, iterations, u_a, u_b);
+
+        size_t n = out_len < SHA256_DIGEST_LENGTH ? out_len : SHA256_DIGEST_LENGTH;
+        words_to_be(u_a, out, n);
+        out += n;
+        out_len -= n;
+        if (two) {
+            n = out_len < SHA256_DIGEST_LENGTH ? out_len : SHA256_DIGEST_LENGTH;
+            words_to_be(u_b, out, n);
+            out += n;
+            out_len -= n;
+        }
+        block += 2;
+    }
+    return 1;
+}
+
+#endif /* PX_PBKDF2_SHANI */
+
+int px_pbkdf2_sha256(const px_pbkdf2_key *key, const unsigned char *salt, size_t salt_len, int iterations, unsigned char *out, size_t out_len) {
+#ifdef PX_PBKDF2_SHANI
+    if (accelerated && iterations >= 1 && salt_len <= MAX_SALT_LEN) {
+        return shani_pbkdf2(key, salt, salt_len, iterations, out, out_len);
+    }
+#endif
+    return PKCS5_PBKDF2_HMAC(key->pass, key->pass_len, salt, salt_len, iterations, key->md, out_len, out);
+}
+
+// compares the kernel output with openssl for key sizes around the block size, odd output sizes and a few iteration counts
+static bool self_test(void) {
+    static const char long_pass[] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789";
+    static const unsigned char salt[] = "perimeterx salt";
+    static const size_t pass_lens[] = { 0, 8, 32, 64, 65, sizeof(long_pass) - 1 };
+    static const int iterations[] = { 1, 2, 1000 };
+    static const size_t out_lens[] = { 20, 32, 48, 100 };
+
+    for (size_t p = 0; p < sizeof(pass_lens) / sizeof(pass_lens[0]); ++p) {
+        px_pbkdf2_key key;
+        if (!px_pbkdf2_key_init(&key, long_pass, pass_lens[p], EVP_sha256())) {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof(iterations) / sizeof(iterations[0]); ++i) {
+            for (size_t o = 0; o < sizeof(out_lens) / sizeof(out_lens[0]); ++o) {
+                unsigned char expected[100], actual[100];
+                if (!PKCS5_PBKDF2_HMAC(long_pass, pass_lens[p], salt, sizeof(salt) - 1, iterations[i], EVP_sha256(), out_lens[o], expected)
+                        || !px_pbkdf2_sha256(&key, salt, sizeof(salt) - 1, iterations[i], actual, out_lens[o])
+                        || memcmp(expected, actual, out_lens[o]) != 0) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool px_pbkdf2_init(void) {
+#ifdef PX_PBKDF2_SHANI
+    accelerated = cpu_has_shani();
+    if (accelerated && !self_test()) {
+        accelerated = false;
+    }
+#endif
+    return accelerated;
+}
+
+bool px_pbkdf2_accelerated(void) {
+    return accelerated;
+}
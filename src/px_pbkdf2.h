@@ -0,0 +1,29 @@
+#ifndef PX_PBKDF2_H
+#define PX_PBKDF2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/evp.h>
+
+// hmac-sha256 key with the ipad/opad compression states computed once
+typedef struct px_pbkdf2_key_t {
+    const char *pass;
+    size_t pass_len;
+    const EVP_MD *md; // sha256, used for the first hmac and by the openssl fallback
+    uint32_t ipad[8];
+    uint32_t opad[8];
+} px_pbkdf2_key;
+
+// detects the cpu features and verifies the accelerated kernel against openssl, must be called before any thread uses
+// px_pbkdf2_sha256. returns true if the accelerated kernel is in use.
+bool px_pbkdf2_init(void);
+bool px_pbkdf2_accelerated(void);
+
+// md must be sha256 and outlive the key, a prefetched one avoids the implicit provider fetch of EVP_sha256()
+int px_pbkdf2_key_init(px_pbkdf2_key *key, const char *pass, size_t pass_len, const EVP_MD *md);
+// PKCS5_PBKDF2_HMAC with sha256, returns 1 for success or 0 if an error occurred
+int px_pbkdf2_sha256(const px_pbkdf2_key *key, const unsigned char *salt, size_t salt_len, int iterations, unsigned char *out, size_t out_len);
+
+#endif /* PX_PBKDF2_H */
@@ -0,0 +1,120 @@
+#include "px_response_json.h"
+#include "px_json_scan.h"
+
+#include <string.h>
+
+enum {
+    FIELD_STATUS = 1 << 0,
+    FIELD_UUID = 1 << 1,
+    FIELD_SCORE = 1 << 2,
+    FIELD_ACTION = 1 << 3,
+    FIELD_ACTION_DATA = 1 << 4,
+    FIELD_BODY = 1 << 5,
+    FIELD_VID = 1 << 6,
+    FIELD_CID = 1 << 7,
+};
+
+static const unsigned int FIELDS_RISK = FIELD_STATUS | FIELD_UUID | FIELD_SCORE | FIELD_ACTION;
+
+typedef struct response_parser_t {
+    apr_pool_t *pool;
+    void *response;
+} response_parser;
+
+static const char *parse_string(px_json_scan *scan, response_parser *rp) {
+    size_t len;
+    const char *start = px_json_scan_string(scan, &len);
+    return start ? px_json_decode_string(rp->pool, start, len) : NULL;
+}
+
+static bool key_is(const char *key, size_t key_len, const char *name) {
+    return key_len == strlen(name) && memcmp(key, name, key_len) == 0;
+}
+
+static bool member_action_data(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    response_parser *rp = (response_parser*)out;
+    risk_response *response = (risk_response*)rp->response;
+    if (key_is(key, key_len, "body")) {
+        return px_json_claim(scan, FIELD_BODY) && (response->action_data_body = parse_string(scan, rp)) != NULL;
+    }
+    return px_json_skip_value(scan, 2);
+}
+
+static bool member_risk(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    response_parser *rp = (response_parser*)out;
+    risk_response *response = (risk_response*)rp->response;
+    if (key_is(key, key_len, "status")) {
+        return px_json_claim(scan, FIELD_STATUS) && px_json_scan_int(scan, &response->status) != NULL;
+    }
+    if (key_is(key, key_len, "uuid")) {
+        return px_json_claim(scan, FIELD_UUID) && (response->uuid = parse_string(scan, rp)) != NULL;
+    }
+    if (key_is(key, key_len, "score")) {
+        return px_json_claim(scan, FIELD_SCORE) && px_json_scan_int(scan, &response->score) != NULL;
+    }
+    if (key_is(key, key_len, "action")) {
+        return px_json_claim(scan, FIELD_ACTION) && (response->action = parse_string(scan, rp)) != NULL;
+    }
+    if (key_is(key, key_len, "action_data")) {
+        // only read for the challenge action, any other value is just skipped
+        return px_json_claim(scan, FIELD_ACTION_DATA)
+            && (*scan->p == '{' ? px_json_scan_object(scan, member_action_data, rp) : px_json_skip_value(scan, 1));
+    }
+    return px_json_skip_value(scan, 1);
+}
+
+static bool member_captcha(px_json_scan *scan, const char *key, size_t key_len, void *out) {
+    response_parser *rp = (response_parser*)out;
+    captcha_response *response = (captcha_response*)rp->response;
+    if (key_is(key, key_len, "status")) {
+        return px_json_claim(scan, FIELD_STATUS) && px_json_scan_int(scan, &response->status) != NULL;
+    }
+    if (key_is(key, key_len, "uuid")) {
+        return px_json_claim(scan, FIELD_UUID) && (response->uuid = parse_string(scan, rp)) != NULL;
+    }
+    if (key_is(key, key_len, "vid")) {
+        return px_json_claim(scan, FIELD_VID) && (response->vid = parse_string(scan, rp)) != NULL;
+    }
+    if (key_is(key, key_len, "cid")) {
+        return px_json_claim(scan, FIELD_CID) && (response->cid = parse_string(scan, rp)) != NULL;
+    }
+    return px_json_skip_value(scan, 1);
+}
+
+// returns the fields seen or 0 when raw is not a plain object
+static unsigned int parse_response(const char *raw, apr_pool_t *pool, px_json_member_fn member, void *response) {
+    // the scanner only writes through p for cookie tokens, response strings are copied into the pool instead
+    px_json_scan scan = { .p = (char*)raw };
+    response_parser rp = { .pool = pool, .response = response };
+    px_json_skip_ws(&scan);
+    if (!px_json_scan_object(&scan, member, &rp)) {
+        return 0;
+    }
+    px_json_skip_ws(&scan);
+    return *scan.p == '\0' ? scan.seen : 0;
+}
+
+bool px_risk_response_json_parse(const char *raw, apr_pool_t *pool, risk_response *response) {
+    memset(response, 0, sizeof(*response));
+    unsigned int seen = parse_response(raw, pool, member_risk, response);
+    if ((seen & FIELDS_RISK) != FIELDS_RISK) {
+        return false;
+    }
+    if (strcmp(response->action, "j")) {
+        response->action_data_body = NULL;
+    } else if (!(seen & FIELD_BODY)) {
+        return false;
+    }
+    return true;
+}
+
+bool px_captcha_response_json_parse(const char *raw, apr_pool_t *pool, captcha_response *response) {
+    memset(response, 0, sizeof(*response));
+    if (!(parse_response(raw, pool, member_captcha, response) & FIELD_STATUS)) {
+        return false;
+    }
+    if (!response->vid) {
+        response->vid = "";
+    }
+    return true;
+}
@@ -0,0 +1,14 @@
+#ifndef PX_RESPONSE_JSON_H
+#define PX_RESPONSE_JSON_H
+
+#include <stdbool.h>
+
+#include "px_types.h"
+
+// decode risk api and captcha responses without jansson, the strings are copied into pool and raw is not written.
+// members the module does not use are validated and skipped. escapes other than \u are decoded, anything beyond that
+// (\u escapes, non ascii text, exponents, duplicate keys...) returns false and has to go through jansson.
+bool px_risk_response_json_parse(const char *raw, apr_pool_t *pool, risk_response *response);
+bool px_captcha_response_json_parse(const char *raw, apr_pool_t *pool, captcha_response *response);
+
+#endif /* PX_RESPONSE_JSON_H */
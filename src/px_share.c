@@ -0,0 +1,95 @@
+#include "px_share.h"
+
+#include <apr_atomic.h>
+#include <openssl/ssl.h>
+
+// the prereq callback only gets the handle, so the counters are per child like the share
+static volatile apr_uint32_t transfers;
+static volatile apr_uint32_t reused;
+static volatile apr_uint32_t tls_handshakes;
+static volatile apr_uint32_t tls_resumed;
+
+static void share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr) {
+    px_share *share = (px_share*)userptr;
+    if (data < CURL_LOCK_DATA_LAST && share->locks[data]) {
+        apr_thread_mutex_lock(share->locks[data]);
+    }
+}
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr) {
+    px_share *share = (px_share*)userptr;
+    if (data < CURL_LOCK_DATA_LAST && share->locks[data]) {
+        apr_thread_mutex_unlock(share->locks[data]);
+    }
+}
+
+#if LIBCURL_VERSION_NUM >= 0x075000
+// runs once the connection is set up, before the request is sent
+static int share_prereq(void *clientp, char *conn_primary_ip, char *conn_local_ip, int conn_primary_port, int conn_local_port) {
+    CURL *curl = (CURL*)clientp;
+    long connects = 0;
+    apr_atomic_inc32(&transfers);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    if (connects == 0) {
+        apr_atomic_inc32(&reused);
+        return CURL_PREREQFUNC_OK;
+    }
+    // internals is only an SSL* with the openssl backend, the check stays ahead of the cast
+    struct curl_tlssessioninfo *tls = NULL;
+    if (curl_easy_getinfo(curl, CURLINFO_TLS_SSL_PTR, &tls) == CURLE_OK && tls && tls->backend == CURLSSLBACKEND_OPENSSL && tls->internals) {
+        apr_atomic_inc32(&tls_handshakes);
+        if (SSL_session_reused((SSL*)tls->internals)) {
+            apr_atomic_inc32(&tls_resumed);
+        }
+    }
+    return CURL_PREREQFUNC_OK;
+}
+#endif
+
+static apr_status_t share_cleanup(void *data) {
+    px_share *share = (px_share*)data;
+    curl_share_cleanup(share->share);
+    return APR_SUCCESS;
+}
+
+px_share *px_share_create(apr_pool_t *p) {
+    px_share *share = (px_share*)apr_pcalloc(p, sizeof(px_share));
+    share->share = curl_share_init();
+    if (!share->share) {
+        return NULL;
+    }
+    // libcurl also locks CURL_LOCK_DATA_SHARE for the share itself, and newer ids for data it keeps there, so every id
+    // gets its own mutex
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+        if (apr_thread_mutex_create(&share->locks[i], APR_THREAD_MUTEX_DEFAULT, p) != APR_SUCCESS) {
+            curl_share_cleanup(share->share);
+            return NULL;
+        }
+    }
+    curl_share_setopt(share->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share->share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share->share, CURLSHOPT_USERDATA, share);
+    // registered after the mutexes, so it runs before they are destroyed
+    apr_pool_cleanup_register(p, share, share_cleanup, apr_pool_cleanup_null);
+    return share;
+}
+
+void px_share_attach(px_share *share, CURL *curl) {
+    if (!share) {
+        return;
+    }
+    curl_easy_setopt(curl, CURLOPT_SHARE, share->share);
+#if LIBCURL_VERSION_NUM >= 0x075000
+    curl_easy_setopt(curl, CURLOPT_PREREQFUNCTION, share_prereq);
+    curl_easy_setopt(curl, CURLOPT_PREREQDATA, curl);
+#endif
+}
+
+void px_share_get_stats(px_share_stats *stats) {
+    stats->transfers = apr_atomic_read32(&transfers);
+    stats->reused = apr_atomic_read32(&reused);
+    stats->tls_handshakes = apr_atomic_read32(&tls_handshakes);
+    stats->tls_resumed = apr_atomic_read32(&tls_resumed);
+}
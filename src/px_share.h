@@ -0,0 +1,30 @@
+#ifndef PX_SHARE_H
+#define PX_SHARE_H
+
+#include <curl/curl.h>
+#include <apr_pools.h>
+#include <apr_thread_mutex.h>
+
+// dns cache and tls sessions shared by every handle of a child. the connection cache is not shared, libcurl does not
+// support sharing it between threads, the io threads share connections through their multi handles instead.
+typedef struct px_share_t {
+    CURLSH *share;
+    apr_thread_mutex_t *locks[CURL_LOCK_DATA_LAST];
+} px_share;
+
+// transfers of the attached handles, counted when libcurl calls the prereq callback (7.80 and later). tls sessions
+// are only inspected with the openssl backend.
+typedef struct px_share_stats_t {
+    apr_uint32_t transfers;
+    apr_uint32_t reused;
+    apr_uint32_t tls_handshakes;
+    apr_uint32_t tls_resumed;
+} px_share_stats;
+
+// one per child, the share has to outlive every handle attached to it. returns NULL on failure.
+px_share *px_share_create(apr_pool_t *p);
+// no-op when share is NULL, has to be repeated after curl_easy_reset
+void px_share_attach(px_share *share, CURL *curl);
+void px_share_get_stats(px_share_stats *stats);
+
+#endif /* PX_SHARE_H */
@@ -0,0 +1,37 @@
+#include "px_token_bucket.h"
+
+px_token_bucket *px_token_bucket_create(apr_pool_t *p, double rate, double burst) {
+    if (rate <= 0) {
+        return NULL;
+    }
+    px_token_bucket *bucket = apr_pcalloc(p, sizeof(px_token_bucket));
+    if (apr_thread_mutex_create(&bucket->mutex, APR_THREAD_MUTEX_DEFAULT, p) != APR_SUCCESS) {
+        return NULL;
+    }
+    bucket->rate = rate;
+    bucket->burst = burst > 0 ? burst : rate;
+    bucket->tokens = bucket->burst;
+    bucket->refilled = apr_time_now();
+    return bucket;
+}
+
+bool px_token_bucket_take(px_token_bucket *bucket, double n) {
+    if (!bucket) {
+        return true;
+    }
+    apr_thread_mutex_lock(bucket->mutex);
+    apr_time_t now = apr_time_now();
+    if (now > bucket->refilled) {
+        bucket->tokens += bucket->rate * (now - bucket->refilled) / APR_USEC_PER_SEC;
+        if (bucket->tokens > bucket->burst) {
+            bucket->tokens = bucket->burst;
+        }
+        bucket->refilled = now;
+    }
+    bool taken = bucket->tokens > 0;
+    if (taken) {
+        bucket->tokens -= n;
+    }
+    apr_thread_mutex_unlock(bucket->mutex);
+    return taken;
+}
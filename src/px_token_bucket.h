@@ -0,0 +1,25 @@
+#ifndef PX_TOKEN_BUCKET_H
+#define PX_TOKEN_BUCKET_H
+
+#include <stdbool.h>
+
+#include <apr_pools.h>
+#include <apr_time.h>
+#include <apr_thread_mutex.h>
+
+// rate limiter refilled with rate tokens per second up to burst tokens
+typedef struct px_token_bucket_t {
+    double rate;
+    double burst;
+    double tokens;
+    apr_time_t refilled;
+    apr_thread_mutex_t *mutex;
+} px_token_bucket;
+
+// returns NULL if rate is not positive or the bucket could not be created, a NULL bucket never limits
+px_token_bucket *px_token_bucket_create(apr_pool_t *p, double rate, double burst);
+// takes n tokens if the bucket is not empty. the bucket may go into debt by one request so a request larger than
+// burst is not starved, the debt delays the following ones.
+bool px_token_bucket_take(px_token_bucket *bucket, double n);
+
+#endif /* PX_TOKEN_BUCKET_H */
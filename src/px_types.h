@@ -6,18 +6,69 @@
 #include <http_protocol.h>
 #include <apr_thread_pool.h>
 #include <apr_queue.h>
+#include <apr_shm.h>
 
 #include "curl_pool.h"
+#include "px_cache.h"
+#include "px_crypto.h"
+#include "px_token_bucket.h"
+#include "px_io.h"
+#include "px_share.h"
+#include "px_breaker.h"
+
 typedef enum {
     CAPTCHA_TYPE_RECAPTCHA,
     CAPTCHA_TYPE_FUNCAPTCHA
 } captcha_type_t;
 
+// max number of CookieKey values active at the same time
+#define PX_PAYLOAD_KEYS_MAX 8
+
+// a cookie decryption key, several keys are active while the key is rotated
+typedef struct px_payload_key_t {
+    const char *key;
+    // short fingerprint of the key, safe to log
+    const char *id;
+    int index;
+    px_crypto *crypto;
+    // cookies matched to this key by this child
+    volatile apr_uint32_t cookies;
+} px_payload_key;
+
+// a PerimeterX api and a pool of handles set up for it once, requests only set the body and the deadline
+typedef struct px_endpoint_t {
+    const char *url;
+    struct curl_slist *headers;
+    curl_pool *pool;
+    struct px_config_t *config;
+    px_rolling_histogram *rtt; // in usec
+    // a request still waiting at this percentile of rtt is sent again, 0 disables hedging
+    int hedge_percentile;
+    // hedges allowed per 100 requests, in hundredths of a hedge
+    int hedge_budget;
+    volatile apr_uint32_t hedge_tokens;
+    volatile apr_uint32_t hedges_fired;
+    volatile apr_uint32_t hedges_won;
+    px_breaker *breaker; // NULL unless PXHealthCheck is on
+} px_endpoint;
+
+// the circuit breakers of a server, kept in shared memory so every child sees the state found by one of them. the
+// child holding the lease runs the health checks.
+typedef struct px_health_t {
+    px_breaker_lease lease;
+    px_breaker risk;
+    px_breaker captcha;
+    px_breaker activities;
+    px_breaker redirect;
+} px_health;
+
 typedef struct px_config_t {
     // px module server memory pool
     apr_pool_t *pool;
     const char *app_id;
-    const char *payload_key;
+    apr_array_header_t *payload_keys; // px_payload_key*, the first configured key first
+    volatile apr_uint32_t payload_key_last;
+    px_cache *key_hint_cache;
     const char *auth_token;
     const char *block_page_url;
     const char *base_url;
@@ -40,11 +91,36 @@ typedef struct px_config_t {
     long captcha_timeout;
     bool send_page_activities;
     const char *module_version;
-    curl_pool *curl_pool;
+    // the risk api pool is sized by CurlPoolSize, captcha and activities get pools of their own
+    px_endpoint *risk_endpoint;
+    px_endpoint *captcha_endpoint;
+    px_endpoint *activities_endpoint;
     curl_pool *redirect_curl_pool;
     int curl_pool_size;
     int redirect_curl_pool_size;
+    int curl_pool_min_size;
+    int redirect_curl_pool_min_size;
+    apr_interval_time_t curl_pool_idle_timeout;
+    int curl_io_threads;
+    px_io *io;
+    px_share *share;
+    bool curl_http2;
+    int curl_warm_connections;
+    int curl_tcp_keepalive; // in seconds
+    int curl_connection_idle_timeout; // in seconds
+    bool curl_tcp_fastopen;
+    volatile apr_uint32_t connections_warmed;
+    bool suspend_requests;
+    bool hedge_risk_requests;
+    int hedge_percentile;
+    int hedge_budget_percent;
+    int adaptive_timeout_multiplier;
+    long adaptive_timeout_min_ms;
+    long adaptive_timeout_max_ms;
+    px_rolling_histogram *redirect_rtt;
+    volatile apr_uint32_t requests_suspended;
     const char *proxy_url;
+    const char *curl_ca_info;
     apr_array_header_t *routes_whitelist;
     apr_array_header_t *useragents_whitelist;
     apr_array_header_t *custom_file_ext_whitelist;
@@ -62,8 +138,16 @@ typedef struct px_config_t {
     apr_thread_t *health_check_thread;
     apr_thread_cond_t *health_check_cond;
     int px_errors_threshold;
-    volatile apr_uint32_t px_errors_count;
-    long health_check_interval; // in ms
+    long health_check_interval; // in usec, the window of the circuit breakers
+    int breaker_error_rate;
+    long breaker_max_latency_ms;
+    long breaker_probe_min_ms;
+    long breaker_probe_max_ms;
+    long breaker_ramp_ms;
+    bool breaker_ramp_exponential;
+    px_breaker *redirect_breaker;
+    px_health *health;
+    apr_shm_t *health_shm;
     bool should_exit_thread;
     bool enable_token_via_header;
     bool uuid_header_enabled;
@@ -84,6 +168,18 @@ typedef struct px_config_t {
     const char *client_exteral_path;
     const char *collector_base_uri;
     const char *client_base_uri;
+    int key_cache_size;
+    px_cache *key_cache;
+    int verdict_cache_size;
+    px_cache *verdict_cache;
+    int negative_cache_size;
+    int negative_cache_ttl; // in seconds
+    px_cache *negative_cache;
+    int key_derivation_budget; // pbkdf2 iterations per second
+    int key_derivation_burst;
+    px_token_bucket *key_derivation_bucket;
+    volatile apr_uint32_t key_derivations;
+    volatile apr_uint32_t key_derivations_throttled;
 } px_config;
 
 typedef struct health_check_data_t {
@@ -91,6 +187,13 @@ typedef struct health_check_data_t {
     px_config *config;
 } health_check_data;
 
+typedef struct warm_connection_t {
+    px_config *config;
+    server_rec *server;
+    curl_pool *pool;
+    CURL *curl;
+} warm_connection;
+
 typedef struct activity_consumer_data_t {
     px_config *config;
     server_rec *server;
@@ -129,6 +232,7 @@ typedef enum {
     PASS_REASON_CAPTCHA_TIMEOUT,
     PASS_REASON_ERROR,
     PASS_REASON_MONITOR_MODE,
+    PASS_REASON_S2S_RAMP,
 } pass_reason_t;
 
 typedef enum {
@@ -185,6 +289,12 @@ typedef struct request_context_t {
     int px_payload_version;
     const char *px_payload_decrypted;
     const char *px_payload_hmac;
+    bool px_payload_hmac_verified;
+    bool px_payload_throttled;
+    // key of the cookie in the verdict and negative caches, computed on first use
+    bool px_payload_cache_key_set;
+    unsigned char px_payload_cache_key[PX_CACHE_KEY_LEN];
+    const px_payload_key *px_payload_key;
     const char *px_captcha;
     const char *ip;
     const char *vid;
@@ -203,6 +313,7 @@ typedef struct request_context_t {
     pass_reason_t pass_reason;
     bool block_enabled;
     bool made_api_call;
+    bool risk_api_admitted;
     request_rec *r;
     double api_rtt;
     token_origin_t token_origin;
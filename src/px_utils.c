@@ -1,7 +1,5 @@
 #include "px_utils.h"
 
-#include <apr_atomic.h>
-
 #include <arpa/inet.h>
 #include <apr_strings.h>
 #include <http_log.h>
@@ -11,18 +9,11 @@ APLOG_USE_MODULE(perimeterx);
 #endif
 
 #define BLOCKSIZE 4096
+// largest body reserved up front from Content-Length, risk api and captcha responses are well below it
+#define RESPONSE_RESERVE_MAX (64 * 1024)
 #define T_ESCAPE_URLENCODED    (16)
 #define TEST_CHAR(c, f)        (test_char_table[(unsigned)(c)] & (f))
 
-struct response_t {
-    char* data;
-    size_t size;
-    server_rec *server;
-    request_rec *r;
-    apr_array_header_t *headers;
-    const char *app_id;
-};
-
 
 static const char *JSON_CONTENT_TYPE = "Content-Type: application/json";
 static const char *EXPECT = "Expect:";
@@ -46,18 +37,6 @@ static const unsigned char test_char_table[256] = {
     30,30,30,30,30,30,30,30,30,30,30,30,30,30,30,30
 };
 
-static void update_and_notify_health_check(px_config *conf) {
-    if (!conf->px_health_check) {
-        return;
-    }
-    apr_uint32_t old_value = apr_atomic_inc32(&conf->px_errors_count);
-    apr_thread_mutex_lock(conf->health_check_cond_mutex);
-    if (old_value >= conf->px_errors_threshold) {
-        apr_thread_cond_signal(conf->health_check_cond);
-    }
-    apr_thread_mutex_unlock(conf->health_check_cond_mutex);
-}
-
 /**
  * Use this function to read the body from request_rec
  * Pointer to data will be set to body
@@ -96,20 +75,56 @@ static int read_body(request_rec *r, char **body) {
     return -1;
 }
 
+// grows on the heap for handle buffers, which keep their capacity, or in the pool for bodies handed to a request
+static bool buffer_reserve(curl_buffer *buffer, size_t capacity, apr_pool_t *pool) {
+    if (capacity <= buffer->capacity) {
+        return true;
+    }
+    char *data;
+    if (pool) {
+        data = apr_palloc(pool, capacity);
+        if (data && buffer->size) {
+            memcpy(data, buffer->data, buffer->size);
+        }
+    } else {
+        data = realloc(buffer->data, capacity);
+    }
+    if (!data) {
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
 static size_t write_response_cb(void* contents, size_t size, size_t nmemb, void *stream) {
     struct response_t *res = (struct response_t*)stream;
+    curl_buffer *body = res->body;
     size_t realsize = size * nmemb;
-    char *tmp;
-    tmp = realloc(res->data, res->size + realsize + 1);
-    if (tmp == NULL) {
+    if (!body) {
+        return 0;
+    }
+    size_t needed = body->size + realsize + 1;
+#if LIBCURL_VERSION_NUM >= 0x073700
+    // the whole body at once when the length is known, up to RESPONSE_RESERVE_MAX. a larger announced length only
+    // grows the buffer as the data arrives, so a bogus header cannot reserve more than it sends
+    if (body->size == 0) {
+        curl_off_t content_length = -1;
+        if (curl_easy_getinfo(res->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length) == CURLE_OK && content_length >= (curl_off_t)realsize) {
+            needed = (size_t)(content_length < RESPONSE_RESERVE_MAX ? content_length : RESPONSE_RESERVE_MAX) + 1;
+            if (needed < realsize + 1) {
+                needed = realsize + 1;
+            }
+        }
+    }
+#endif
+    if (needed > body->capacity && !buffer_reserve(body, needed > 2 * body->capacity ? needed : 2 * body->capacity, res->pool)) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, res->server, "[%s]: not enough memory for post_request buffer alloc", res->app_id);
-        free(res->data);
         return 0;
     }
-    res->data = tmp;
-    memcpy(&(res->data[res->size]), contents, realsize);
-    res->size += realsize;
-    res->data[res->size] = 0;
+    memcpy(&(body->data[body->size]), contents, realsize);
+    body->size += realsize;
+    body->data[body->size] = 0;
     return realsize;
 }
 
@@ -173,81 +188,151 @@ const char *get_request_ip(const request_rec *r, const px_config *conf) {
     return socket_ip;
 }
 
-CURLcode post_request_helper(CURL* curl, const char *url, const char *payload, long timeout, px_config *conf, server_rec *server, char **response_data) {
-    struct response_t response;
-    struct curl_slist *headers = NULL;
-    long status_code;
-    char errbuf[CURL_ERROR_SIZE];
-    errbuf[0] = 0;
+void set_connection_options(CURL *curl, const char *url, const px_config *conf) {
+    if (conf->curl_ca_info) {
+        curl_easy_setopt(curl, CURLOPT_CAINFO, conf->curl_ca_info);
+    }
+#if LIBCURL_VERSION_NUM >= 0x073100
+    // transfers on the same io thread then share one connection per host. only https, where ALPN falls back to
+    // HTTP/1.1 for peers without h2. plain http collectors, first party hosts and proxies may not speak h2c.
+    if (conf->curl_http2 && strncmp(url, "https://", 8) == 0) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+    if (conf->curl_tcp_fastopen) {
+        curl_easy_setopt(curl, CURLOPT_TCP_FASTOPEN, 1L);
+    }
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071900
+    if (conf->curl_tcp_keepalive > 0) {
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, (long)conf->curl_tcp_keepalive);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, (long)conf->curl_tcp_keepalive);
+    }
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074100
+    if (conf->curl_connection_idle_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, (long)conf->curl_connection_idle_timeout);
+    }
+#endif
+}
 
-    response.data = malloc(1);
-    response.size = 0;
-    response.server = server;
+void warm_connection_start(CURL *curl, const char *url, px_config *conf) {
+    // a HEAD request, connect only transfers leave connections libcurl does not hand to later requests
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, conf->api_timeout_ms);
+    set_connection_options(curl, url, conf);
+    if (conf->proxy_url) {
+        curl_easy_setopt(curl, CURLOPT_PROXY, conf->proxy_url);
+    }
+}
+
+void warm_connection_end(CURL *curl) {
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+}
 
+struct curl_slist *post_request_headers(px_config *conf) {
+    struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, conf->auth_header);
     headers = curl_slist_append(headers, JSON_CONTENT_TYPE);
     headers = curl_slist_append(headers, EXPECT);
+    return headers;
+}
 
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+void post_request_init(CURL *curl, const char *url, struct curl_slist *headers, px_config *conf) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*) &response);
+    set_connection_options(curl, url, conf);
     if (conf->proxy_url) {
         curl_easy_setopt(curl, CURLOPT_PROXY, conf->proxy_url);
     }
-    CURLcode status = curl_easy_perform(curl);
-    curl_slist_free_all(headers);
+}
+
+void post_request_start(post_request_state *state, CURL *curl, const char *payload, long timeout, server_rec *server) {
+    state->errbuf[0] = 0;
+
+    state->response.body = curl_pool_buffer(curl);
+    if (state->response.body) {
+        state->response.body->size = 0;
+    }
+    state->response.curl = curl;
+    state->response.pool = NULL;
+    state->response.server = server;
+    state->response.app_id = NULL;
+
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, state->errbuf);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*) &state->response);
+}
+
+CURLcode post_request_end(post_request_state *state, CURL *curl, CURLcode status, px_config *conf, const char **response_data) {
+    server_rec *server = state->response.server;
+    long status_code;
     if (status == CURLE_OK) {
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status_code);
         if (status_code == HTTP_OK) {
             if (response_data != NULL) {
-                *response_data = response.data;
-            } else {
-                free(response.data);
+                curl_buffer *body = state->response.body;
+                *response_data = body && body->size ? body->data : "";
             }
             return status;
         }
+        const char *url = NULL;
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
         ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, server, "[%s]: post_request: status: %lu, url: %s", conf->app_id, status_code, url);
         status = CURLE_HTTP_RETURNED_ERROR;
     } else {
-        update_and_notify_health_check(conf);
-        size_t len = strlen(errbuf);
+        size_t len = strlen(state->errbuf);
         if (len) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, server, "[%s]: post_request failed: %s", conf->app_id, errbuf);
+            ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, server, "[%s]: post_request failed: %s", conf->app_id, state->errbuf);
         } else {
             ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, server, "[%s]: post_request failed: %s", conf->app_id, curl_easy_strerror(status));
         }
     }
-    free(response.data);
     if (response_data != NULL) {
         *response_data = NULL;
     }
     return status;
 }
 
+CURLcode post_request_helper(CURL* curl, const char *payload, long timeout, px_config *conf, server_rec *server, const char **response_data) {
+    post_request_state state;
+    post_request_start(&state, curl, payload, timeout, server);
+    CURLcode status = px_io_perform(conf->io, curl, timeout);
+    return post_request_end(&state, curl, status, conf, response_data);
+}
+
 // returns the payload version, 0 if error msg, -1 if header not found
 int extract_payload_from_header(apr_pool_t *pool, apr_table_t *headers, const char **payload3, const char **payload1) {
     *payload3 = NULL;
     *payload1 = NULL;
     const char *header_value = apr_table_get(headers, MOBILE_SDK_HEADER);
     if (header_value) {
-        char *rest;
-        char *header_cpy = apr_pstrdup(pool, header_value);
-        const char *prefix = apr_strtok(header_cpy, ":", &rest);
-        if (prefix == NULL) {
+        // parsed in place, payloads point into the header value
+        const char *prefix = header_value;
+        while (*prefix == ':') {
+            prefix++;
+        }
+        if (*prefix == '\0') {
             // Setting payload to "" so it will fail on decryption
             *payload3 = "";
             return 0;
         }
-        const char *postfix = apr_strtok(NULL, "", &rest);
+        const char *delimiter = strchr(prefix, ':');
         // if postfix is empty, use prefix as payload number, in this case version will be 0
-        if (postfix == NULL) {
+        if (delimiter == NULL) {
             *payload3 = prefix;
             return 0;
         }
+        if (delimiter[1] == '\0') {
+            *payload3 = apr_pstrmemdup(pool, prefix, delimiter - prefix);
+            return 0;
+        }
+        const char *postfix = delimiter + 1;
         int version = apr_atoi64(prefix);
         switch (version) {
             case 1:
@@ -343,16 +428,20 @@ const char *pescape_urlencoded(apr_pool_t *p, const char *str) {
  * Unlike post_request_helper, response_data doesn't have to be free as it being allocated using apr
  * Returns CURLcode
  */
-CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, const char *vid, px_config *conf, request_rec *r, const char **response_data, apr_array_header_t **response_headers, int *content_size) {
+CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, const char *vid, long timeout, px_config *conf, request_rec *r, const char **response_data, apr_array_header_t **response_headers, int *content_size) {
     const char *url = apr_pstrcat(r->pool, base_url, uri, NULL);
     struct response_t response;
+    curl_buffer response_body = { NULL, 0, 0 };
     struct curl_slist *headers = NULL;
     long status_code;
     char errbuf[CURL_ERROR_SIZE];
     errbuf[0] = 0;
 
-    response.data = malloc(1);
-    response.size = 0;
+    // the body is handed to the request as is, so it grows in the request pool
+    response.body = &response_body;
+    response.curl = curl;
+    response.pool = r->pool;
+    response.app_id = conf->app_id;
     response.headers = apr_array_make(r->pool, 0, sizeof(char*));
     response.r = r;
     response.server = r->server;
@@ -392,15 +481,16 @@ CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, cons
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
     }
 
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, conf->api_timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response_cb);
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*) &response);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*) &response);
+    set_connection_options(curl, url, conf);
     if (conf->proxy_url) {
         curl_easy_setopt(curl, CURLOPT_PROXY, conf->proxy_url);
     }
-    CURLcode status = curl_easy_perform(curl);
+    CURLcode status = px_io_perform(conf->io, curl, timeout);
     curl_slist_free_all(headers);
 
     if (status == CURLE_OK) {
@@ -408,15 +498,14 @@ CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, cons
         if (status_code == HTTP_OK) {
             if (response_data != NULL) {
                 *response_headers = response.headers;
-                *response_data = apr_pstrmemdup(r->pool, response.data, response.size);
-                *content_size = response.size;
+                *response_data = response_body.data ? response_body.data : "";
+                *content_size = response_body.size;
             }
         } else {
             ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, "[%s]: post_request: status: %lu, url: %s", conf->app_id, status_code, url);
             status = CURLE_HTTP_RETURNED_ERROR;
         }
     } else {
-        update_and_notify_health_check(conf);
         size_t len = strlen(errbuf);
         if (len) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, "[%s]: post_request failed: %s", conf->app_id, errbuf);
@@ -424,6 +513,5 @@ CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, cons
             ap_log_error(APLOG_MARK, APLOG_DEBUG | APLOG_NOERRNO, 0, r->server, "[%s]: post_request failed: %s", conf->app_id, curl_easy_strerror(status));
         }
     }
-    free(response.data);
     return status;
 }
@@ -6,9 +6,41 @@
 
 #include "px_types.h"
 
+struct response_t {
+    curl_buffer *body;
+    CURL *curl;
+    // the body grows in this pool instead of on the heap when set
+    apr_pool_t *pool;
+    server_rec *server;
+    request_rec *r;
+    apr_array_header_t *headers;
+    const char *app_id;
+};
+
+// a post request between post_request_start and post_request_end, has to stay in place while the transfer runs
+typedef struct post_request_state_t {
+    struct response_t response;
+    char errbuf[CURL_ERROR_SIZE];
+} post_request_state;
+
 const char *get_request_ip(const request_rec *r, const px_config *conf);
 const char *pescape_urlencoded(apr_pool_t *p, const char *str);
 int extract_payload_from_header(apr_pool_t *pool, apr_table_t *headers, const char **payload3, const char **payload1);
-CURLcode post_request_helper(CURL* curl, const char *url, const char *payload, long timeout, px_config *conf, server_rec *server, char **response_data);
-CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, const char *vid, px_config *conf, request_rec *r, const char **response_data,  apr_array_header_t **response_headers, int *content_size);
+// http version, keepalive and fast open options of every handle talking to PerimeterX
+void set_connection_options(CURL *curl, const char *url, const px_config *conf);
+// sets up curl for a request that only leaves an idle connection to url behind, warm_connection_end has to follow
+void warm_connection_start(CURL *curl, const char *url, px_config *conf);
+void warm_connection_end(CURL *curl);
+// authorization and content type headers of the posts to PerimeterX, released by the caller
+struct curl_slist *post_request_headers(px_config *conf);
+// sets up the options every post to url shares, once per handle. headers have to outlive the handle.
+void post_request_init(CURL *curl, const char *url, struct curl_slist *headers, px_config *conf);
+// sets the body and the deadline of a post on a handle set up by post_request_init, the transfer is then run by the
+// caller. curl has to come from a curl_pool, the response is written to its buffer.
+void post_request_start(post_request_state *state, CURL *curl, const char *payload, long timeout, server_rec *server);
+// checks the transfer result, must follow every post_request_start. response_data points into the buffer of the handle
+// and is valid until the handle is used again, NULL on failure.
+CURLcode post_request_end(post_request_state *state, CURL *curl, CURLcode status, px_config *conf, const char **response_data);
+CURLcode post_request_helper(CURL* curl, const char *payload, long timeout, px_config *conf, server_rec *server, const char **response_data);
+CURLcode redirect_helper(CURL* curl, const char *base_url, const char *uri, const char *vid, long timeout, px_config *conf, request_rec *r, const char **response_data,  apr_array_header_t **response_headers, int *content_size);
 #endif
@@ -0,0 +1,71 @@
+use strict;
+use warnings FATAL => 'all';
+
+use Apache::Test;
+use Apache::TestRequest qw(GET GET_BODY);
+use IO::Socket::INET;
+
+# must match the px_breaker_ramp virtual host
+my $port = 18554;
+my $threshold = 5;
+
+my $requests = 30;
+my $samples = 10;
+
+plan tests => 4;
+
+Apache::TestRequest::module('px_breaker_ramp');
+
+# status counters of the Risk API breaker, which lives in shared memory and reads the same from every child
+sub risk_breaker {
+    for (1..$samples) {
+        my %status = GET_BODY('/server-status?auto') =~ /^(\w+): (\d+)$/mg;
+        return \%status if defined $status{PXRiskBreakerTrips};
+    }
+    return {};
+}
+
+# nothing listens on the port yet, every Risk API call fails to connect until the breaker opens
+GET '/index.html', 'User-Agent' => "breaker-ramp-outage-$_" for 1..($threshold * 2);
+sleep 1;
+my $outage = risk_breaker();
+
+# the stand-in answers the health check and every Risk API call with a passing score
+my $listener = IO::Socket::INET->new(LocalAddr => '127.0.0.1', LocalPort => $port, Listen => 16, ReuseAddr => 1)
+    or die "listen failed: $!";
+my $server = fork;
+die "fork failed" unless defined $server;
+if (!$server) {
+    while (my $client = $listener->accept) {
+        my $length = 0;
+        while (defined(my $line = <$client>)) {
+            $length = $1 if $line =~ /^Content-Length:\s*(\d+)/i;
+            last if $line eq "\r\n";
+        }
+        read $client, my $body, $length if $length;
+        my $response = '{"status":0,"uuid":"00000000-0000-0000-0000-000000000000","score":0,"action":"c"}';
+        print $client "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " . length($response)
+            . "\r\nConnection: close\r\n\r\n$response";
+        close $client;
+    }
+    exit 0;
+}
+close $listener;
+
+# a probe finds the stand-in and starts the ramp, early on most requests pass without calling the Risk API
+sleep 1;
+GET '/index.html', 'User-Agent' => "breaker-ramp-recovery-$_" for 1..$requests;
+my $recovery = risk_breaker();
+
+kill 'TERM', $server;
+waitpid $server, 0;
+
+my $tripped = ($outage->{PXRiskBreakerTrips} // 0) >= 1;
+my $probed = ($recovery->{PXRiskBreakerProbes} // 0) >= 1;
+my $ramped = ($recovery->{PXRiskBreakerRamped} // 0) > 0;
+my $ramping = ($recovery->{PXRiskBreakerAdmitPercent} // 100) < 100;
+
+ok $tripped;
+ok $probed;
+ok $ramped;
+ok $ramping;
@@ -0,0 +1,82 @@
+use strict;
+use warnings FATAL => 'all';
+
+use Apache::Test;
+use Apache::TestRequest qw(GET GET_BODY);
+use File::Path qw(make_path remove_tree);
+
+# must match the px_http2 virtual host
+my $port = 18553;
+my $io_threads = 2;
+
+my $clients = 16;
+my $requests = 10;
+my $samples = 10;
+
+sub in_path {
+    my $tool = shift;
+    return grep { -x "$_/$tool" } split /:/, $ENV{PATH};
+}
+
+plan tests => 5, need({ 'nghttpd and openssl are needed for the HTTP/2 stand-in' => in_path('nghttpd') && in_path('openssl') });
+
+Apache::TestRequest::module('px_http2');
+
+# the stand-in answers every Risk API call with a passing score, over TLS with a certificate for 127.0.0.1
+my $dir = Apache::Test::vars('serverroot') . '/h2';
+make_path("$dir/htdocs/api/v2", "$dir/htdocs/api/v1/kpi");
+open my $risk, '>', "$dir/htdocs/api/v2/risk" or die $!;
+print $risk '{"status":0,"uuid":"00000000-0000-0000-0000-000000000000","score":0,"action":"c"}';
+close $risk;
+open my $kpi, '>', "$dir/htdocs/api/v1/kpi/status" or die $!;
+close $kpi;
+system('openssl', 'req', '-x509', '-newkey', 'rsa:2048', '-nodes', '-days', '1', '-subj', '/CN=127.0.0.1',
+    '-addext', 'subjectAltName=IP:127.0.0.1', '-keyout', "$dir/key.pem", '-out', "$dir/cert.pem") == 0
+    or die "openssl failed";
+
+my $server = fork;
+die "fork failed" unless defined $server;
+if (!$server) {
+    open STDOUT, '>', '/dev/null';
+    open STDERR, '>', '/dev/null';
+    exec 'nghttpd', '-d', "$dir/htdocs", $port, "$dir/key.pem", "$dir/cert.pem";
+    exit 1;
+}
+sleep 1;
+
+# concurrent requests without a cookie, every one asks the Risk API
+my @pids;
+for my $client (1..$clients) {
+    my $pid = fork;
+    die "fork failed" unless defined $pid;
+    if (!$pid) {
+        GET '/index.html', 'User-Agent' => "http2-client-$client" for 1..$requests;
+        exit 0;
+    }
+    push @pids, $pid;
+}
+waitpid $_, 0 for @pids;
+
+# counters are per child, sample the status page of whichever children answer. with h2 each io thread keeps a single
+# connection to the stand-in, however many calls run at the same time.
+my ($completed, $connects_bounded, $handshakes_bounded, $rtt_reported) = (0, 1, 1, 0);
+my $reported = 0;
+for (1..$samples) {
+    my %status = GET_BODY('/server-status?auto') =~ /^(\w+): (\d+)$/mg;
+    next unless defined $status{PXIOConnects};
+    $reported = 1;
+    $completed = 1 if $status{PXIOCompleted} > 0;
+    $connects_bounded = 0 if $status{PXIOConnects} > $io_threads;
+    $handshakes_bounded = 0 if $status{PXIOTLSHandshakes} > $status{PXIOConnects};
+    $rtt_reported = 1 if defined $status{PXIORttP99Ms};
+}
+
+kill 'TERM', $server;
+waitpid $server, 0;
+remove_tree($dir);
+
+ok $reported;
+ok $completed;
+ok $connects_bounded;
+ok $handshakes_bounded;
+ok $rtt_reported;
@@ -0,0 +1,53 @@
+use strict;
+use warnings FATAL => 'all';
+
+use Apache::Test;
+use Apache::TestRequest qw(GET GET_BODY);
+use Digest::SHA qw(hmac_sha256_hex);
+use MIME::Base64 qw(encode_base64);
+use Time::HiRes qw(time);
+
+# must match the px_key_derivation_budget virtual host
+my $cookie_key = 'perimeterx';
+my $budget = 1000;
+my $burst = 10000;
+
+my $iterations = 10000;
+my $requests = 50;
+my $samples = 10;
+my $user_agent = 'key-derivation-flood';
+
+plan tests => 3;
+
+Apache::TestRequest::module('px_key_derivation_budget');
+
+# correctly signed v3 cookie with a fresh salt, every one needs a key derivation and then fails to decrypt
+sub flood_cookie {
+    my $n = shift;
+    my $salt = encode_base64(pack('NN', $n, $$), '');
+    my $payload = encode_base64(join('', map { chr(int(rand(256))) } 1..48), '');
+    my $signed = "$salt:$iterations:$payload";
+    return '_px3=' . hmac_sha256_hex($signed . $user_agent, $cookie_key) . ":$signed";
+}
+
+# the bucket holds at most the burst when the flood starts, and refills by the budget while it runs
+my $start = time;
+for my $n (1..$requests) {
+    GET '/index.html', 'User-Agent' => $user_agent, 'Cookie' => flood_cookie($n);
+}
+
+# counters are per child, sample the status page of whichever children answer
+my ($reported, $bounded, $throttled) = (0, 1, 0);
+for (1..$samples) {
+    my %status = GET_BODY('/server-status?auto') =~ /^(\w+): (\d+)$/mg;
+    next unless defined $status{PXKeyDerivations};
+    $reported = 1;
+    # a derivation started within the budget may overdraw it by one cookie
+    my $allowed = $burst + $budget * (time - $start) + $iterations;
+    $bounded = 0 if $status{PXKeyDerivations} * $iterations > $allowed;
+    $throttled = 1 if $status{PXKeyDerivationsThrottled} > 0;
+}
+
+ok $reported;
+ok $bounded;
+ok $throttled;